@@ -68,11 +68,23 @@ int main()
 
     BMPExporter exporter(img);
     // ASCIIExporter exporter(img);
-    exporter.Export(os);
+    {
+        RenderStats::ScopedTimer timer(renderer.stats.Seconds(RenderStats::Phase::kExport));
+        exporter.Export(os);
+    }
     // exporter.Export(std::cout);
 
     os.close();
 
+    std::ofstream stats_os("./cornellbox_stats.json");
+    renderer.stats.ExportJSON(stats_os);
+
+    if (Trace::Enabled())
+    {
+        std::ofstream trace_os("./cornellbox_trace.json");
+        Trace::Write(trace_os);
+    }
+
     std::cout << "Completed.\n";
 
     return 0;
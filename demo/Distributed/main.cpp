@@ -0,0 +1,60 @@
+#include <RenderToy/rendertoy.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+using namespace RenderToy;
+
+int main(int argc, char **argv)
+{
+    const std::size_t worker_count = argc > 1 ? std::atoi(argv[1]) : 4;
+
+    World world;
+    OBJModelImporter::Import(world, "./cornellbox.obj");
+    Vector3f light_color = Convert::BlackBody(6000) * 2.0f;
+
+    PrincipledBSDF mat_red(Vector3f::X);
+    PrincipledBSDF mat_green(Vector3f::Y);
+    PrincipledBSDF mat_white(Vector3f::White);
+    PrincipledBSDF mat_light(Vector3f::White, light_color);
+    PrincipledBSDF mat_glass(1.0f * Vector3f::White, Vector3f::O, 0.0f, 0.0f, 1.0f, 1.33f);
+
+    world.meshes[0]->tex = &mat_white;
+    world.meshes[3]->tex = &mat_red;
+    world.meshes[4]->tex = &mat_green;
+    world.meshes[1]->tex = &mat_white;
+    world.meshes[2]->tex = &mat_glass;
+    world.meshes[5]->tex = &mat_light;
+    world.PrepareDirectLightSampling();
+
+    world.cameras.push_back(academy_format);
+    Matrix4x4f camera_mat4 = AffineTransformation::Translation({0.0f, 0.0f, 10.0f});
+    camera_mat4 = AffineTransformation::Translation({0.0f, 0.0f, 2.0f}) * AffineTransformation::RotationEulerXYZ({0.0f, 0.0f, Convert::DegreeToRadians(-90)}) * AffineTransformation::RotationEulerXYZ({Convert::DegreeToRadians(90), 0.0f, 0.0f}) * camera_mat4;
+    world.cameras[0].SetO2W(camera_mat4);
+
+    std::cout << "Rendering with " << worker_count << " worker(s)...\n";
+
+    RenderCoordinator coordinator(&world, FormatSettings(SizeN(640, 360), Vector2f(16.0f, 9.0f)), 64, worker_count);
+    coordinator.split = WorkSplit::kTilesAndSamples;
+    coordinator.sample_chunks = 2;
+
+    auto t1 = std::chrono::system_clock::now();
+    Image img = coordinator.Render();
+    auto t2 = std::chrono::system_clock::now();
+    std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << std::endl;
+
+    img.Tonemap();
+    img.GammaCorrection();
+
+    std::ofstream os;
+    os.open("./distributed.bmp");
+    BMPExporter exporter(img);
+    exporter.Export(os);
+    os.close();
+
+    std::cout << "Completed.\n";
+
+    return 0;
+}
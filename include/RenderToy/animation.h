@@ -0,0 +1,46 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtmath.h"
+
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Transform keyframe. Channels follow Blender conventions and are interpolated one by one.
+    struct TransformKey
+    {
+        float frame = 0.0f;
+        Vector3f location;
+        /// @brief XYZ-Euler angles, in radius.
+        Vector3f rotation_euler;
+
+        TransformKey() = default;
+        TransformKey(const float frame_, const Vector3f &location_, const Vector3f &rotation_euler_ = Vector3f::O);
+
+        /// @brief Get the O2W matrix of the key.
+        /// @return
+        const Matrix4x4f O2W() const;
+    };
+
+    /// @brief Animated transform, linear between keys. Holds the first and last key outside their range.
+    struct TransformTrack
+    {
+        /// @brief Keys sorted by frame.
+        std::vector<TransformKey> keys;
+
+        TransformTrack() = default;
+        TransformTrack(const std::vector<TransformKey> &keys_);
+
+        /// @brief Insert a key, keeping keys sorted.
+        /// @param key
+        void Insert(const TransformKey &key);
+        /// @brief Evaluate the transform at a (fractional) frame.
+        /// @param frame
+        /// @return
+        const TransformKey Evaluate(const float frame) const;
+        const bool Empty() const;
+    };
+}
+
+#endif // ANIMATION_H
@@ -22,13 +22,16 @@ namespace RenderToy
         /// @param t_min 
         /// @param t_max 
         /// @return 
-        const bool Intersect(const Ray &ray, float &t_min, float &t_max);
+        const bool Intersect(const Ray &ray, float &t_min, float &t_max) const;
         /// @brief Extends by another bbox.
         /// @param bbox
         void ExtendBy(const BoundingBox &bbox);
         /// @brief Get center point of bbox.
         /// @return 
         const Vector3f Centroid() const;
+        /// @brief Get surface area of bbox.
+        /// @return
+        const float SurfaceArea() const;
 
         const Triangle *object{nullptr};
     };
@@ -38,9 +41,17 @@ namespace RenderToy
     {
         OctreeNode *child[8];
         std::vector<const BoundingBox *> node_bbox_list;
+        /// @brief Bounds at shutter open.
         BoundingBox bbox;
+        /// @brief Bounds at shutter close. Bounds in between are interpolated linearly.
+        BoundingBox bbox_close;
         bool is_leaf;
         OctreeNode();
+
+        /// @brief Get bounds at a time in the shutter interval.
+        /// @param time
+        /// @return
+        const BoundingBox Bounds(const float time) const;
         ~OctreeNode();
     };
 
@@ -50,6 +61,12 @@ namespace RenderToy
         Octree(const BoundingBox &tree_bbox_);
         void Insert(const BoundingBox *bbox_insert);
         void Build();
+        /// @brief Recompute node bounds from the inserted bboxes, keeping the tree topology.
+        /// Shutter close bounds are taken from the triangles of the bboxes.
+        void Refit();
+        /// @brief Get the sum of surface areas of all nodes, an estimate of traversal cost.
+        /// @return
+        const float Cost() const;
         ~Octree();
         struct QueueElement
         {
@@ -67,6 +84,8 @@ namespace RenderToy
     private:
         void Insert(OctreeNode *&node, const BoundingBox *bbox_insert, const BoundingBox &bbox, int depth);
         void Build(OctreeNode *&node, const BoundingBox &bbox);
+        const bool Refit(OctreeNode *node);
+        const float Cost(const OctreeNode *node) const;
         void RecursiveDelete(OctreeNode *&node);
     };
 
@@ -80,7 +99,23 @@ namespace RenderToy
         const Triangle *Intersect(const Ray &ray, Vector3f &position, float &t, float &u, float &v, const Triangle *const exclude) const;
         ~BVH();
 
+        /// @brief Update bounds after triangles moved. Cheap, but the tree degrades as triangles drift from where they were inserted.
+        void Refit();
+        /// @brief Rebuild the tree from the current triangle positions.
+        void Rebuild();
+        /// @brief Get the traversal cost relative to a fresh build. 1 right after Rebuild().
+        /// @return
+        const float Degradation() const;
+
+    private:
+        void Build();
+
+        float build_cost = 0.0f;
+        /// @brief Whether any triangle moves while the shutter is open. Otherwise shutter close bounds are ignored.
+        bool motion = false;
+
 #ifdef DISABLE_BVH
+    public:
         std::vector<Triangle *> *models;
 #endif
     };
@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "renderer.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace RenderToy
+{
+    /// @brief Saves and restores the accumulation state of a path tracing render.
+    /// A checkpoint stores the render settings, the number of finished iterations, the random seed and the accumulation buffer.
+    class RenderCheckpoint
+    {
+    public:
+        RenderCheckpoint() = delete;
+        RenderCheckpoint(const RenderCheckpoint &) = delete;
+        RenderCheckpoint(const RenderCheckpoint &&) = delete;
+
+        /// @brief Write a checkpoint of renderer into stream.
+        /// @param renderer
+        /// @param os
+        static void Save(const PathTracingRenderer &renderer, std::ostream &os);
+        /// @brief Write a checkpoint of renderer into file. The file is replaced only after the checkpoint is completely written.
+        /// @param renderer
+        /// @param path
+        static void Save(const PathTracingRenderer &renderer, const std::string &path);
+
+        /// @brief Restore renderer from a checkpoint. The next Render() call continues where the checkpoint was taken.
+        /// Throws InvalidCheckpointException on malformed data and CheckpointNotMatchException if the render settings differ.
+        /// @param renderer
+        /// @param is
+        static void Load(PathTracingRenderer &renderer, std::istream &is);
+        /// @brief Restore renderer from a checkpoint file.
+        /// @param renderer
+        /// @param path
+        static void Load(PathTracingRenderer &renderer, const std::string &path);
+    };
+}
+
+#endif // CHECKPOINT_H
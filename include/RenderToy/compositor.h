@@ -64,6 +64,8 @@ namespace RenderToy
 
         Vector3f *buffer;
 
+        static void Paste(const Image &src, const PointN &origin, Image &dst);
+
     public:
         /// @brief Sample mode for sampling and resizing.
         enum class SampleMode
@@ -77,7 +79,7 @@ namespace RenderToy
         /// @brief Construct an image with given resolution.
         /// @param resolution_ 
         Image(const SizeN &resolution_);
-        /// @brief Construct an image with given render context.
+        /// @brief Construct an image with the buffer of given render context. Includes the overscan of a render region.
         /// @param render_context_ 
         Image(const RenderContext *const render_context_);
         /// @brief Construct an image with another image.
@@ -280,6 +282,18 @@ namespace RenderToy
         /// @param color
         void Fill(PointN p1, PointN p2, const Vector3f &color = Vector3f::White);
 
+        /// @brief Cut out a rectangular area. Pixels outside the image are black.
+        /// @param origin Top-left pixel of the area.
+        /// @param size
+        /// @return
+        [[nodiscard]] const Image Crop(PointN origin, const SizeN &size) const;
+
+        /// @brief Copy img onto self with its top-left pixel at origin. Pixels outside self are dropped.
+        /// @param img
+        /// @param origin
+        /// @return Reference to self.
+        Image &Paste(const Image &img, const PointN &origin);
+
         // template <SampleMode _SM = SampleMode::kNearestNeighbor>
         // const Image Resize(const SizeN &new_size) const
         // {
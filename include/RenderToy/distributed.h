@@ -0,0 +1,73 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtmath.h"
+#include "renderer.h"
+#include "compositor.h"
+#include "world.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief How a frame is split into work items.
+    enum class WorkSplit
+    {
+        /// @brief Each item renders all iterations of one bucket.
+        kTiles = 0,
+        /// @brief Each item renders a share of the iterations of the whole frame.
+        kSamples,
+        /// @brief Each item renders a share of the iterations of one bucket.
+        kTilesAndSamples
+    };
+
+    /// @brief A piece of a frame rendered by one worker.
+    struct WorkItem
+    {
+        RenderRegion region;
+        /// @brief First sample of each pixel, so that items sharing pixels draw different samples.
+        int first_iteration;
+        int iteration_count;
+    };
+
+    /// @brief Renders a frame with several worker processes and merges their results.
+    /// Workers talk to the coordinator over a pair of file descriptors each. Render() forks them on the local host and connects them with pipes,
+    /// a remote worker only has to run Serve() on the two ends of a socket.
+    class RenderCoordinator
+    {
+    public:
+        World *world;
+        FormatSettings format_settings;
+        int camera_id = 0;
+        int iteration_count;
+        /// @brief Seed of the random sequences. The merged frame matches a single process render with the same seed.
+        uint64_t seed = 0;
+
+        std::size_t worker_count;
+        WorkSplit split = WorkSplit::kTiles;
+        SizeN bucket_size = SizeN(64, 64);
+        /// @brief Number of iteration ranges per pixel for sample splits. 0 uses one range per worker.
+        int sample_chunks = 0;
+        /// @brief OpenMP threads of each worker. 0 keeps the default.
+        int threads_per_worker = 1;
+
+        RenderCoordinator(World *world_, const FormatSettings &format_settings_, const int iteration_count_, const std::size_t worker_count_);
+
+        /// @brief Split the frame into work items.
+        /// @return
+        const std::vector<WorkItem> Split() const;
+
+        /// @brief Render the frame with worker_count forked workers. Items of a worker that dies are handed to the others.
+        /// Workers are forked from the calling process, call it before the process enters its first OpenMP parallel region.
+        /// @return The merged frame.
+        const Image Render();
+
+        /// @brief Worker loop. Render the items read from in_fd and write the results to out_fd until in_fd is closed.
+        /// @param in_fd
+        /// @param out_fd
+        void Serve(const int in_fd, const int out_fd) const;
+    };
+}
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,118 @@
+#ifndef DISTRIBUTION_H
+#define DISTRIBUTION_H
+
+#include "rtmath.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Walker alias table. Draws an index proportional to its weight in O(1).
+    struct AliasTable
+    {
+        /// @brief Construct an empty alias table.
+        AliasTable() = default;
+        /// @brief Construct an alias table from non-negative weights.
+        /// @param weights
+        AliasTable(const std::vector<float> &weights);
+
+        /// @brief (Re)build the table. Falls back to a uniform distribution when all weights are zero.
+        /// @param weights
+        void Build(const std::vector<float> &weights);
+
+        /// @brief Draw an index.
+        /// @param u Uniform random number in [0, 1).
+        /// @param pmf_o Probability of the returned index.
+        /// @return
+        const std::size_t Sample(const float u, float &pmf_o) const;
+
+        /// @brief Get the probability of drawing given index.
+        /// @param index
+        /// @return
+        const float PMF(const std::size_t index) const;
+
+        const std::size_t Size() const;
+        const bool Empty() const;
+
+    private:
+        struct Bin
+        {
+            float threshold;
+            float pmf;
+            std::size_t alias;
+        };
+        std::vector<Bin> bins;
+    };
+
+    /// @brief Piecewise constant distribution over [0, 1). Draws a continuous value proportional to its weight by inverting a CDF.
+    struct Distribution1D
+    {
+        /// @brief Construct an empty distribution.
+        Distribution1D() = default;
+        /// @brief Construct a distribution from non-negative weights of equally wide pieces.
+        /// @param weights
+        Distribution1D(const std::vector<float> &weights);
+
+        /// @brief (Re)build the distribution. Falls back to a uniform distribution when all weights are zero.
+        /// @param weights
+        void Build(const std::vector<float> &weights);
+
+        /// @brief Draw a value.
+        /// @param u Uniform random number in [0, 1).
+        /// @param pdf_o Density of the returned value.
+        /// @param index_o Piece containing the returned value.
+        /// @return Value in [0, 1).
+        const float Sample(const float u, float &pdf_o, std::size_t &index_o) const;
+
+        /// @brief Get the density of drawing given value.
+        /// @param x Value in [0, 1).
+        /// @return
+        const float PDF(const float x) const;
+
+        /// @brief Get the integral of the weights over [0, 1), that is, their mean.
+        /// @return
+        const float Integral() const;
+
+        const std::size_t Size() const;
+        const bool Empty() const;
+
+    private:
+        std::vector<float> weights;
+        /// @brief Size() + 1 entries, from 0 to 1.
+        std::vector<float> cdf;
+        float integral = 0.0f;
+    };
+
+    /// @brief Piecewise constant distribution over [0, 1)^2, sampled by a marginal distribution over rows and a conditional one in each row.
+    struct Distribution2D
+    {
+        /// @brief Construct an empty distribution.
+        Distribution2D() = default;
+
+        /// @brief (Re)build the distribution.
+        /// @param weights Non-negative weights of size.Area() equally large pieces, row by row.
+        /// @param size
+        void Build(const std::vector<float> &weights, const SizeN &size);
+
+        /// @brief Draw a point.
+        /// @param u Uniform random number in [0, 1), picks the column.
+        /// @param v Uniform random number in [0, 1), picks the row.
+        /// @param pdf_o Density of the returned point.
+        /// @return Point in [0, 1)^2.
+        const Vector2f Sample(const float u, const float v, float &pdf_o) const;
+
+        /// @brief Get the density of drawing given point.
+        /// @param p Point in [0, 1)^2.
+        /// @return
+        const float PDF(const Vector2f &p) const;
+
+        const bool Empty() const;
+
+    private:
+        std::vector<Distribution1D> conditional;
+        Distribution1D marginal;
+    };
+}
+
+#endif // DISTRIBUTION_H
@@ -0,0 +1,56 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtmath.h"
+#include "distribution.h"
+
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Lat-long environment map, lighting the scene from infinitely far away.
+    /// Columns run over phi from -pi to pi around +Z, rows over theta from +Z (top row) to -Z.
+    class EnvironmentMap
+    {
+    public:
+        /// @brief Scale of all texels.
+        float intensity = 1.0f;
+
+        /// @brief Construct a black environment map.
+        /// @param resolution_
+        EnvironmentMap(const SizeN &resolution_);
+
+        Vector3f &operator()(const std::size_t x, const std::size_t y);
+        const Vector3f &operator()(const std::size_t x, const std::size_t y) const;
+        const SizeN &Resolution() const;
+
+        /// @brief A must-evaluate function (for sampling) building the distribution of texels. Called by World::PrepareDirectLightSampling().
+        void Prepare();
+
+        /// @brief Get the radiance arriving from direction.
+        /// @param direction Normalized direction towards the environment, in WORLD SPACE.
+        /// @return
+        const Vector3f Eval(const Vector3f &direction) const;
+        /// @brief Sample a direction proportional to the radiance arriving from it.
+        /// @param u Uniform random number in [0, 1).
+        /// @param v Uniform random number in [0, 1).
+        /// @param direction_o Normalized direction towards the environment, in WORLD SPACE.
+        /// @param pdf_o Solid angle pdf of direction_o.
+        /// @return Radiance arriving from direction_o.
+        const Vector3f Sample(const float u, const float v, Vector3f &direction_o, float &pdf_o) const;
+        /// @brief Get the solid angle pdf of Sample() returning direction.
+        /// @param direction Normalized direction towards the environment, in WORLD SPACE.
+        /// @return
+        const float PDF(const Vector3f &direction) const;
+
+    private:
+        SizeN resolution;
+        std::vector<Vector3f> texels;
+        Distribution2D distribution;
+
+        static const Vector2f ToLatLong(const Vector3f &direction);
+        const Vector3f &Texel(const Vector2f &uv) const;
+    };
+}
+
+#endif // ENVIRONMENT_H
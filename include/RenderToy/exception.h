@@ -18,4 +18,34 @@ namespace RenderToy::Exception
     public:
         ImageSizeNotMatchException(const std::string &exception_what_) noexcept;
     };
+
+    class InvalidCheckpointException : public IRenderToyException
+    {
+    public:
+        InvalidCheckpointException(const std::string &exception_what_) noexcept;
+    };
+
+    class CheckpointNotMatchException : public IRenderToyException
+    {
+    public:
+        CheckpointNotMatchException(const std::string &exception_what_) noexcept;
+    };
+
+    class WorkerException : public IRenderToyException
+    {
+    public:
+        WorkerException(const std::string &exception_what_) noexcept;
+    };
+
+    class InvalidImageException : public IRenderToyException
+    {
+    public:
+        InvalidImageException(const std::string &exception_what_) noexcept;
+    };
+
+    class TooManyMaterialsException : public IRenderToyException
+    {
+    public:
+        TooManyMaterialsException(const std::string &exception_what_) noexcept;
+    };
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "rtmath.h"
+#include "bvh.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Incident radiance learned online for path guiding.
+    /// Space is split into a uniform grid of cells, each holding a directional histogram over the sphere.
+    /// Directions are binned by (cos(theta), phi), so all bins cover the same solid angle.
+    class GuidingField
+    {
+    public:
+        static constexpr std::size_t kCosThetaBins = 8;
+        static constexpr std::size_t kPhiBins = 16;
+        static constexpr std::size_t kBins = kCosThetaBins * kPhiBins;
+
+        GuidingField() = default;
+
+        /// @brief Discard everything learned and cover new bounds.
+        /// @param bounds_ Bounds of the scene. Positions outside are clamped into the border cells.
+        /// @param resolution_ Number of cells along the longest axis of bounds_.
+        void Reset(const BoundingBox &bounds_, const std::size_t resolution_ = 16);
+        /// @brief Release all cells.
+        void Clear();
+        const bool Empty() const;
+
+        /// @brief Whether the cell containing position has learned anything it can be sampled from.
+        /// @param position
+        /// @return
+        const bool Trained(const Vector3f &position) const;
+        /// @brief Sample a direction proportional to the radiance learned around position.
+        /// Directions below the surface are mirrored above it, a cell shared by several surfaces wastes no samples.
+        /// @param position
+        /// @param normal Normal of the surface at position, in WORLD SPACE.
+        /// @param pdf_o Solid angle pdf of the direction.
+        /// @return Normalized direction in WORLD SPACE.
+        const Vector3f Sample(const Vector3f &position, const Vector3f &normal, float &pdf_o) const;
+        /// @brief Get the solid angle pdf of Sample() returning direction.
+        /// @param position
+        /// @param normal Normal of the surface at position, in WORLD SPACE.
+        /// @param direction Normalized direction in WORLD SPACE.
+        /// @return Zero if the cell is not trained or direction is below the surface.
+        const float PDF(const Vector3f &position, const Vector3f &normal, const Vector3f &direction) const;
+
+        /// @brief Record a radiance estimate arriving at position. Thread safe.
+        /// Estimates are summed in fixed point, so the result does not depend on the order of records.
+        /// @param position
+        /// @param direction Direction the radiance arrives from.
+        /// @param value Luma of the radiance divided by the pdf of direction.
+        void Record(const Vector3f &position, const Vector3f &direction, const float value);
+        /// @brief Add everything recorded since the last update to the sampling distributions.
+        void Update();
+
+    private:
+        const std::size_t Cell(const Vector3f &position) const;
+        const float BinPDF(const std::size_t cell, const Vector3f &direction) const;
+        static const std::size_t Bin(const Vector3f &direction);
+
+        BoundingBox bounds;
+        Vector3f cell_size;
+        std::size_t resolution[3] = {0, 0, 0};
+
+        // Recorded since the last update, per cell and bin.
+        std::vector<std::atomic<uint64_t>> recorded;
+        // Everything learned, per cell and bin.
+        std::vector<uint64_t> learned;
+        // Per cell CDF over bins, built from learned. The last entry of a cell is 0 if it has not learned anything.
+        std::vector<float> cdf;
+    };
+}
+
+#endif // GUIDING_H
@@ -5,6 +5,7 @@
 
 #include "object.h"
 #include "world.h"
+#include "texture.h"
 
 #include <string>
 #include <vector>
@@ -19,13 +20,15 @@ namespace RenderToy
         OBJModelImporter(const OBJModelImporter &) = delete;
         OBJModelImporter(const OBJModelImporter &&) = delete;
 
-        /// @brief Import OBJ file from path into world.
+        /// @brief Import OBJ file from path into world. Vertex tangents are computed for every mesh.
         /// @param world 
         /// @param path 
         static void Import(World &world, const std::string &path);
     };
 
     /// @brief Import Wavefront MTL Material. (With PBR extension support)
+    /// TGA maps map_Kd, map_Pr and map_Pm drive base color, roughness and metallic, they are added to World::textures.
+    /// norm is a tangent space normal map, and bump or map_Bump a height map scaled by its -bm option.
     class MTLImporter
     {
     public:
@@ -37,7 +40,21 @@ namespace RenderToy
         static void Import(World &world, const std::string &path);
     };
 
-    /// @brief (WIP) Import TARGA image file.
+    /// @brief Import Radiance RGBE (.hdr) image file as lat-long environment map.
+    class RGBEImporter
+    {
+    public:
+        RGBEImporter() = delete;
+        RGBEImporter(const RGBEImporter &) = delete;
+        RGBEImporter(const RGBEImporter &&) = delete;
+
+        /// @brief Import HDR file from path as the environment of world, deleting the previous one. Throws InvalidImageException on malformed files.
+        /// @param world
+        /// @param path
+        static void Import(World &world, const std::string &path);
+    };
+
+    /// @brief Import TARGA image file as texture. Uncompressed and run length encoded true color or grayscale images.
     class TARGAImporter
     {
     public:
@@ -45,7 +62,12 @@ namespace RenderToy
         TARGAImporter(const TARGAImporter &) = delete;
         TARGAImporter(const TARGAImporter &&) = delete;
 
-        // static void Import(ImageTexture &image, const std::string &path);
+        /// @brief Import TGA file from path. Throws InvalidImageException on malformed or unsupported files.
+        /// @param path
+        /// @param srgb Decode sRGB encoded colors to linear, otherwise texels are taken as they are (e.g. roughness maps).
+        /// @param cache Cache the texture loads its tiles into.
+        /// @return The texture, owned by the caller.
+        static ImageTexture *Import(const std::string &path, const bool srgb = true, TileCache *cache = &TileCache::Global());
     };
 };
 
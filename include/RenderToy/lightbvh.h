@@ -0,0 +1,98 @@
+#ifndef LIGHTBVH_H
+#define LIGHTBVH_H
+
+#include "rtmath.h"
+#include "bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RenderToy
+{
+    class Triangle;
+
+    /// @brief Spatial and directional bounds of a set of emitters.
+    struct LightBounds
+    {
+        BoundingBox bbox;
+        /// @brief Average emitting direction.
+        Vector3f axis;
+        /// @brief Cosine of the cone angle bounding all normals around axis.
+        float cos_theta_o = 1.0f;
+        /// @brief Cosine of the extra angle light spreads around each normal.
+        float cos_theta_e = 0.0f;
+        /// @brief Emitted power.
+        float phi = 0.0f;
+        bool two_sided = true;
+
+        LightBounds() = default;
+        LightBounds(const BoundingBox &bbox_, const Vector3f &axis_, const float phi_, const float cos_theta_o_, const float cos_theta_e_, const bool two_sided_);
+
+        /// @brief Estimate the contribution of these emitters to a receiver.
+        /// @param position Receiver position.
+        /// @param normal Receiver normal. Pass O for receivers without orientation.
+        /// @return
+        const float Importance(const Vector3f &position, const Vector3f &normal) const;
+
+        /// @brief Merge two bounds.
+        /// @param a
+        /// @param b
+        /// @return
+        static const LightBounds Union(const LightBounds &a, const LightBounds &b);
+    };
+
+    /// @brief Bounding volume hierarchy over emissive triangles, used to pick emitters by their estimated contribution.
+    class LightBVH
+    {
+    public:
+        LightBVH() = default;
+
+        /// @brief Build the hierarchy.
+        /// @param emitters Emissive triangles.
+        /// @param power Emitted power of each triangle.
+        void Build(const std::vector<const Triangle *> &emitters, const std::vector<float> &power);
+
+        /// @brief Choose an emitter for a receiver.
+        /// @param position Receiver position.
+        /// @param normal Receiver normal.
+        /// @param u Uniform random number in [0, 1).
+        /// @param index_o Index of the chosen emitter in the list passed to Build().
+        /// @param pmf_o Probability of the choice.
+        /// @return FALSE if no emitter can reach the receiver.
+        const bool Sample(const Vector3f &position, const Vector3f &normal, float u, std::size_t &index_o, float &pmf_o) const;
+
+        /// @brief Get the probability of Sample() choosing given emitter.
+        /// @param position
+        /// @param normal
+        /// @param index
+        /// @return
+        const float PMF(const Vector3f &position, const Vector3f &normal, const std::size_t index) const;
+
+        const bool Empty() const;
+
+    private:
+        struct Node
+        {
+            LightBounds bounds;
+            // Leaf: emitter index. Interior: index of the second child, the first child follows its parent.
+            std::size_t index;
+            bool is_leaf;
+        };
+
+        std::size_t Build(std::vector<std::size_t> &order, std::size_t begin, std::size_t end, const std::vector<LightBounds> &leaf_bounds, uint64_t bit_trail, int depth);
+        /// @brief Descend from the root to a leaf, shared by Sample() and PMF() so both reject the same nodes.
+        /// @param position
+        /// @param normal
+        /// @param choose Called with the probability of the first child at every interior node, returns TRUE to take the second.
+        /// @param leaf_o Node reached.
+        /// @return Probability of reaching leaf_o, 0 if a node on the way has no importance.
+        template <typename Choose>
+        const float Descend(const Vector3f &position, const Vector3f &normal, Choose &&choose, std::size_t &leaf_o) const;
+
+        std::vector<Node> nodes;
+        // Left/right decisions leading to every emitter, one bit per level.
+        std::vector<uint64_t> bit_trails;
+    };
+}
+
+#endif // LIGHTBVH_H
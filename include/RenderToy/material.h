@@ -3,11 +3,43 @@
 
 #include "rtmath.h"
 #include "ray.h"
+#include "texture.h"
 
+#include <array>
 #include <string>
+#include <vector>
 
 namespace RenderToy
 {
+    class FresnelTable;
+
+    /// @brief Up to kLanes shading queries of one material in SoA layout, evaluated at once by PrincipledBSDF::EvalBatch().
+    struct BSDFBatch
+    {
+        static constexpr std::size_t kLanes = 16;
+
+        std::size_t count = 0;
+        /// @brief Ray state of every query, for eta and the shading frame. Not owned.
+        std::array<const RayState *, kLanes> state;
+        // V, N and L of every query, as passed to PrincipledBSDF::Eval().
+        std::array<Vector3f, kLanes> v;
+        std::array<Vector3f, kLanes> n;
+        std::array<Vector3f, kLanes> l;
+
+        // Written by PrincipledBSDF::EvalBatch().
+        std::array<Vector3f, kLanes> color;
+        std::array<float, kLanes> pdf;
+
+        /// @brief Append a query.
+        /// @param state_ Must outlive the evaluation.
+        /// @param V
+        /// @param N
+        /// @param L
+        /// @return Lane of the query.
+        const std::size_t Push(const RayState &state_, const Vector3f &V, const Vector3f &N, const Vector3f &L);
+        const bool Full() const;
+    };
+
     /// @brief Disney Principled BSDF
     struct PrincipledBSDF
     {
@@ -29,6 +61,36 @@ namespace RenderToy
         float at_distance = 1.0f;
         Vector3f extinction = Vector3f::White;
 
+        /// @brief Textures replacing parameters at every shading point, see ApplyTextures(). Not owned.
+        const ITexture *base_color_texture = nullptr;
+        /// @brief Red channel replaces roughness.
+        const ITexture *roughness_texture = nullptr;
+        /// @brief Red channel replaces metallic.
+        const ITexture *metallic_texture = nullptr;
+        /// @brief Tangent space normal map perturbing the shading normal, see SurfacePoint::ApplyTextures(). Not owned.
+        /// Channels in [0, 1] map to [-1, 1] along the tangent, the bitangent (increasing v) and the normal.
+        const ITexture *normal_texture = nullptr;
+        /// @brief Height map perturbing the shading normal by the slope of its red channel. Not owned. Ignored if there is a normal map.
+        const ITexture *bump_texture = nullptr;
+        /// @brief Height of a bump map value of 1, in WORLD SPACE units.
+        float bump_scale = 1.0f;
+
+        /// @brief Lobes a material can scatter into. Prepare() picks the smallest kind that fits the parameters,
+        /// and Eval(), Sample() and PDF() run a kernel compiled without the lobes the kind leaves out.
+        enum class Kind
+        {
+            /// @brief All lobes.
+            kPrincipled,
+            /// @brief Diffuse and specular reflection. Not metallic, no transmission, sheen, subsurface or clearcoat.
+            kDiffuse,
+            /// @brief Specular reflection only. Fully metallic.
+            kConductor,
+            /// @brief Specular reflection and refraction. Not metallic, full transmission, no clearcoat.
+            kDielectric,
+            /// @brief Nothing, light is only emitted. Black, not metallic, no clearcoat and ior of 1.
+            kEmissive
+        };
+
         /// @brief Construct a default Principled BSDF object.
         PrincipledBSDF() = default;
         /// @brief Construct PrincipledBSDF. Explanations on parameters are copied from Principled BSDF section of Blender Manual.
@@ -63,17 +125,121 @@ namespace RenderToy
                        const float at_distance_ = 1.0f,
                        const Vector3f &extinction_ = Vector3f::White);
 
+        /// @brief Cache the shading terms that only depend on the parameters, for both sides of the surface.
+        /// Called by World::PrepareDirectLightSampling(). Call again after changing parameters of a prepared material.
+        void Prepare();
+        /// @brief Prepare(), and also cache the shading terms of the surfaces between this material and each medium of media_iors,
+        /// for rays in nested media. Iors of 1 are skipped, Prepare() covers vacuum. Media past kMaxInterfaces are compiled at every call.
+        /// Called by World::PrepareMaterials() with the ior of every transmissive material.
+        /// @param media_iors
+        void Prepare(const std::vector<float> &media_iors);
+        /// @brief Get the kind picked by Prepare(), kPrincipled if the material is not prepared.
+        /// @return
+        const Kind GetKind() const;
+        /// @brief Get the medium behind the surface, absorbing extinction of the light over at_distance.
+        /// The absorption coefficient is cached by Prepare().
+        /// @param material_id Id of this material in World::materials.
+        /// @return
+        const Medium GetMedium(const uint16_t material_id) const;
+
+        /// @brief Whether any parameter is driven by a texture.
+        /// @return
+        const bool Textured() const;
+        /// @brief Whether a normal or bump map perturbs the shading normal.
+        /// @return
+        const bool Perturbed() const;
+        /// @brief Take the parameters of shared, with the textured ones replaced by their values at uv.
+        /// Meant for a material made for one shading point. Only the constants for eta are compiled, and only if a texture changes them,
+        /// the others are read from shared along with the surfaces of nested media.
+        /// @param shared Material the textures belong to, must outlive this one.
+        /// @param uv
+        /// @param footprint Width of the area the lookup stands for, in UV units. Picks the level of every texture.
+        /// @param eta RayState::eta the point is shaded with.
+        /// @param misses Incremented by every texture tile that had to be loaded.
+        void ApplyTextures(const PrincipledBSDF &shared, const Vector2f &uv, const float footprint, const float eta, uint64_t &misses);
+
         const Vector3f Eval(const RayState state, Vector3f V, Vector3f N, Vector3f L, float &bsdf_pdf) const;
         const bool Sample(const Vector3f &in_dir, Vector3f &out_dir, Vector3f &color_o, float &pdf, RayState &state) const;
+        /// @brief Get the pdf of Sample() choosing L, summed over all lobes.
+        /// Unlike the pdf from Eval(), lobes are weighted the way Sample() picks them.
+        /// @param state
+        /// @param V
+        /// @param N
+        /// @param L
+        /// @return
+        const float PDF(const RayState state, Vector3f V, Vector3f N, Vector3f L) const;
+        /// @brief Eval() every query of batch, with the same results.
+        /// Picks the kernel of the kind once, and looks the constants up once per run of lanes with the same eta.
+        /// @param batch
+        void EvalBatch(BSDFBatch &batch) const;
 
     private:
-        const float FresnelMix(const float eta, const float VDotH) const;
-        const Vector3f EvalDiffuse(const Vector3f Csheen, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
-        const Vector3f EvalSpecReflection(const float eta, const Vector3f specCol, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
-        const Vector3f EvalSpecRefraction(const float eta, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
-        const Vector3f EvalClearcoat(const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
-        void GetSpecColor(const float eta, Vector3f &specCol, Vector3f &sheenCol) const;
-        void GetLobeProbabilities(const float eta, const Vector3f specCol, const float approxFresnel, float &diffuseWt, float &specReflectWt, float &specRefractWt, float &clearcoatWt) const;
+        /// @brief Shading terms independent of the directions, for one value of eta.
+        struct Constants
+        {
+            float eta;
+            Vector3f spec_color;
+            float spec_luma;
+            // Scaled by sheen.
+            Vector3f sheen_color;
+            // Scaled by 1 / pi.
+            Vector3f diffuse_color;
+            // Scale of the diffuse and sheen lobe, (1 - metallic) * (1 - spec_trans).
+            float diffuse_scale;
+            // Scaled by (1 - metallic) * spec_trans.
+            Vector3f refraction_color;
+            // Lobe weights before the Fresnel term and normalization.
+            float diffuse_weight;
+            float spec_refract_weight;
+            float clearcoat_weight;
+            // Log of the squared clearcoat roughness, normalizes GTR1.
+            float clearcoat_log;
+            // Tables of eta and of the clearcoat, null unless built with RENDERTOY_FRESNEL_TABLES.
+            const FresnelTable *fresnel = nullptr;
+            const FresnelTable *clearcoat_fresnel = nullptr;
+        };
+
+        const Constants Compile(const float eta) const;
+        /// @brief Compile the terms of c.eta, leaving its Fresnel tables as they are.
+        void CompileTerms(Constants &c) const;
+        const Kind Classify() const;
+        /// @brief Get the prepared constants for eta, or compile them into scratch if there are none.
+        const Constants &GetConstants(const float eta, Constants &scratch) const;
+        template <Kind K>
+        const Vector3f EvalKernel(const Constants &c, const RayState &state, Vector3f V, Vector3f N, Vector3f L, float &bsdf_pdf) const;
+        template <Kind K>
+        void EvalBatchKernel(BSDFBatch &batch) const;
+        template <Kind K>
+        const float PDFKernel(const Constants &c, const RayState &state, Vector3f V, Vector3f N, Vector3f L) const;
+        template <Kind K>
+        const bool SampleKernel(const Vector3f &in_dir, Vector3f &out_dir, Vector3f &color_o, float &pdf, RayState &state) const;
+
+        /// @brief DielectricFresnel() of c.eta, looked up in its table if there is one.
+        static const float Dielectric(const Constants &c, const float cos_theta_i);
+        template <Kind K>
+        const float FresnelMix(const Constants &c, const float VDotH) const;
+        template <Kind K>
+        const Vector3f EvalDiffuse(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
+        template <Kind K>
+        const Vector3f EvalSpecReflection(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
+        const Vector3f EvalSpecRefraction(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
+        const Vector3f EvalClearcoat(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const;
+        template <Kind K>
+        void GetLobeProbabilities(const Constants &c, const float approxFresnel, float &diffuseWt, float &specReflectWt, float &specRefractWt, float &clearcoatWt) const;
+
+        bool prepared = false;
+        Kind kind = Kind::kPrincipled;
+        // Leaving the surface uses eta = ior, entering it eta = 1 / ior.
+        Constants front;
+        Constants back;
+        // Surfaces with another medium outside, leaving at interfaces[2 * i] with eta = ior / outer_iors[i] and entering at interfaces[2 * i + 1].
+        static constexpr std::size_t kMaxInterfaces = 4;
+        std::size_t interface_count = 0;
+        std::array<float, kMaxInterfaces> outer_iors;
+        std::array<Constants, 2 * kMaxInterfaces> interfaces;
+        Vector3f absorption;
+        // Set by ApplyTextures() if no texture changes the constants, which are then those of the shared material.
+        const PrincipledBSDF *base = nullptr;
     };
 
     struct EmissiveBSDF : public PrincipledBSDF
@@ -95,11 +261,6 @@ namespace RenderToy
     {
         GlossyBSDF(const Vector3f &base_color_, const float roughness_ = 0.5f);
     };
-
-    struct ITexture
-    {
-        virtual void Sample(const float u, const float v) const = 0;
-    };
 }
 
 #endif // MATERIAL_H
\ No newline at end of file
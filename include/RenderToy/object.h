@@ -11,6 +11,7 @@
 #include <string>
 #include <tuple>
 #include <array>
+#include <cstdint>
 
 namespace RenderToy
 {
@@ -30,6 +31,9 @@ namespace RenderToy
     protected:
         Matrix4x4f object_to_world;
         Matrix4x4f world_to_object;
+        /// @brief O2W matrix at shutter close. Equals object_to_world for static objects.
+        Matrix4x4f object_to_world_close;
+        bool moving = false;
 
     public:
         std::string name;
@@ -39,10 +43,25 @@ namespace RenderToy
         /// @brief Set object to world matrix.
         /// @param object_to_world O2W Matrix, should be an AFFINE matrix.
         virtual void SetO2W(const Matrix4x4f &object_to_world_);
+        /// @brief Set object to world matrices at shutter open and close, for motion blur.
+        /// Points move linearly between the two, so rotations should be small over the shutter interval.
+        /// @param object_to_world_ O2W Matrix at shutter open, should be an AFFINE matrix.
+        /// @param object_to_world_close_ O2W Matrix at shutter close, should be an AFFINE matrix.
+        virtual void SetO2W(const Matrix4x4f &object_to_world_, const Matrix4x4f &object_to_world_close_);
 
         /// @brief Get O2W matrix of the Geometry Object.
         /// @return
         const Matrix4x4f &GetO2W() const;
+        /// @brief Get O2W matrix at shutter close.
+        /// @return
+        const Matrix4x4f &GetO2WClose() const;
+        /// @brief Get O2W matrix at a time in the shutter interval.
+        /// @param time 0 at shutter open, 1 at shutter close.
+        /// @return
+        const Matrix4x4f GetO2W(const float time) const;
+        /// @brief Whether the object moves while the shutter is open.
+        /// @return
+        const bool IsMoving() const;
         /// @brief Get W2O matrix of the Geometry Object.
         /// @return
         const Matrix4x4f &GetW2O() const;
@@ -55,11 +74,16 @@ namespace RenderToy
         /// @param vec
         /// @return
         const Vector3f W2OTransform(const Vector3f &vec) const;
-        /// @brief Transforms a ray by O2W matrix.
+        /// @brief Transforms a vector by O2W matrix at a time in the shutter interval.
+        /// @param vec
+        /// @param time
+        /// @return
+        const Vector3f O2WTransform(const Vector3f &vec, const float time) const;
+        /// @brief Transforms a ray by O2W matrix at the time of the ray.
         /// @param ray
         /// @return
         const Ray O2WTransform(const Ray &ray) const;
-        /// @brief Transforms a ray by W2O matrix.
+        /// @brief Transforms a ray by W2O matrix. Motion is ignored.
         /// @param ray
         /// @return
         const Ray W2OTransform(const Ray &ray) const;
@@ -98,15 +122,23 @@ namespace RenderToy
     class Triangle
     {
     public:
-        /// @brief Get the bounding box of the triangle.
+        /// @brief Get the bounding box of the triangle over the whole shutter interval.
         /// @return Bounding box of the triangle.
         const BoundingBox BBox() const;
+        /// @brief Get the bounding box of the triangle at a time in the shutter interval.
+        /// @param time
+        /// @return
+        const BoundingBox BBox(const float time) const;
         std::array<Vector3f, 3> vert;
         std::array<Vector3f, 3> norm;
         std::array<Vector2f, 3> uv;
+        /// @brief Vertex tangents along increasing u of the texture, in OBJECT SPACE. Zero if unknown, see Mesh::ComputeTangents().
+        std::array<Vector3f, 3> tang = {};
+        /// @brief 1 if the texture runs along Cross(normal, tangent) with increasing v, -1 if it is mirrored.
+        float tangent_sign = 1.0f;
 
         Triangle(const std::array<Vector3f, 3> &vert_, const std::array<Vector3f, 3> &norm_, const std::array<Vector2f, 3> &uv_, Mesh *const parent_);
-        /// @brief Do ray-triangle intersection test in WORLD SPACE.
+        /// @brief Do ray-triangle intersection test in WORLD SPACE, at the time of the ray.
         /// @param ray Incoming ray.
         /// @param t Distance.
         /// @param u Barycentric U.
@@ -114,20 +146,38 @@ namespace RenderToy
         /// @return Intersected(TRUE) or not(FALSE).
         const bool Intersect(const Ray &ray, float &t, float &u, float &v) const;
         /// @brief Get sample point in WORLD SPACE.
+        /// @param time Time in the shutter interval.
         /// @return
-        const Vector3f GetSamplePoint() const;
+        const Vector3f GetSamplePoint(const float time = 0.0f) const;
+        /// @brief Get barycentric coordinates of a point on the triangle in WORLD SPACE.
+        /// @param position
+        /// @param u Barycentric U.
+        /// @param v Barycentric V.
+        /// @param time Time in the shutter interval.
+        void Barycentric(const Vector3f &position, float &u, float &v, const float time = 0.0f) const;
         /// @brief Get cached area.
+        /// @param time Time in the shutter interval.
         /// @return
-        const float AreaC() const;
-        /// @brief (Deprecated) Get cached tangent.
-        /// @return Returns geometrical tangent. Deprecated for not supporting gourand interpolation.
-        [[deprecated]] const Vector3f TangentC() const;
-        /// @brief Get cached normal.
+        const float AreaC(const float time = 0.0f) const;
+        /// @brief Get cached tangent in WORLD SPACE, interpolated from the vertex tangents. Neither normalized nor orthogonal to the normal.
+        /// @param u
+        /// @param v
+        /// @param time Time in the shutter interval.
+        /// @return Zero if the triangle has no tangents.
+        const Vector3f TangentC(const float u, const float v, const float time = 0.0f) const;
+        /// @brief Get cached normal in WORLD SPACE, interpolated from the vertex normals if the mesh is smooth.
+        /// @param u
+        /// @param v
+        /// @param time Time in the shutter interval.
         /// @return
-        const Vector3f NormalC(const float u, const float v) const;
+        const Vector3f NormalC(const float u, const float v, const float time = 0.0f) const;
         /// @brief Get geometrical normal.
+        /// @param time Time in the shutter interval.
+        /// @return
+        const Vector3f GeometricalNormalC(const float time = 0.0f) const;
+        /// @brief Whether the triangle moves while the shutter is open.
         /// @return
-        const Vector3f GeometricalNormalC() const;
+        const bool IsMoving() const;
 
         /// @brief Update cache. Should be evaluated after O2W matrix having been changed.
         void UpdateCache();
@@ -144,6 +194,8 @@ namespace RenderToy
         const void AppendVBO(std::vector<float> &target, const std::vector<GLAttributeObject> &attrib_list) const;
 
         Mesh *parent;
+        /// @brief Index of the material of parent in World::materials. Set by World::PrepareMaterials().
+        uint16_t material_id = 0;
 
     private:
         /// @brief Calculate tangent.
@@ -156,13 +208,28 @@ namespace RenderToy
         /// @return
         const float Area() const;
 
+        /// @brief Intersection test against given world space vertex and edges.
+        static const bool Intersect(const Ray &ray, const Vector3f &v0, const Vector3f &v0v1, const Vector3f &v0v2, float &t, float &u, float &v);
+
         Vector3f v0v1_w;
         Vector3f v0v2_w;
         std::array<Vector3f, 3> vert_w;
 
         float area;
         Vector3f normal;
-        Vector3f tangent;
+        std::array<Vector3f, 3> tang_w;
+        // Vertex normals, transformed by the inverse transpose of O2W and normalized.
+        std::array<Vector3f, 3> norm_w;
+
+        // Shutter close counterparts, vertices move linearly in between.
+        bool moving = false;
+        Vector3f v0v1_w_close;
+        Vector3f v0v2_w_close;
+        std::array<Vector3f, 3> vert_w_close;
+        float area_close;
+        Vector3f normal_close;
+        std::array<Vector3f, 3> tang_w_close;
+        std::array<Vector3f, 3> norm_w_close;
     };
 
     /// @brief Polygon class. Used by PCG Mesh & Importer. Provides a function to convert to triangles.
@@ -200,6 +267,15 @@ namespace RenderToy
         /// @brief Set object to world matrix.
         /// @param object_to_world O2W Matrix, should be an AFFINE matrix.
         virtual void SetO2W(const Matrix4x4f &object_to_world_) override;
+        /// @brief Set object to world matrices at shutter open and close, for motion blur.
+        /// @param object_to_world_ O2W Matrix at shutter open, should be an AFFINE matrix.
+        /// @param object_to_world_close_ O2W Matrix at shutter close, should be an AFFINE matrix.
+        virtual void SetO2W(const Matrix4x4f &object_to_world_, const Matrix4x4f &object_to_world_close_) override;
+
+        /// @brief Compute the vertex tangents of all triangles from their positions and texture coordinates, once after import.
+        /// Corners sharing a position, normal and handedness get the mean tangent of the faces around them, made orthogonal to their normal.
+        /// Faces with degenerate texture coordinates contribute nothing.
+        void ComputeTangents();
 
         /// @brief [OpenGL Extension] Generate VBO of the mesh.
         /// @param attrib_list OpenGL attribute list.
@@ -222,6 +298,13 @@ namespace RenderToy
         Light(Vector3f color_ = Vector3f::White, float intensity_ = 1.0f);
 
         virtual const Vector3f GetSamplePoint() const = 0;
+
+        /// @brief Evaluate the light arriving at a receiver. Used by next event estimation.
+        /// @param position Receiver position in WORLD SPACE.
+        /// @param dir_to_light_o Normalized direction from the receiver towards the light.
+        /// @param distance_o Distance to the light, kFloatInfinity for lights at infinity.
+        /// @return Irradiance on a surface perpendicular to dir_to_light_o.
+        virtual const Vector3f Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const = 0;
     };
 
     /// @brief Delta light.
@@ -235,6 +318,26 @@ namespace RenderToy
         /// @brief Sampling the light.
         /// @return
         virtual const Vector3f GetSamplePoint() const override final;
+
+        virtual const Vector3f Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const override;
+    };
+
+    /// @brief Spot light. A delta light emitting inside a cone around (0,0,-1) in object space.
+    struct SpotLight : public DeltaLight
+    {
+        /// @brief Full angle of the cone, in radians.
+        float spot_size;
+        /// @brief Fraction of the cone softened towards its edge, in [0, 1].
+        float spot_blend;
+
+        /// @brief Create a spot light. Parameters follow Blender conventions.
+        /// @param color_ Base color of light.
+        /// @param intensity_ Intensity of light.
+        /// @param spot_size_ Full angle of the cone, in radians.
+        /// @param spot_blend_ Softness of the cone edge.
+        SpotLight(Vector3f color_ = Vector3f::White, float intensity_ = 1.0f, float spot_size_ = Convert::DegreeToRadians(45), float spot_blend_ = 0.15f);
+
+        virtual const Vector3f Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const override final;
     };
 
     /// @brief Directional light. Pointing at (0,0,-1) in object space.
@@ -248,6 +351,8 @@ namespace RenderToy
         /// @brief Sampling the light.
         /// @return
         virtual const Vector3f GetSamplePoint() const override final;
+
+        virtual const Vector3f Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const override final;
     };
 };
 
@@ -3,6 +3,8 @@
 
 #include "rtmath.h"
 
+#include <array>
+
 namespace RenderToy
 {
 
@@ -19,6 +21,41 @@ namespace RenderToy
     const float SchlickFresnel(const float u);
     const float DielectricFresnel(const float cos_theta_i, const float eta);
 
+    /// @brief DielectricFresnel() of one eta, tabulated over cos_theta_i and linearly interpolated.
+    /// Total internal reflection and the bins right above the critical angle, where the curve has a square root kink, are evaluated exactly.
+    /// The absolute error is below kMaxError for any eta.
+    class FresnelTable
+    {
+    public:
+        static constexpr std::size_t kSize = 1024;
+        static constexpr float kMaxError = 1e-3f;
+
+        explicit FresnelTable(const float eta_);
+
+        /// @brief Get the table of eta, built on first use and kept for the lifetime of the program. Thread safe.
+        /// @param eta
+        /// @return
+        static const FresnelTable &Get(const float eta);
+
+        /// @brief Approximate DielectricFresnel(cos_theta_i, Eta()).
+        /// @param cos_theta_i Negative values are evaluated exactly.
+        /// @return
+        const float Eval(const float cos_theta_i) const;
+        const float Eta() const;
+
+    private:
+        // Bins above the critical cosine evaluated exactly.
+        static constexpr std::size_t kExactBins = 4;
+
+        float eta;
+        float cos_critical;
+        // Bins per unit of cos_theta_i.
+        float scale;
+        // Lowest cos_theta_i looked up in the table.
+        float cos_table;
+        std::array<float, kSize + 1> values;
+    };
+
     const Vector3f CosineSampleHemisphere(const float r1, const float r2);
     const Vector3f UniformSampleHemisphere(const float r1, const float r2);
     const Vector3f UniformSampleSphere(const float r1, const float r2);
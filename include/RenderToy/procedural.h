@@ -4,6 +4,7 @@
 #include "rtmath.h"
 #include "compositor.h"
 #include "object.h"
+#include "texture.h"
 
 #include <type_traits>
 #include <cmath>
@@ -98,6 +99,98 @@ namespace RenderToy::ProceduralTexture
         siv::BasicPerlinNoise<float> perlin_noise_generator;
         siv::PerlinNoise::seed_type seed;
     };
+
+    inline const Vector3f ToColor(const float value)
+    {
+        return Vector3f(value, value, value);
+    }
+
+    inline const Vector3f ToColor(const Vector3f &value)
+    {
+        return value;
+    }
+
+    /// @brief Material input evaluating a procedural texture at every lookup, unfiltered.
+    /// @tparam _TpRet Return type of the texture, float or Vector3f.
+    template <typename _TpRet>
+    class Input : public ITexture
+    {
+    public:
+        /// @brief Construct an input.
+        /// @param source_ Not owned.
+        Input(const IPCGT<_TpRet> *source_)
+            : source(source_)
+        {
+        }
+
+        const Vector3f Sample(const Vector2f &uv, const float /*lod*/, uint64_t & /*misses*/) const override
+        {
+            return ToColor(source->Sample(Vector2f(uv.x() - std::floor(uv.x()), uv.y() - std::floor(uv.y()))));
+        }
+
+        const float Level(const float /*footprint*/) const override
+        {
+            return 0.0f;
+        }
+
+    private:
+        const IPCGT<_TpRet> *source;
+    };
+
+    /// @brief Material input rasterizing a procedural texture on first use, tile by tile and level by level, into a tile cache.
+    /// Repeated lookups in the same region cost a cache hit instead of evaluating the texture.
+    /// Call Invalidate() after changing the parameters of the texture.
+    /// @tparam _TpRet Return type of the texture, float or Vector3f.
+    template <typename _TpRet>
+    class BakedInput : public TiledTexture
+    {
+    public:
+        /// @brief Largest grid of samples per axis averaged into a texel of a coarse level.
+        static constexpr std::size_t kMaxBakeSamples = 4;
+
+        /// @brief Construct an input, nothing is rasterized yet.
+        /// @param source_ Not owned.
+        /// @param resolution_ Resolution of the finest level.
+        /// @param cache_ Cache to bake tiles into.
+        BakedInput(const IPCGT<_TpRet> *source_, const SizeN &resolution_, TileCache *cache_ = &TileCache::Global())
+            : TiledTexture(resolution_, cache_), source(source_)
+        {
+        }
+
+    protected:
+        /// @brief Texels of the finest level sample the texture at their center. Texels of coarser levels average a grid
+        /// of samples over their area instead of the level below, so a tile never waits on other tiles.
+        const bool Load(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, TileCache::Tile &tile) const override
+        {
+            const SizeN &resolution = Resolution(level);
+            const std::size_t n = std::min(std::size_t(1) << level, kMaxBakeSamples);
+            const float weight = 1.0f / float(n * n);
+            for (std::size_t y = 0; y < TileCache::kTileSize; ++y)
+            {
+                const std::size_t row = std::min(tile_y * TileCache::kTileSize + y, resolution.height - 1);
+                for (std::size_t x = 0; x < TileCache::kTileSize; ++x)
+                {
+                    const std::size_t column = std::min(tile_x * TileCache::kTileSize + x, resolution.width - 1);
+                    Vector3f sum;
+                    for (std::size_t j = 0; j < n; ++j)
+                    {
+                        // Rows run from the top, v from the bottom.
+                        const float v = 1.0f - (float(row) + (float(j) + 0.5f) / float(n)) / float(resolution.height);
+                        for (std::size_t i = 0; i < n; ++i)
+                        {
+                            const float u = (float(column) + (float(i) + 0.5f) / float(n)) / float(resolution.width);
+                            sum += ToColor(source->Sample(Vector2f(u, v)));
+                        }
+                    }
+                    tile.texels[y * TileCache::kTileSize + x] = sum * weight;
+                }
+            }
+            return true;
+        }
+
+    private:
+        const IPCGT<_TpRet> *source;
+    };
 }
 
 #endif // PROCEDURAL_H
\ No newline at end of file
@@ -3,6 +3,9 @@
 
 #include "rtmath.h"
 
+#include <array>
+#include <cstdint>
+
 namespace RenderToy
 {
     /// @brief Ray class.
@@ -13,20 +16,87 @@ namespace RenderToy
         /// @brief Constructor of Ray class.
         /// @param src_ Ray source.
         /// @param normalized_direction_ NORMALIZED ray direction.
-        Ray(Vector3f src_, Vector3f normalized_direction_);
+        /// @param time_ Time in the shutter interval, 0 at shutter open and 1 at shutter close.
+        Ray(Vector3f src_, Vector3f normalized_direction_, float time_ = 0.0f);
 
         Vector3f src;
         Vector3f direction;
+        float time;
 
         const Ray operator-(const Ray &ray);
     };
 
+    /// @brief Medium a ray travels through after entering a surface of a material.
+    struct Medium
+    {
+        /// @brief Material of the surfaces bounding the medium, see World::GetMaterial().
+        uint16_t material_id;
+        float ior;
+        /// @brief Absorption coefficient per unit distance, zero for clear media.
+        Vector3f absorption;
+    };
+
     /// @brief Represents current status of ray in the scene.
     struct RayState
     {
-        float eta;
+        /// @brief Relative index of refraction at the current hit, from the incident to the other side.
+        float eta = 1.0f;
+        /// @brief Absorption coefficient of the innermost medium, kept in step with media.
         Vector3f absorption;
         Vector3f ffnormal;
+        /// @brief Tangent and bitangent completing ffnormal to an orthonormal frame, set along with it by SetFrame().
+        /// Built once per hit and shared by every BSDF query made there.
+        Vector3f fftangent;
+        Vector3f ffbitangent;
+
+        /// @brief Media enclosing the ray, innermost last. Outside of all of them is vacuum.
+        /// Nested media, like a liquid in a glass, leave and reveal each other in any order.
+        static constexpr std::size_t kMaxMedia = 4;
+        std::array<Medium, kMaxMedia> media;
+        std::size_t medium_count = 0;
+
+        /// @brief Footprint of the path as a ray cone, the isotropic form of ray differentials.
+        /// Width of the cone at the ray source, in WORLD SPACE units.
+        float cone_width = 0.0f;
+        /// @brief Angle the cone opens by, in radians.
+        float cone_spread = 0.0f;
+
+        /// @brief Widen the cone over the distance to the next vertex.
+        /// @param distance
+        void Travel(const float distance);
+        /// @brief Open the cone by the solid angle a sampled bounce stands for, 1 / pdf.
+        /// Rough bounces open it wide, so later vertices read coarse texture levels.
+        /// @param pdf Solid angle pdf of the bounce.
+        void Scatter(const float pdf);
+        /// @brief Set ffnormal and the frame around it.
+        /// @param normal Normalized.
+        /// @param tangent Projected onto the plane of normal. If it is zero or parallel to normal, Onb() picks the frame.
+        void SetFrame(const Vector3f &normal, const Vector3f &tangent = Vector3f::O);
+        /// @brief Get the frame around N, the cached one if N is ffnormal.
+        /// @param N
+        /// @param T
+        /// @param B
+        void Frame(const Vector3f &N, Vector3f &T, Vector3f &B) const;
+
+        /// @brief Enter a medium through its surface, leaving any earlier entry of its material first.
+        /// Past kMaxMedia media, the outermost one is forgotten.
+        /// @param medium
+        void Enter(const Medium &medium);
+        /// @brief Leave the innermost medium of a material through its surface. Does nothing if the ray is not inside one.
+        /// @param material_id
+        void Leave(const uint16_t material_id);
+        /// @brief Get the index of refraction around the ray.
+        /// @return
+        const float Ior() const;
+        /// @brief Get the index of refraction on the outer side of a surface of a material, the one a ray leaving it passes into
+        /// and a ray entering it comes from.
+        /// @param material_id
+        /// @return
+        const float OuterIor(const uint16_t material_id) const;
+        /// @brief Get the fraction of light left over a distance through the innermost medium. Only exponentiates in absorbing media.
+        /// @param distance
+        /// @return
+        const Vector3f Transmittance(const float distance) const;
     };
 }
 
@@ -1,11 +1,16 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <optional>
 #include <ostream>
+#include <string>
+#include <vector>
 
 #include "world.h"
 #include "rtmath.h"
 #include "bvh.h"
+#include "guiding.h"
+#include "stats.h"
 #include "surfacepoint.h"
 
 namespace RenderToy
@@ -29,15 +34,38 @@ namespace RenderToy
         kParallel
     };
 
+    /// @brief Rectangular window of the frame. Corresponding to Render Region in Blender.
+    struct RenderRegion
+    {
+        /// @brief Top-left pixel in Raster Space.
+        PointN origin;
+        SizeN size;
+        /// @brief Pixels rendered around the region, so that filters see valid neighbours at its border.
+        std::size_t overscan = 0;
+
+        RenderRegion() = default;
+        RenderRegion(const PointN &origin_, const SizeN &size_, const std::size_t overscan_ = 0);
+
+        /// @brief Split a frame into buckets in scanline order. Buckets on the right and bottom border are cut to fit the frame.
+        /// @param resolution
+        /// @param bucket_size
+        /// @param overscan
+        /// @return
+        static std::vector<RenderRegion> Buckets(const SizeN &resolution, const SizeN &bucket_size, const std::size_t overscan = 0);
+    };
+
     // Use Blender conventions.
     /// @brief Format settings for the renderer.
     struct FormatSettings
     {
         SizeN resolution = SizeN(1920, 1080);
         Vector2f aspect = Vector2f(1.0f, 1.0f); // Don't touch it!
+        /// @brief Render only this window of the frame. The whole frame is rendered if empty.
+        std::optional<RenderRegion> region;
 
         FormatSettings() = default;
         FormatSettings(SizeN resolution_, Vector2f aspect_);
+        FormatSettings(SizeN resolution_, Vector2f aspect_, const RenderRegion &region_);
     };
 
     /// @brief Render context.
@@ -46,17 +74,28 @@ namespace RenderToy
         World *world;
         BVH *bvh;
 
-        Vector3f *buffer;
-
         FormatSettings format_settings;
         int camera_id = 0;
 
+        /// @brief Pixels held by buffer: the render region grown by its overscan and clipped to the frame, or the whole frame.
+        PointN buffer_origin;
+        SizeN buffer_size;
+        Vector3f *buffer;
+
+        /// @brief Seconds spent building and refitting bvh.
+        double build_seconds = 0.0;
+
         /// @brief Initialize a render context with world pointer and format settings.
         /// @param world_ 
         /// @param format_settings_ 
         RenderContext(World *world_, FormatSettings format_settings_);
         ~RenderContext();
 
+        /// @brief Change the render region and reallocate a cleared buffer for it. The BVH is kept.
+        /// @param region_ Render the whole frame if empty.
+        void SetRegion(const std::optional<RenderRegion> &region_);
+
+        /// @brief Access buffer. (x, y) is relative to buffer_origin.
         Vector3f &operator()(const std::size_t x, const std::size_t y);
         const Vector3f &operator()(const std::size_t x, const std::size_t y) const;
     };
@@ -66,9 +105,27 @@ namespace RenderToy
     {
     protected:
         void PrepareScreenSpace(Camera *cam, float &top, float &right);
+        /// @brief Generate the primary ray through raster point (x, y).
+        /// @param cam
+        /// @param top Result of PrepareScreenSpace.
+        /// @param right Result of PrepareScreenSpace.
+        /// @param x
+        /// @param y
+        /// @param time Time in the shutter interval.
+        /// @return Ray in WORLD SPACE.
+        const Ray GenerateCameraRay(const Camera *cam, const float top, const float right, const int x, const int y, const float time = 0.0f) const;
+        /// @brief Get the angle a pixel subtends, the spread of the ray cones of camera rays.
+        /// @param top Result of PrepareScreenSpace.
+        /// @return
+        const float PixelSpread(const float top) const;
+        /// @brief Reset stats for a render of the whole buffer.
+        /// @param samples_per_pixel
+        void BeginStats(const std::size_t samples_per_pixel);
 
     public:
         RenderContext *render_context;
+        /// @brief Statistics of the last Render() call. Export time is up to the caller, see RenderStats::ScopedTimer.
+        mutable RenderStats stats;
         Renderer() = delete;
         Renderer(const Renderer &) = delete;
         Renderer(const Renderer &&) = delete;
@@ -112,18 +169,256 @@ namespace RenderToy
         virtual void Render() override final;
     };
 
+    /// @brief Unoccluded light contribution waiting for its shadow ray.
+    struct ShadowQuery
+    {
+        Vector3f origin;
+        Vector3f direction;
+        /// @brief Distance to the light. Occluders beyond it are ignored.
+        float distance;
+        /// @brief Triangle the query starts from.
+        const Triangle *exclude;
+        /// @brief Emitter being sampled. Hitting it does not count as occlusion.
+        const Triangle *target;
+        Vector3f contribution;
+        /// @brief Time in the shutter interval.
+        float time;
+    };
+
+    /// @brief Sample of a light, waiting for the BSDF value towards it to become a ShadowQuery.
+    struct LightSample
+    {
+        Vector3f direction;
+        /// @brief Distance to the light. Occluders beyond it are ignored.
+        float distance;
+        /// @brief Emitter being sampled, null for other lights.
+        const Triangle *target;
+        /// @brief Radiance arriving from the light, or irradiance for analytic lights.
+        Vector3f radiance;
+        /// @brief Pdf of direction, weighted against the one of the BSDF. Unused for analytic lights.
+        float pdf;
+        /// @brief Whether the light is analytic, a delta distribution that the BSDF cannot sample.
+        bool delta;
+    };
+
+    /// @brief Double precision sums of pixel samples, stored tile by tile.
+    /// A tile is owned by one thread during a pass, so threads never write to the same cache lines.
+    class AccumulationBuffer
+    {
+    public:
+        /// @brief Edge length of a tile, in pixels.
+        static constexpr std::size_t kTileSize = 16;
+
+        AccumulationBuffer() = default;
+
+        /// @brief Resize and clear.
+        /// @param size_
+        void Resize(const SizeN &size_);
+        const SizeN &Size() const;
+
+        const std::size_t TileCount() const;
+        /// @brief Get the pixels covered by tile t.
+        /// @param t
+        /// @param origin_o Top-left pixel.
+        /// @param size_o Size of the tile, cut at the right and bottom border.
+        void Tile(const std::size_t t, PointN &origin_o, SizeN &size_o) const;
+
+        Vector3d &operator()(const std::size_t x, const std::size_t y);
+        const Vector3d &operator()(const std::size_t x, const std::size_t y) const;
+
+        /// @brief Write sum * scale of every pixel into dst, a scanline ordered buffer of Size().
+        /// @param dst
+        /// @param scale
+        void Resolve(Vector3f *dst, const double scale) const;
+
+    private:
+        SizeN size;
+        std::size_t tiles_x = 0;
+        std::vector<Vector3d> sums;
+    };
+
     /// @brief Path tracing renderer.
     class PathTracingRenderer : public Renderer
     {
+    protected:
         int iteration_count;
+        /// @brief Iterations already accumulated into the buffer.
+        int finished_iterations = 0;
 
     public:
+        /// @brief Seed of the random sequences. Every pixel sample draws from the sequence of (seed, pixel, sample),
+        /// so renders with equal seeds are identical whatever the thread count.
+        uint64_t seed = 0;
+        /// @brief Index of the first sample, for renders sharing the samples of a pixel with others.
+        int sample_offset = 0;
+        /// @brief Write a checkpoint to checkpoint_path every checkpoint_interval iterations. 0 disables checkpointing.
+        int checkpoint_interval = 0;
+        std::string checkpoint_path;
+        /// @brief Learn incident radiance while rendering and sample bounces from it, for scenes lit mostly indirectly.
+        /// Passes then double in length, so that most samples are taken with a refined field.
+        /// Checkpoints do not store the field, a resumed render learns it again.
+        bool path_guiding = false;
+        /// @brief Probability of sampling the guiding field instead of the BSDF where guiding applies.
+        float guiding_fraction = 0.5f;
+
         PathTracingRenderer(RenderContext *render_context_, const int iteration_count_);
+        /// @brief Render the remaining iterations. Continues from the state restored by RenderCheckpoint::Load().
         virtual void Render() override final;
+        const int FinishedIterations() const;
+        /// @brief Discard the accumulated samples, so that the next Render() starts over. Keeps allocations.
+        void Reset();
+
+    protected:
+        friend class RenderCheckpoint;
+
+        /// @brief Sums of all finished samples. Resolved into the buffer at the end of every pass.
+        AccumulationBuffer accumulation;
+
+        /// @brief Add the samples of iterations [first_iteration, first_iteration + count) to accumulation.
+        /// @param first_iteration
+        /// @param count
+        virtual void RenderIterations(const int first_iteration, const int count);
+
+        /// @brief Maximum bounce depth. Paths are terminated after it.
+        static constexpr int kMaxDepth = 4;
+        /// @brief Surfaces smoother than this keep plain BSDF sampling, their lobes are narrower than a histogram bin.
+        static constexpr float kGuidingMinRoughness = 0.2f;
+
+        /// @brief Learned by every pass, sampled from by the next ones. Recording is thread safe.
+        mutable GuidingField guiding;
+        /// @brief Iterations learned into guiding.
+        int guiding_iterations = 0;
+
+        /// @brief Whether bounces from a surface point sample the guiding field.
+        /// @param surface_point
+        /// @return
+        const bool Guided(const SurfacePoint &surface_point) const;
+        /// @brief Sample the next direction of a path, from the BSDF or from a mix of the BSDF and the guiding field.
+        /// @param state
+        /// @param ray_dir Direction of the ray arriving at surface_point.
+        /// @param surface_point
+        /// @param direction_o
+        /// @param color_o BSDF value times cosine.
+        /// @param pdf_o Pdf of direction_o under the mix.
+        /// @return FALSE if the path should be terminated.
+        const bool SampleBounce(RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, Vector3f &direction_o, Vector3f &color_o, float &pdf_o) const;
+        /// @brief Enter or leave the medium behind the surface if the bounce crossed it.
+        /// @param state
+        /// @param leaving Whether the ray hit the surface from inside.
+        /// @param direction Direction of the bounce.
+        /// @param surface_point
+        void UpdateMedia(RayState &state, const bool leaving, const Vector3f &direction, const SurfacePoint &surface_point) const;
+        /// @brief Get the pdf of SampleBounce() choosing a direction, for multiple importance sampling.
+        /// @param state
+        /// @param ray_dir Direction of the ray arriving at surface_point.
+        /// @param surface_point
+        /// @param direction
+        /// @param bsdf_pdf Pdf of the BSDF alone, returned as is where guiding does not apply.
+        /// @return
+        const float BouncePDF(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, const Vector3f &direction, const float bsdf_pdf) const;
 
-    private:
         const Vector3f Radiance(const Ray &cast_ray, const Triangle *last_hit, RayState &state, const int depth, const float last_bsdfpdf) const;
-        const Vector3f DirectLight(const RayState state, const Vector3f &ray_dir, const SurfacePoint &surface_point) const;
+        const Vector3f DirectLight(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point) const;
+        /// @brief Sample emitters and analytic lights at a surface point, appending one query per light sample.
+        /// @param state
+        /// @param ray_dir Direction of the ray arriving at surface_point.
+        /// @param surface_point
+        /// @param queries
+        void SampleDirectLight(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, std::vector<ShadowQuery> &queries) const;
+        /// @brief Draw the light samples of SampleDirectLight(), without evaluating the BSDF.
+        /// @param state
+        /// @param surface_point
+        /// @param samples Appended one sample per light sample.
+        void SampleLights(const RayState &state, const SurfacePoint &surface_point, std::vector<LightSample> &samples) const;
+        /// @brief Weigh a light sample by the BSDF towards it, into the query of its shadow ray.
+        /// @param state
+        /// @param ray_dir Direction of the ray arriving at surface_point.
+        /// @param surface_point
+        /// @param sample
+        /// @param f BSDF value times cosine towards the sample, from PrincipledBSDF::Eval().
+        /// @param bsdf_pdf Pdf from PrincipledBSDF::Eval().
+        /// @param query_o
+        /// @return FALSE if the sample adds nothing.
+        const bool LightQuery(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, const LightSample &sample, const Vector3f &f, const float bsdf_pdf, ShadowQuery &query_o) const;
+        /// @brief Trace the shadow ray of a query.
+        /// @param query
+        /// @return TRUE if the light is visible.
+        const bool Unoccluded(const ShadowQuery &query) const;
+    };
+
+    /// @brief Wavefront (stream) path tracing renderer.
+    /// Keeps a batch of path states in SoA buffers and runs each stage (generate, extend, shade, shadow, accumulate) over the whole batch.
+    class WavefrontPathTracingRenderer : public PathTracingRenderer
+    {
+    public:
+        /// @brief Number of paths in flight.
+        std::size_t batch_size;
+
+        WavefrontPathTracingRenderer(RenderContext *render_context_, const int iteration_count_, const std::size_t batch_size_ = std::size_t(1) << 16);
+
+    protected:
+        virtual void RenderIterations(const int first_iteration, const int count) override final;
+
+    private:
+        /// @brief Bounce of a path, radiance arriving along direction is (final radiance - radiance) / throughput.
+        struct GuidingVertex
+        {
+            Vector3f position;
+            Vector3f direction;
+            /// @brief Throughput after the bounce.
+            Vector3f throughput;
+            /// @brief Radiance of the path when it left the bounce, including next event estimation at it.
+            Vector3f radiance;
+            float pdf;
+            /// @brief Depth of the path at the bounce.
+            int depth;
+        };
+
+        /// @brief Path states in SoA layout.
+        struct PathStates
+        {
+            std::vector<Vector3f> origin;
+            std::vector<Vector3f> direction;
+            std::vector<Vector3f> throughput;
+            std::vector<Vector3f> radiance;
+            std::vector<RayState> state;
+            std::vector<const Triangle *> last_hit;
+            std::vector<float> last_bsdfpdf;
+            std::vector<int> depth;
+            std::vector<std::size_t> pixel;
+            std::vector<char> alive;
+            std::vector<Random::PCG32> rng;
+            /// @brief Time in the shutter interval, fixed for the whole path.
+            std::vector<float> time;
+            /// @brief Guided bounces of each path, kMaxDepth per path, recorded into the guiding field once the path is done.
+            std::vector<GuidingVertex> guiding_vertices;
+            std::vector<int> guiding_count;
+
+            std::vector<const Triangle *> hit;
+            std::vector<Vector3f> hit_position;
+            std::vector<float> hit_u;
+            std::vector<float> hit_v;
+
+            std::vector<ShadowQuery> shadow_queries;
+            std::vector<std::size_t> shadow_count;
+
+            void Resize(const std::size_t size, const std::size_t queries_per_path);
+        };
+
+        void Generate(PathStates &paths, const std::size_t first_path, const std::size_t count, const Camera *cam, const float top, const float right) const;
+        void Extend(PathStates &paths, std::vector<std::size_t> &active) const;
+        /// @brief Shade the hits of active, kShadeChunk at a time. The BSDF values towards the light samples of a chunk
+        /// are evaluated in batches of hits with the same material, see PrincipledBSDF::EvalBatch().
+        void Shade(PathStates &paths, std::vector<std::size_t> &active) const;
+        void Shadow(PathStates &paths, const std::vector<std::size_t> &active) const;
+        void Accumulate(const PathStates &paths, const std::size_t count);
+        /// @brief Record the guided bounces of finished paths into the guiding field.
+        void Learn(const PathStates &paths, const std::size_t count);
+
+        /// @brief Hits shaded together, filling a few BSDF batches with the light samples of each material.
+        static constexpr std::size_t kShadeChunk = 32;
+
+        std::size_t queries_per_path;
     };
 
     /// @brief Albedo pass renderer.
@@ -8,3 +8,14 @@
 #include "material.h"
 #include "procedural.h"
 #include "compositor.h"
+#include "distribution.h"
+#include "lightbvh.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "animation.h"
+#include "sequence.h"
+#include "guiding.h"
+#include "environment.h"
+#include "stats.h"
+#include "trace.h"
+#include "texture.h"
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define RTMATH_H
 
 #include <array>
+#include <cstdint>
 #include <istream>
+#include <ostream>
 #include <stack>
 #include <cmath>
 #include <algorithm>
@@ -1266,10 +1268,42 @@ namespace RenderToy
 
 #pragma region Random
     /// @brief Random helpers.
+    /// Every thread owns its engine. Renderers reseed it per pixel sample, so the image does not depend on how samples are scheduled.
     namespace Random
     {
+        /// @brief PCG32 random engine. Small and cheap to seed, so that every pixel sample can own a sequence.
+        struct PCG32
+        {
+            using result_type = uint32_t;
+
+            uint64_t state = 0x853c49e6748fea9bULL;
+            uint64_t inc = 0xda3e39cb94b95bdbULL;
+
+            PCG32() = default;
+            PCG32(const uint64_t seed, const uint64_t stream);
+
+            /// @brief Select sequence stream and start it at seed.
+            /// @param seed
+            /// @param stream
+            void Seed(const uint64_t seed, const uint64_t stream);
+            result_type operator()();
+
+            static constexpr result_type min() { return 0; }
+            static constexpr result_type max() { return 0xFFFFFFFFu; }
+        };
+
         const int Int(int min, int max);
         const float Float();
+
+        /// @brief Restart the engine of the calling thread. The sequence depends only on (seed, pixel, sample).
+        /// @param seed
+        /// @param pixel
+        /// @param sample
+        void Seed(const uint64_t seed, const uint64_t pixel = 0, const uint64_t sample = 0);
+
+        /// @brief Get the engine of the calling thread. Renderers that interleave paths save and restore it per path.
+        /// @return
+        PCG32 &Engine();
     };
 #pragma endregion
 
@@ -0,0 +1,75 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "animation.h"
+#include "compositor.h"
+#include "renderer.h"
+#include "world.h"
+
+#include <functional>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Renders animation sequences.
+    /// The render context, its BVH and the renderer are kept alive across frames. Moving meshes only refit the BVH,
+    /// which is rebuilt once it has degraded too much. Frames are written on another thread while the next frame renders.
+    class SequenceRenderer
+    {
+    public:
+        RenderContext render_context;
+        int iteration_count;
+        /// @brief Seed of frame 0. Each frame adds its number, so noise is not frozen across frames.
+        uint64_t seed = 0;
+
+        /// @brief Animation of the active camera. Ignored if empty.
+        TransformTrack camera_track;
+        /// @brief Animations of meshes.
+        std::vector<std::pair<Mesh *, TransformTrack>> mesh_tracks;
+
+        /// @brief Fraction of a frame the shutter stays open, centered on the frame. 0 disables motion blur.
+        float shutter = 0.0f;
+
+        /// @brief Rebuild the BVH once refitting made traversal this many times more expensive.
+        float rebuild_threshold = 2.0f;
+
+        /// @brief Output path. A run of '#' is replaced by the zero padded frame number, as in Blender.
+        /// Frames are written as PPM if the path ends with .ppm, as BMP otherwise.
+        std::string output_path = "./frame_####.bmp";
+        /// @brief Processing applied to every frame before it is written, e.g. tone mapping. Runs on the output thread.
+        std::function<void(Image &)> post_process;
+
+        SequenceRenderer(World *world_, const FormatSettings &format_settings_, const int iteration_count_);
+        ~SequenceRenderer();
+
+        /// @brief Render frames [first_frame, last_frame].
+        /// @param first_frame
+        /// @param last_frame
+        void Render(const int first_frame, const int last_frame);
+
+        /// @brief Get the output path of a frame.
+        /// @param frame
+        /// @return
+        const std::string FramePath(const int frame) const;
+
+        /// @brief Number of BVH rebuilds so far.
+        /// @return
+        const int RebuildCount() const;
+
+    private:
+        /// @brief Move the camera and meshes to a frame.
+        /// @param frame
+        void SetFrame(const int frame);
+        /// @brief Wait for pending writes. Rethrows their exceptions.
+        void Flush();
+
+        PathTracingRenderer renderer;
+        std::vector<std::future<void>> pending_writes;
+        int rebuild_count = 0;
+    };
+}
+
+#endif // SEQUENCE_H
@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief Throughput statistics of a render.
+    /// Counters are kept per thread, each on its own cache line, and merged when read.
+    class RenderStats
+    {
+    public:
+        /// @brief Phases timed in wall clock seconds.
+        /// The megakernel path tracer interleaves tracing and shading, so only the wavefront one times them apart.
+        enum class Phase
+        {
+            kBuild = 0,
+            kTrace,
+            kShade,
+            kExport,
+            kRender,
+            kCount
+        };
+
+        struct alignas(64) Counters
+        {
+            uint64_t camera_rays = 0;
+            uint64_t bounce_rays = 0;
+            uint64_t shadow_rays = 0;
+            /// @brief Texture tiles missing from the tile cache, loaded while shading.
+            uint64_t texture_misses = 0;
+            /// @brief Seconds the thread spent rendering, for its utilization.
+            double busy_seconds = 0.0;
+        };
+
+        /// @brief Add the wall clock time of a scope to seconds.
+        class ScopedTimer
+        {
+        public:
+            ScopedTimer(double &seconds_);
+            ScopedTimer(const ScopedTimer &) = delete;
+            ~ScopedTimer();
+
+        private:
+            double &seconds;
+            std::chrono::steady_clock::time_point begin;
+        };
+
+        /// @brief Pixels rendered.
+        uint64_t pixels = 0;
+        /// @brief Samples taken, over all pixels.
+        uint64_t samples = 0;
+
+        RenderStats();
+
+        /// @brief Clear everything and make room for the current maximum thread count.
+        void Reset();
+
+        /// @brief Get the counters of the calling thread.
+        /// @return
+        Counters &Thread();
+        /// @brief Get the time spent in a phase.
+        /// @param phase
+        /// @return
+        double &Seconds(const Phase phase);
+        const double Seconds(const Phase phase) const;
+
+        /// @brief Merge the counters of all threads.
+        /// @return busy_seconds is the sum over all threads.
+        const Counters Total() const;
+        const std::size_t ThreadCount() const;
+        /// @brief Get the share of the render time a thread was busy.
+        /// @param thread
+        /// @return
+        const double Utilization(const std::size_t thread) const;
+        const double RaysPerSecond() const;
+        const double SamplesPerPixel() const;
+
+        /// @brief Write all statistics as a JSON object.
+        /// @param os
+        void ExportJSON(std::ostream &os) const;
+
+    private:
+        std::vector<Counters> threads;
+        double seconds[std::size_t(Phase::kCount)];
+    };
+}
+
+#endif // STATS_H
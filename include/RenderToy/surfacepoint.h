@@ -4,13 +4,23 @@
 #include "object.h"
 #include "rtmath.h"
 
+#include <cstdint>
+#include <optional>
+
 namespace RenderToy
 {   
     /// @brief Intersected surface point.
     class SurfacePoint
     {
     public:
-        SurfacePoint(const Triangle *triangle_, const Vector3f &position_, const float u_, const float v_);
+        /// @brief Construct a surface point.
+        /// @param triangle_
+        /// @param position_
+        /// @param u_ Barycentric U.
+        /// @param v_ Barycentric V.
+        /// @param time_ Time in the shutter interval the point was hit at.
+        /// @param material_ Material of the triangle, usually from World::GetMaterial(). If null, the material of its mesh.
+        SurfacePoint(const Triangle *triangle_, const Vector3f &position_, const float u_, const float v_, const float time_ = 0.0f, const PrincipledBSDF *material_ = nullptr);
 
         /// @brief Get radiosity generated by an emissive triangle.
         /// @param to_pos
@@ -32,7 +42,7 @@ namespace RenderToy
             */
             const Vector3f ray(to_pos - position);
             const float distance2 = ray.Dot(ray);
-            const float cos_area = out_dir.Dot(GetNormal()) * triangle->AreaC();
+            const float cos_area = out_dir.Dot(GetNormal()) * triangle->AreaC(time);
             if constexpr (is_solid_angle)
             {
                 pdf = std::abs(distance2 / cos_area);
@@ -41,7 +51,7 @@ namespace RenderToy
             {
                 pdf = distance2;
             }
-            return triangle->parent->tex->emission;
+            return material->emission;
         }
 
         const Triangle *GetHitTriangle();
@@ -49,14 +59,53 @@ namespace RenderToy
         Vector3f &GetPosition();
         const Vector3f &GetPosition() const;
         const Mesh *GetHitMesh() const;
+        /// @brief Get the material, with its textures applied if ApplyTextures() was called.
+        /// @return
         const PrincipledBSDF *GetMaterial() const;
+        /// @brief Shade with a material whose textured parameters take their values at this point, see PrincipledBSDF::ApplyTextures(),
+        /// and perturb the shading normal by the normal or bump map of the material.
+        /// Does nothing for untextured materials, which are shared as they are.
+        /// @param direction Direction of the ray that hit the point, foreshortens the footprint.
+        /// @param width Width of the ray cone at the point, see RayState. Zero reads full resolution.
+        /// @param eta RayState::eta the point is shaded with.
+        /// @param misses Incremented by every texture tile that had to be loaded.
+        void ApplyTextures(const Vector3f &direction, const float width, const float eta, uint64_t &misses);
+        /// @brief Get the texture coordinates, interpolated from the ones of the triangle.
+        /// @return
+        const Vector2f GetUV() const;
+        /// @brief Get the normal interpolated from the vertex normals, or the geometrical one for flat meshes.
+        /// @return
         const Vector3f GetNormal() const;
+        /// @brief Get the normal to shade with, GetNormal() unless ApplyTextures() perturbed it.
+        /// @return
+        const Vector3f GetShadingNormal() const;
+        /// @brief Get the tangent the shading normal was perturbed along, to build the shading frame around it.
+        /// @return Zero if the normal was not perturbed, any frame around it will do.
+        const Vector3f GetShadingTangent() const;
+        /// @brief Get the tangent interpolated from the vertex tangents.
+        /// @return Zero if the mesh has none.
+        const Vector3f GetTangent() const;
         const Vector3f GetGeometricalNormal() const;
+        const float GetTime() const;
 
     private:
+        /// @brief Perturb the shading normal by the normal or bump map of the material.
+        /// @param uv
+        /// @param footprint
+        /// @param uv_per_world Length in UV units of a unit length on the surface.
+        /// @param misses
+        void Perturb(const Vector2f &uv, const float footprint, const float uv_per_world, uint64_t &misses);
+
         const Triangle *triangle;
+        const PrincipledBSDF *material;
+        std::optional<PrincipledBSDF> textured_material;
+        // Set by Perturb().
+        bool perturbed = false;
+        Vector3f shading_normal;
+        Vector3f shading_tangent;
         Vector3f position;
         float u, v;
+        float time;
     };
 }
 
@@ -0,0 +1,185 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "rtmath.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace RenderToy
+{
+    /// @brief A texture looked up by surface UV.
+    struct ITexture
+    {
+        virtual ~ITexture() = default;
+
+        /// @brief Get the filtered value at uv.
+        /// @param uv Texture coordinates, wrapped into [0, 1).
+        /// @param lod Level of detail, 0 is the full resolution and every level up halves it.
+        /// @param misses Incremented by every tile that had to be loaded.
+        /// @return
+        virtual const Vector3f Sample(const Vector2f &uv, const float lod, uint64_t &misses) const = 0;
+        /// @brief Get the level of detail matching a footprint, the smallest one that does not alias.
+        /// @param footprint Width of the area a lookup stands for, in UV units.
+        /// @return
+        virtual const float Level(const float footprint) const = 0;
+    };
+
+    /// @brief Fixed-size LRU cache of texture tiles, shared by all textures using it. Thread safe.
+    /// Keys are split over shards with their own lock and LRU list, so threads hitting different tiles rarely wait on each other.
+    class TileCache
+    {
+    public:
+        /// @brief Width and height of a tile in texels.
+        static constexpr std::size_t kTileSize = 32;
+
+        struct Tile
+        {
+            Vector3f texels[kTileSize * kTileSize];
+        };
+
+        /// @brief Construct an empty cache.
+        /// @param capacity_ Number of tiles kept resident, rounded up to a multiple of the shard count.
+        explicit TileCache(const std::size_t capacity_ = 4096);
+        TileCache(const TileCache &) = delete;
+
+        /// @brief Find a resident tile and mark it as most recently used. Counts a miss if there is none.
+        /// @param key
+        /// @return Null on a miss.
+        const std::shared_ptr<const Tile> Find(const uint64_t key);
+        /// @brief Make a loaded tile resident, evicting the least recently used tiles of its shard beyond capacity.
+        /// Tiles still referenced elsewhere stay alive until released.
+        /// @param key
+        /// @param tile
+        /// @return The resident tile, which is another one if a thread loaded the same key first.
+        const std::shared_ptr<const Tile> Insert(const uint64_t key, std::shared_ptr<const Tile> tile);
+
+        /// @brief Evict everything.
+        void Clear();
+        /// @brief Change the number of tiles kept resident, evicting tiles beyond it.
+        /// @param capacity_
+        void SetCapacity(const std::size_t capacity_);
+        const std::size_t Capacity() const;
+        /// @brief Get the number of resident tiles.
+        /// @return
+        const std::size_t Size() const;
+        /// @brief Get the number of Find() calls that missed since construction.
+        /// @return
+        const uint64_t Misses() const;
+
+        /// @brief Cache used by textures unless given another one.
+        /// @return
+        static TileCache &Global();
+
+    private:
+        static constexpr std::size_t kShards = 16;
+
+        struct alignas(64) Shard
+        {
+            mutable std::mutex mutex;
+            // Most recently used first.
+            std::list<std::pair<uint64_t, std::shared_ptr<const Tile>>> lru;
+            std::unordered_map<uint64_t, decltype(lru)::iterator> index;
+
+            void Evict(const std::size_t capacity);
+        };
+
+        static const std::size_t ShardOf(const uint64_t key);
+
+        Shard shards[kShards];
+        std::atomic<std::size_t> shard_capacity;
+        std::atomic<uint64_t> misses = 0;
+    };
+
+    /// @brief Mip-mapped texture whose tiles are loaded into a tile cache on demand.
+    /// Lookups wrap around, v runs from the bottom row up as in OBJ. Every level halves the one below, down to a single texel.
+    class TiledTexture : public ITexture
+    {
+    public:
+        TiledTexture(const TiledTexture &) = delete;
+
+        /// @brief Bilinear inside a level and linear between the two levels around lod.
+        const Vector3f Sample(const Vector2f &uv, const float lod, uint64_t &misses) const override;
+        /// @brief The level whose texels are as wide as footprint.
+        const float Level(const float footprint) const override;
+        /// @brief Get a single texel.
+        /// @param level
+        /// @param x Column, wrapped around.
+        /// @param y Row from the top, wrapped around.
+        /// @param misses Incremented if the tile had to be loaded.
+        /// @return
+        const Vector3f Texel(const std::size_t level, const long x, const long y, uint64_t &misses) const;
+
+        const std::size_t LevelCount() const;
+        const SizeN &Resolution(const std::size_t level = 0) const;
+
+        /// @brief Drop the tiles loaded so far, for textures whose content changed. Stale tiles age out of the cache.
+        void Invalidate();
+
+    protected:
+        /// @brief Lay out the levels. Throws InvalidImageException if resolution_ is empty or too large.
+        /// @param resolution_
+        /// @param cache_ Cache to load tiles into.
+        TiledTexture(const SizeN &resolution_, TileCache *cache_);
+
+        /// @brief Fill a tile on a miss. Called from any thread.
+        /// Texels past the border of the level are never filtered in.
+        /// @param level
+        /// @param tile_x
+        /// @param tile_y
+        /// @param tile
+        /// @return False if the tile could not be loaded, it is then shown magenta and not cached.
+        virtual const bool Load(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, TileCache::Tile &tile) const = 0;
+
+        /// @brief Get the index of a tile over all levels, from the finest level up and row by row inside a level.
+        /// @param level
+        /// @param tile_x
+        /// @param tile_y
+        /// @return
+        const std::size_t TileIndex(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y) const;
+
+    private:
+        struct MipLevel
+        {
+            SizeN resolution;
+            std::size_t tiles_x;
+            std::size_t first_tile;
+        };
+
+        const Vector3f Bilinear(const std::size_t level, const Vector2f &uv, uint64_t &misses) const;
+        const std::shared_ptr<const TileCache::Tile> GetTile(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, uint64_t &misses) const;
+
+        std::vector<MipLevel> levels;
+        std::size_t tile_count = 0;
+        TileCache *cache;
+        // Distinguishes the tiles of this texture from the ones of others in the cache.
+        uint64_t id;
+    };
+
+    /// @brief Image texture paged in tile by tile.
+    /// The box filtered pyramid is written to an unlinked temporary file on construction, and only tiles in the tile cache stay in memory.
+    class ImageTexture : public TiledTexture
+    {
+    public:
+        /// @brief Build the mip pyramid of an image and page it out. Throws InvalidImageException if it is empty, too large or cannot be paged out.
+        /// @param texels Rows from top to bottom, only read during construction.
+        /// @param resolution_
+        /// @param cache_ Cache to load tiles into.
+        ImageTexture(const std::vector<Vector3f> &texels, const SizeN &resolution_, TileCache *cache_ = &TileCache::Global());
+        ~ImageTexture();
+
+    protected:
+        const bool Load(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, TileCache::Tile &tile) const override;
+
+    private:
+        int fd = -1;
+    };
+}
+
+#endif // TEXTURE_H
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace RenderToy::Trace
+{
+    /// @brief Events kept per thread. Older events are overwritten once a thread has recorded more.
+    static constexpr std::size_t kRingCapacity = 1 << 16;
+
+    /// @brief Record the wall clock time of a scope as a complete event of the calling thread.
+    /// Use TRACE_SCOPE() instead, which compiles to nothing unless RENDERTOY_ENABLE_TRACING is defined.
+    class Scope
+    {
+    public:
+        /// @param name_ Must outlive the trace, a string literal in practice.
+        Scope(const char *name_);
+        Scope(const Scope &) = delete;
+        ~Scope();
+
+    private:
+        const char *name;
+        int64_t begin;
+    };
+
+    /// @brief Whether the library was built with RENDERTOY_ENABLE_TRACING.
+    /// @return
+    const bool Enabled();
+
+    /// @brief Write the events of all threads as Chrome trace event JSON, readable by chrome://tracing and Perfetto.
+    /// Not thread safe against recording, call it while nothing is traced.
+    /// @param os
+    void Write(std::ostream &os);
+
+    /// @brief Drop all recorded events.
+    void Clear();
+}
+
+#ifdef RENDERTOY_ENABLE_TRACING
+#define RENDERTOY_TRACE_CONCAT_(a, b) a##b
+#define RENDERTOY_TRACE_CONCAT(a, b) RENDERTOY_TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) ::RenderToy::Trace::Scope RENDERTOY_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif // TRACE_H
@@ -4,40 +4,107 @@
 #include "object.h"
 #include "rtmath.h"
 #include "material.h"
+#include "distribution.h"
+#include "lightbvh.h"
+#include "environment.h"
 
 #include <vector>
+#include <unordered_map>
 
 namespace RenderToy
 {
+    /// @brief Strategy used to choose an emissive triangle for direct light sampling.
+    enum class EmitterSampling
+    {
+        kPower = 0,
+        kLightBVH
+    };
+
     /// @brief Contains everything in the world space. Including meshes and cameras.
     struct World
     {
         std::vector<Mesh *> meshes;
         std::vector<Triangle *> triangles;
         std::vector<Camera> cameras;
+        /// @brief Material table, indexed by Triangle::material_id.
         std::vector<PrincipledBSDF *> materials;
         std::vector<Light *> lights;
+        /// @brief Textures referenced by materials.
+        std::vector<ITexture *> textures;
 
-        /// @brief Randomly chooses a emissive triangle in the scene. Used by source sampling.
-        /// @param random
+        /// @brief Randomly chooses a emissive triangle in the scene, proportional to its power. Used by source sampling.
         /// @param position_o
         /// @param id_o
-        void SampleEmitter(Vector3f &position_o, const Triangle *&id_o) const;
+        /// @param pmf_o Probability of choosing id_o.
+        /// @param time Time in the shutter interval to sample position_o at.
+        void SampleEmitter(Vector3f &position_o, const Triangle *&id_o, float &pmf_o, const float time = 0.0f) const;
+
+        /// @brief Get the probability of SampleEmitter choosing given triangle.
+        /// @param triangle
+        /// @return Zero if the triangle is not emissive.
+        const float EmitterPMF(const Triangle *triangle) const;
+
+        /// @brief Chooses an emissive triangle for a receiver by emitter_sampling strategy.
+        /// @param position Receiver position.
+        /// @param normal Receiver normal.
+        /// @param position_o
+        /// @param id_o
+        /// @param pmf_o Probability of choosing id_o.
+        /// @param time Time in the shutter interval to sample position_o at.
+        void SampleEmitter(const Vector3f &position, const Vector3f &normal, Vector3f &position_o, const Triangle *&id_o, float &pmf_o, const float time = 0.0f) const;
+
+        /// @brief Get the probability of SampleEmitter choosing given triangle for a receiver.
+        /// @param position Receiver position.
+        /// @param normal Receiver normal.
+        /// @param triangle
+        /// @return Zero if the triangle is not emissive.
+        const float EmitterPMF(const Vector3f &position, const Vector3f &normal, const Triangle *triangle) const;
+
+        EmitterSampling emitter_sampling = EmitterSampling::kLightBVH;
+
+        /// @brief Whether any camera or mesh moves while the shutter is open.
+        /// @return
+        const bool HasMotion() const;
 
         /// @brief Count all emissive triangles in the world.
         /// @return 
         int CountEmitters() const;
 
-        /// @brief A must-evaluate function (for DLS) marking all emissive triangles in the world.
+        /// @brief A must-evaluate function (for DLS) marking all emissive triangles in the world and building their power distribution.
+        /// Also prepares the environment map for sampling.
         void PrepareDirectLightSampling();
 
+        /// @brief Add the material of every mesh to materials, give every triangle the id of its material and prepare all materials.
+        /// Called by PrepareDirectLightSampling().
+        void PrepareMaterials();
+        /// @brief Get a material by Triangle::material_id.
+        /// @param id
+        /// @return
+        const PrincipledBSDF *GetMaterial(const uint16_t id) const
+        {
+            return materials[id];
+        }
+        /// @brief Replace a material of the table, for every triangle using it. Meshes using it are pointed at the new one, triangles are left alone.
+        /// Prepares all materials again, for the medium of the new one. Call PrepareDirectLightSampling() afterwards if the emission changes.
+        /// @param id
+        /// @param material
+        void SetMaterial(const uint16_t id, PrincipledBSDF *material);
+
+        /// @brief Lights escaped rays and is sampled by DLS. Replaces sky_emission and ground_reflection if set. Not deleted by World, RGBEImporter::Import() deletes the one it replaces.
+        EnvironmentMap *environment = nullptr;
         Vector3f sky_emission;
         Vector3f ground_reflection;
 
+        /// @brief Get the radiance escaped rays receive.
+        /// @param back_dir Opposite of the ray direction.
+        /// @return
         const Vector3f GetDefaultEmission(const Vector3f &back_dir) const;
 
     private:
         std::vector<const Triangle *> emissive_triangles;
+        std::unordered_map<const Triangle *, std::size_t> emitter_index;
+        AliasTable emitter_distribution;
+        LightBVH emitter_hierarchy;
     };
 }
 
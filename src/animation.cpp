@@ -0,0 +1,57 @@
+#include <RenderToy/animation.h>
+
+#include <algorithm>
+
+namespace RenderToy
+{
+    TransformKey::TransformKey(const float frame_, const Vector3f &location_, const Vector3f &rotation_euler_)
+        : frame(frame_), location(location_), rotation_euler(rotation_euler_)
+    {
+    }
+
+    const Matrix4x4f TransformKey::O2W() const
+    {
+        return AffineTransformation::Translation(location) * AffineTransformation::RotationEulerXYZ(rotation_euler);
+    }
+
+    TransformTrack::TransformTrack(const std::vector<TransformKey> &keys_)
+        : keys(keys_)
+    {
+        std::stable_sort(keys.begin(), keys.end(), [](const TransformKey &a, const TransformKey &b) -> bool
+                         { return a.frame < b.frame; });
+    }
+
+    void TransformTrack::Insert(const TransformKey &key)
+    {
+        auto it = std::upper_bound(keys.begin(), keys.end(), key, [](const TransformKey &a, const TransformKey &b) -> bool
+                                   { return a.frame < b.frame; });
+        keys.insert(it, key);
+    }
+
+    const TransformKey TransformTrack::Evaluate(const float frame) const
+    {
+        if (keys.empty())
+        {
+            return TransformKey(frame, Vector3f::O);
+        }
+        if (frame <= keys.front().frame)
+        {
+            return keys.front();
+        }
+        if (frame >= keys.back().frame)
+        {
+            return keys.back();
+        }
+
+        auto next = std::upper_bound(keys.begin(), keys.end(), frame, [](const float f, const TransformKey &k) -> bool
+                                     { return f < k.frame; });
+        auto prev = next - 1;
+        const float a = (frame - prev->frame) / (next->frame - prev->frame);
+        return TransformKey(frame, Lerp(prev->location, next->location, a), Lerp(prev->rotation_euler, next->rotation_euler, a));
+    }
+
+    const bool TransformTrack::Empty() const
+    {
+        return keys.empty();
+    }
+}
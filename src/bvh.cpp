@@ -1,5 +1,6 @@
 #include <RenderToy/bvh.h>
 #include <RenderToy/object.h>
+#include <RenderToy/trace.h>
 
 #include <cstring>
 #include <queue>
@@ -16,7 +17,7 @@ namespace RenderToy
     {
     }
 
-    const bool BoundingBox::Intersect(const Ray &ray, float &t_min, float &t_max)
+    const bool BoundingBox::Intersect(const Ray &ray, float &t_min, float &t_max) const
     {
         float tmin = (vmin.x() - ray.src.x()) / ray.direction.x();
         float tmax = (vmax.x() - ray.src.x()) / ray.direction.x();
@@ -88,6 +89,12 @@ namespace RenderToy
         return 0.5f * (vmin + vmax);
     }
 
+    const float BoundingBox::SurfaceArea() const
+    {
+        const Vector3f d = vmax - vmin;
+        return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
     OctreeNode::OctreeNode()
         : is_leaf(true)
     {
@@ -97,6 +104,11 @@ namespace RenderToy
         }
     }
 
+    const BoundingBox OctreeNode::Bounds(const float time) const
+    {
+        return BoundingBox(Lerp(bbox.vmin, bbox_close.vmin, time), Lerp(bbox.vmax, bbox_close.vmax, time));
+    }
+
     OctreeNode::~OctreeNode()
     {
         // Do nothing.
@@ -119,6 +131,16 @@ namespace RenderToy
         Build(root, tree_bbox);
     }
 
+    void Octree::Refit()
+    {
+        Refit(root);
+    }
+
+    const float Octree::Cost() const
+    {
+        return Cost(root);
+    }
+
     Octree::~Octree()
     {
         RecursiveDelete(root);
@@ -227,6 +249,53 @@ namespace RenderToy
         }
     }
 
+    const bool Octree::Refit(OctreeNode *node)
+    {
+        // Returns FALSE for empty subtrees, which must not contribute to their parent's bounds.
+        bool initialized = false;
+        if (node->is_leaf)
+        {
+            for (const auto &e : node->node_bbox_list)
+            {
+                const BoundingBox close = e->object != nullptr ? e->object->BBox(1.0f) : *e;
+                node->bbox = initialized ? node->bbox : *e;
+                node->bbox.ExtendBy(*e);
+                node->bbox_close = initialized ? node->bbox_close : close;
+                node->bbox_close.ExtendBy(close);
+                initialized = true;
+            }
+        }
+        else
+        {
+            for (uint8_t i = 0; i < 8; ++i)
+            {
+                if (node->child[i] && Refit(node->child[i]))
+                {
+                    node->bbox = initialized ? node->bbox : node->child[i]->bbox;
+                    node->bbox.ExtendBy(node->child[i]->bbox);
+                    node->bbox_close = initialized ? node->bbox_close : node->child[i]->bbox_close;
+                    node->bbox_close.ExtendBy(node->child[i]->bbox_close);
+                    initialized = true;
+                }
+            }
+        }
+        return initialized;
+    }
+
+    const float Octree::Cost(const OctreeNode *node) const
+    {
+        // Rays see the bounds anywhere between shutter open and close.
+        float cost = 0.5f * (node->bbox.SurfaceArea() + node->bbox_close.SurfaceArea());
+        for (uint8_t i = 0; i < 8; ++i)
+        {
+            if (node->child[i] != nullptr)
+            {
+                cost += Cost(node->child[i]);
+            }
+        }
+        return cost;
+    }
+
     void Octree::RecursiveDelete(OctreeNode *&node)
     {
         for (uint8_t i = 0; i < 8; ++i)
@@ -244,23 +313,64 @@ namespace RenderToy
         : models(&models)
 #endif
     {
+        bbox_list.resize(models.size());
+        for (std::size_t i = 0; i < models.size(); ++i)
+        {
+            bbox_list[i].object = models[i];
+        }
+        Build();
+    }
+
+    void BVH::Build()
+    {
+        TRACE_SCOPE("BVH::Build");
         BoundingBox tree_bbox;
-        bbox_list.reserve(models.size());
-        for (int i = 0; i < models.size(); ++i)
+        motion = false;
+        for (std::size_t i = 0; i < bbox_list.size(); ++i)
         {
-            bbox_list[i] = models[i]->BBox();
+            const Triangle *object = bbox_list[i].object;
+            bbox_list[i] = object->BBox(0.0f);
+            bbox_list[i].object = object;
             tree_bbox.ExtendBy(bbox_list[i]);
-            bbox_list[i].object = models[i];
+            motion = motion || object->IsMoving();
         }
 
         octree = new Octree(tree_bbox);
 
-        for (int i = 0; i < models.size(); ++i)
+        for (std::size_t i = 0; i < bbox_list.size(); ++i)
         {
             octree->Insert(&bbox_list[i]);
         }
 
         octree->Build();
+        // Build() grows node bounds from the default box at the origin, tighten them.
+        octree->Refit();
+        build_cost = octree->Cost();
+    }
+
+    void BVH::Refit()
+    {
+        TRACE_SCOPE("BVH::Refit");
+        motion = false;
+        for (auto &bbox : bbox_list)
+        {
+            const Triangle *object = bbox.object;
+            bbox = object->BBox(0.0f);
+            bbox.object = object;
+            motion = motion || object->IsMoving();
+        }
+        octree->Refit();
+    }
+
+    void BVH::Rebuild()
+    {
+        delete octree;
+        Build();
+    }
+
+    const float BVH::Degradation() const
+    {
+        return build_cost > 0.0f ? octree->Cost() / build_cost : 1.0f;
     }
 
     const Triangle *BVH::Intersect(const Ray &ray, Vector3f &position, float &t, float &u, float &v, const Triangle *const exclude) const
@@ -288,7 +398,7 @@ namespace RenderToy
         t = kFloatInfinity;
         const Triangle *intersected = nullptr;
         float t_min, t_max = kFloatInfinity;
-        bool intersected_test = octree->root->bbox.Intersect(ray, t_min, t_max);
+        bool intersected_test = motion ? octree->root->Bounds(ray.time).Intersect(ray, t_min, t_max) : octree->root->bbox.Intersect(ray, t_min, t_max);
         if (!intersected_test || t_max < 0.0f)
         {
             return nullptr;
@@ -326,7 +436,8 @@ namespace RenderToy
                     if (node->child[i] != nullptr)
                     {
                         float t_min_child, t_max_child;
-                        if (node->child[i]->bbox.Intersect(ray, t_min_child, t_max_child))
+                        const OctreeNode *child = node->child[i];
+                        if (motion ? child->Bounds(ray.time).Intersect(ray, t_min_child, t_max_child) : child->bbox.Intersect(ray, t_min_child, t_max_child))
                         {
                             // float t = (t_min_child < 0.0f && t_max_child >= 0.0f) ? t_max_child : t_min_child;
                             queue.push(Octree::QueueElement(node->child[i], t_min_child));
@@ -0,0 +1,165 @@
+#include <RenderToy/checkpoint.h>
+#include <RenderToy/exception.h>
+#include <RenderToy/trace.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+namespace RenderToy
+{
+    static constexpr char kCheckpointMagic[4] = {'R', 'T', 'C', 'K'};
+    static constexpr uint32_t kCheckpointVersion = 4;
+    static_assert(sizeof(Vector3d) == 3 * sizeof(double), "Sums are written as packed doubles.");
+
+    template <typename T>
+    static void WriteValue(std::ostream &os, const T &value)
+    {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static const T ReadValue(std::istream &is)
+    {
+        T value;
+        if (!is.read(reinterpret_cast<char *>(&value), sizeof(T)))
+        {
+            throw Exception::InvalidCheckpointException("Unexpected end of checkpoint.");
+        }
+        return value;
+    }
+
+    void RenderCheckpoint::Save(const PathTracingRenderer &renderer, std::ostream &os)
+    {
+        TRACE_SCOPE("RenderCheckpoint::Save");
+        const RenderContext *rc = renderer.render_context;
+
+        os.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+        WriteValue<uint32_t>(os, kCheckpointVersion);
+        WriteValue<uint64_t>(os, rc->format_settings.resolution.width);
+        WriteValue<uint64_t>(os, rc->format_settings.resolution.height);
+        WriteValue<int32_t>(os, rc->buffer_origin.x);
+        WriteValue<int32_t>(os, rc->buffer_origin.y);
+        WriteValue<uint64_t>(os, rc->buffer_size.width);
+        WriteValue<uint64_t>(os, rc->buffer_size.height);
+        WriteValue<int32_t>(os, rc->camera_id);
+        WriteValue<int32_t>(os, renderer.iteration_count);
+        WriteValue<int32_t>(os, renderer.finished_iterations);
+
+        // Random sequences are derived from the seed, there is no engine state to save.
+        WriteValue<uint64_t>(os, renderer.seed);
+        WriteValue<int32_t>(os, renderer.sample_offset);
+
+        // Save the double precision sums in scanline order, the buffer would lose their low bits.
+        const bool accumulated = renderer.accumulation.Size() == rc->buffer_size;
+        std::vector<Vector3d> row(rc->buffer_size.width);
+        for (std::size_t y = 0; y < rc->buffer_size.height; ++y)
+        {
+            for (std::size_t x = 0; x < rc->buffer_size.width; ++x)
+            {
+                row[x] = accumulated ? renderer.accumulation(x, y) : Vector3d();
+            }
+            os.write(reinterpret_cast<const char *>(row.data()), sizeof(Vector3d) * row.size());
+        }
+    }
+
+    void RenderCheckpoint::Save(const PathTracingRenderer &renderer, const std::string &path)
+    {
+        // A job may be killed while writing, never leave a truncated checkpoint behind.
+        const std::string temp_path = path + ".tmp";
+        {
+            std::ofstream fs(temp_path, std::ios::binary | std::ios::trunc);
+            if (!fs)
+            {
+                throw Exception::InvalidCheckpointException("Cannot open " + temp_path + " for writing.");
+            }
+            Save(renderer, fs);
+            if (!fs.flush())
+            {
+                throw Exception::InvalidCheckpointException("Failed to write " + temp_path + ".");
+            }
+        }
+        std::filesystem::rename(temp_path, path);
+    }
+
+    void RenderCheckpoint::Load(PathTracingRenderer &renderer, std::istream &is)
+    {
+        TRACE_SCOPE("RenderCheckpoint::Load");
+        RenderContext *rc = renderer.render_context;
+
+        char magic[sizeof(kCheckpointMagic)];
+        if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kCheckpointMagic))
+        {
+            throw Exception::InvalidCheckpointException("Not a RenderToy checkpoint.");
+        }
+        if (ReadValue<uint32_t>(is) != kCheckpointVersion)
+        {
+            throw Exception::InvalidCheckpointException("Unsupported checkpoint version.");
+        }
+
+        const uint64_t width = ReadValue<uint64_t>(is);
+        const uint64_t height = ReadValue<uint64_t>(is);
+        const int32_t buffer_x = ReadValue<int32_t>(is);
+        const int32_t buffer_y = ReadValue<int32_t>(is);
+        const uint64_t buffer_width = ReadValue<uint64_t>(is);
+        const uint64_t buffer_height = ReadValue<uint64_t>(is);
+        const int32_t camera_id = ReadValue<int32_t>(is);
+        const int32_t iteration_count = ReadValue<int32_t>(is);
+        const int32_t finished_iterations = ReadValue<int32_t>(is);
+        if (width != rc->format_settings.resolution.width || height != rc->format_settings.resolution.height)
+        {
+            throw Exception::CheckpointNotMatchException("Checkpoint resolution does not match the render context.");
+        }
+        if (buffer_x != rc->buffer_origin.x || buffer_y != rc->buffer_origin.y || buffer_width != rc->buffer_size.width || buffer_height != rc->buffer_size.height)
+        {
+            throw Exception::CheckpointNotMatchException("Checkpoint render region does not match the render context.");
+        }
+        if (camera_id != rc->camera_id)
+        {
+            throw Exception::CheckpointNotMatchException("Checkpoint camera does not match the render context.");
+        }
+        if (iteration_count != renderer.iteration_count)
+        {
+            // The buffer is normalized by the iteration count.
+            throw Exception::CheckpointNotMatchException("Checkpoint iteration count does not match the renderer.");
+        }
+        if (finished_iterations < 0 || finished_iterations > iteration_count)
+        {
+            throw Exception::InvalidCheckpointException("Invalid number of finished iterations.");
+        }
+
+        const uint64_t seed = ReadValue<uint64_t>(is);
+        const int32_t sample_offset = ReadValue<int32_t>(is);
+
+        std::vector<Vector3d> sums(rc->buffer_size.Area());
+        if (!is.read(reinterpret_cast<char *>(sums.data()), sizeof(Vector3d) * sums.size()))
+        {
+            throw Exception::InvalidCheckpointException("Unexpected end of checkpoint.");
+        }
+
+        // Commit only after the whole checkpoint has been validated.
+        renderer.seed = seed;
+        renderer.sample_offset = sample_offset;
+        renderer.finished_iterations = finished_iterations;
+        renderer.accumulation.Resize(rc->buffer_size);
+        for (std::size_t y = 0; y < rc->buffer_size.height; ++y)
+        {
+            for (std::size_t x = 0; x < rc->buffer_size.width; ++x)
+            {
+                renderer.accumulation(x, y) = sums[y * rc->buffer_size.width + x];
+            }
+        }
+        renderer.accumulation.Resolve(rc->buffer, 1.0 / double(iteration_count));
+    }
+
+    void RenderCheckpoint::Load(PathTracingRenderer &renderer, const std::string &path)
+    {
+        std::ifstream fs(path, std::ios::binary);
+        if (!fs)
+        {
+            throw Exception::InvalidCheckpointException("Cannot open " + path + ".");
+        }
+        Load(renderer, fs);
+    }
+}
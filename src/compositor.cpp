@@ -1,5 +1,6 @@
 #include <RenderToy/compositor.h>
 #include <RenderToy/exception.h>
+#include <RenderToy/trace.h>
 
 using namespace RenderToy;
 
@@ -10,7 +11,7 @@ RenderToy::Image::Image(const SizeN &resolution_)
 }
 
 RenderToy::Image::Image(const RenderContext *const render_context_)
-    : resolution(render_context_->format_settings.resolution)
+    : resolution(render_context_->buffer_size)
 {
     buffer = new Vector3f[resolution.Area()];
     for (int i = 0; i < resolution.Area(); ++i)
@@ -41,6 +42,7 @@ const Vector3f &RenderToy::Image::operator()(const std::size_t x, const std::siz
 
 Image &RenderToy::Image::GaussianBlur(const std::size_t size, const float sigma)
 {
+    TRACE_SCOPE("Image::GaussianBlur");
     // UnitizedGaussianKernel<float> gk(size, sigma);
     UnitizedGaussianKernel<float, Orientation::X> gk_x(size, sigma);
     UnitizedGaussianKernel<float, Orientation::Y> gk_y(size, sigma);
@@ -50,6 +52,7 @@ Image &RenderToy::Image::GaussianBlur(const std::size_t size, const float sigma)
 
 const Image RenderToy::Image::Extract(const std::function<bool(const Vector3f &)> &pixel_filter, const Vector3f &default_color)
 {
+    TRACE_SCOPE("Image::Extract");
     Image ret(resolution);
     for (int i = 0; i < resolution.Area(); ++i)
     {
@@ -60,6 +63,7 @@ const Image RenderToy::Image::Extract(const std::function<bool(const Vector3f &)
 
 const void RenderToy::Image::Transform(const std::function<void(Vector3f &)> &pixel_processor)
 {
+    TRACE_SCOPE("Image::Transform");
     for (int i = 0; i < resolution.Area(); ++i)
     {
         pixel_processor(buffer[i]);
@@ -68,6 +72,7 @@ const void RenderToy::Image::Transform(const std::function<void(Vector3f &)> &pi
 
 Image &RenderToy::Image::Bloom(const std::size_t size, const float sigma, const float threshold)
 {
+    TRACE_SCOPE("Image::Bloom");
     Image bloom_layer = Extract([&threshold](const Vector3f &_) -> bool
                                 { return (Convert::Luma(_) > threshold); });
     bloom_layer.GaussianBlur(size, sigma);
@@ -236,6 +241,35 @@ void Image::DrawLine(PointN p1, PointN p2, const Vector3f &color)
     }
 }
 
+const Image Image::Crop(PointN origin, const SizeN &size) const
+{
+    Image ret(size);
+    Paste(*this, PointN(-origin.x, -origin.y), ret);
+    return ret;
+}
+
+Image &Image::Paste(const Image &img, const PointN &origin)
+{
+    Paste(img, origin, *this);
+    return (*this);
+}
+
+void Image::Paste(const Image &src, const PointN &origin, Image &dst)
+{
+    // Overlap of src placed at origin with dst, in dst coordinates.
+    PointN p1 = origin;
+    PointN p2(origin.x + int(src.resolution.width), origin.y + int(src.resolution.height));
+    p1.SizeClamp(dst.resolution);
+    p2.SizeClamp(dst.resolution);
+    for (int j = p1.y; j < p2.y; ++j)
+    {
+        for (int i = p1.x; i < p2.x; ++i)
+        {
+            dst.buffer[j * dst.resolution.width + i] = src.buffer[(j - origin.y) * src.resolution.width + (i - origin.x)];
+        }
+    }
+}
+
 void Image::Fill(PointN p1, PointN p2, const Vector3f &color)
 {
     p1.SizeClamp(resolution);
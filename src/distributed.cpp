@@ -0,0 +1,366 @@
+#include <RenderToy/distributed.h>
+#include <RenderToy/exception.h>
+#include <RenderToy/trace.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <deque>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace RenderToy
+{
+    // Both ends run the same build, so messages are sent in native layout.
+    struct WorkMessage
+    {
+        uint32_t index;
+        int32_t x, y;
+        uint64_t width, height;
+        int32_t first_iteration;
+        int32_t iteration_count;
+    };
+
+    struct ResultMessage
+    {
+        uint32_t index;
+        int32_t x, y;
+        uint64_t width, height;
+    };
+
+    static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Pixels are sent as packed floats.");
+
+    static const bool WriteAll(const int fd, const void *data, std::size_t size)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            const ssize_t n = write(fd, ptr, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            ptr += n;
+            size -= std::size_t(n);
+        }
+        return true;
+    }
+
+    static const bool ReadAll(const int fd, void *data, std::size_t size)
+    {
+        char *ptr = static_cast<char *>(data);
+        while (size > 0)
+        {
+            const ssize_t n = read(fd, ptr, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            ptr += n;
+            size -= std::size_t(n);
+        }
+        return true;
+    }
+
+    // Whether every pixel of a result lies in region.
+    static const bool Inside(const ResultMessage &result, const RenderRegion &region)
+    {
+        return result.x >= region.origin.x && result.y >= region.origin.y &&
+               result.width <= region.size.width && result.height <= region.size.height &&
+               uint64_t(result.x - region.origin.x) <= region.size.width - result.width &&
+               uint64_t(result.y - region.origin.y) <= region.size.height - result.height;
+    }
+
+    RenderCoordinator::RenderCoordinator(World *world_, const FormatSettings &format_settings_, const int iteration_count_, const std::size_t worker_count_)
+        : world(world_), format_settings(format_settings_), iteration_count(iteration_count_), worker_count(std::max(worker_count_, std::size_t(1)))
+    {
+    }
+
+    const std::vector<WorkItem> RenderCoordinator::Split() const
+    {
+        // Work inside the render region if there is one.
+        RenderRegion window(PointN(), format_settings.resolution);
+        if (format_settings.region.has_value())
+        {
+            window = RenderRegion(format_settings.region->origin, format_settings.region->size);
+        }
+
+        std::vector<RenderRegion> regions;
+        if (split == WorkSplit::kSamples)
+        {
+            regions.push_back(window);
+        }
+        else
+        {
+            regions = RenderRegion::Buckets(window.size, bucket_size);
+            for (auto &region : regions)
+            {
+                region.origin = region.origin + window.origin;
+            }
+        }
+
+        int chunks = 1;
+        if (split != WorkSplit::kTiles)
+        {
+            chunks = sample_chunks > 0 ? sample_chunks : int(worker_count);
+            chunks = std::clamp(chunks, 1, std::max(iteration_count, 1));
+        }
+
+        std::vector<WorkItem> items;
+        for (int c = 0; c < chunks; ++c)
+        {
+            const int first_iteration = iteration_count * c / chunks;
+            const int last_iteration = iteration_count * (c + 1) / chunks;
+            for (const auto &region : regions)
+            {
+                items.push_back({region, first_iteration, last_iteration - first_iteration});
+            }
+        }
+        return items;
+    }
+
+    const Image RenderCoordinator::Render()
+    {
+        TRACE_SCOPE("RenderCoordinator::Render");
+        const std::vector<WorkItem> items = Split();
+
+        struct Worker
+        {
+            pid_t pid;
+            int command_fd;
+            int result_fd;
+            bool alive;
+            // Index of the item being rendered, or -1 if idle.
+            long item;
+        };
+        std::vector<Worker> workers;
+
+        // A dead worker must not take the coordinator down with SIGPIPE.
+        struct sigaction ignore_sigpipe = {}, previous_sigpipe = {};
+        ignore_sigpipe.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore_sigpipe, &previous_sigpipe);
+
+        auto Retire = [](Worker &worker) -> void
+        {
+            if (worker.alive)
+            {
+                close(worker.command_fd);
+                close(worker.result_fd);
+                worker.alive = false;
+            }
+        };
+        auto Shutdown = [&workers, &previous_sigpipe, &Retire]() -> void
+        {
+            // Closing the command pipe tells a worker to exit.
+            for (auto &worker : workers)
+            {
+                Retire(worker);
+            }
+            for (auto &worker : workers)
+            {
+                waitpid(worker.pid, nullptr, 0);
+            }
+            sigaction(SIGPIPE, &previous_sigpipe, nullptr);
+        };
+
+        for (std::size_t i = 0; i < worker_count; ++i)
+        {
+            int command[2], result[2];
+            if (pipe(command) != 0)
+            {
+                Shutdown();
+                throw Exception::WorkerException("Failed to create a pipe.");
+            }
+            if (pipe(result) != 0)
+            {
+                close(command[0]);
+                close(command[1]);
+                Shutdown();
+                throw Exception::WorkerException("Failed to create a pipe.");
+            }
+
+            const pid_t pid = fork();
+            if (pid == 0)
+            {
+                close(command[1]);
+                close(result[0]);
+                // Drop the ends of earlier workers, otherwise they never see their command pipe close.
+                for (auto &worker : workers)
+                {
+                    close(worker.command_fd);
+                    close(worker.result_fd);
+                }
+                int status = 0;
+                try
+                {
+                    Serve(command[0], result[1]);
+                }
+                catch (...)
+                {
+                    status = 1;
+                }
+                _exit(status);
+            }
+
+            close(command[0]);
+            close(result[1]);
+            if (pid < 0)
+            {
+                close(command[1]);
+                close(result[0]);
+                Shutdown();
+                throw Exception::WorkerException("Failed to fork a worker.");
+            }
+            workers.push_back({pid, command[1], result[0], true, -1});
+        }
+
+        Image frame(format_settings.resolution);
+        std::deque<std::size_t> pending;
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            pending.push_back(i);
+        }
+        std::size_t remaining = items.size();
+        std::vector<Vector3f> pixels;
+        std::vector<pollfd> fds;
+        std::vector<Worker *> polled;
+
+        while (remaining > 0)
+        {
+            // Hand out items to idle workers.
+            for (auto &worker : workers)
+            {
+                if (!worker.alive || worker.item >= 0 || pending.empty())
+                {
+                    continue;
+                }
+                const std::size_t index = pending.front();
+                const WorkItem &item = items[index];
+                const WorkMessage message = {uint32_t(index), item.region.origin.x, item.region.origin.y, item.region.size.width, item.region.size.height, item.first_iteration, item.iteration_count};
+                if (WriteAll(worker.command_fd, &message, sizeof(message)))
+                {
+                    pending.pop_front();
+                    worker.item = long(index);
+                }
+                else
+                {
+                    Retire(worker);
+                }
+            }
+
+            fds.clear();
+            polled.clear();
+            for (auto &worker : workers)
+            {
+                if (worker.alive && worker.item >= 0)
+                {
+                    fds.push_back({worker.result_fd, POLLIN, 0});
+                    polled.push_back(&worker);
+                }
+            }
+            if (fds.empty())
+            {
+                Shutdown();
+                throw Exception::WorkerException("All workers died before the frame was finished.");
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                Shutdown();
+                throw Exception::WorkerException("Failed to wait for workers.");
+            }
+
+            for (std::size_t i = 0; i < fds.size(); ++i)
+            {
+                if (fds[i].revents == 0)
+                {
+                    continue;
+                }
+                Worker &worker = *polled[i];
+                const std::size_t index = std::size_t(worker.item);
+                const WorkItem &item = items[index];
+
+                ResultMessage result;
+                bool ok = ReadAll(worker.result_fd, &result, sizeof(result));
+                // The worker clips the region to the frame, so the result may be smaller than the item, but never outside of either.
+                ok = ok && result.index == index && Inside(result, item.region) && Inside(result, RenderRegion(PointN(), format_settings.resolution));
+                if (ok)
+                {
+                    pixels.resize(result.width * result.height);
+                    ok = ReadAll(worker.result_fd, pixels.data(), sizeof(Vector3f) * pixels.size());
+                }
+                if (!ok)
+                {
+                    // Give the item to another worker.
+                    pending.push_front(index);
+                    worker.item = -1;
+                    Retire(worker);
+                    continue;
+                }
+
+                // Each result is the mean of its own iterations, weight it by its share of the frame's.
+                const float weight = float(item.iteration_count) / float(iteration_count);
+                for (std::size_t y = 0; y < result.height; ++y)
+                {
+                    for (std::size_t x = 0; x < result.width; ++x)
+                    {
+                        frame(result.x + x, result.y + y) += pixels[y * result.width + x] * weight;
+                    }
+                }
+                worker.item = -1;
+                --remaining;
+            }
+        }
+
+        Shutdown();
+        return frame;
+    }
+
+    void RenderCoordinator::Serve(const int in_fd, const int out_fd) const
+    {
+#ifdef _OPENMP
+        if (threads_per_worker > 0)
+        {
+            omp_set_num_threads(threads_per_worker);
+        }
+#endif
+        // The BVH is built once and shared by all items.
+        FormatSettings empty_settings = format_settings;
+        empty_settings.region = RenderRegion(PointN(), SizeN());
+        RenderContext rc(world, empty_settings);
+        rc.camera_id = camera_id;
+
+        WorkMessage message;
+        while (ReadAll(in_fd, &message, sizeof(message)))
+        {
+            rc.SetRegion(RenderRegion(PointN(message.x, message.y), SizeN(message.width, message.height)));
+            PathTracingRenderer renderer(&rc, message.iteration_count);
+            renderer.seed = seed;
+            renderer.sample_offset = message.first_iteration;
+            renderer.Render();
+
+            const ResultMessage result = {message.index, rc.buffer_origin.x, rc.buffer_origin.y, rc.buffer_size.width, rc.buffer_size.height};
+            if (!WriteAll(out_fd, &result, sizeof(result)) || !WriteAll(out_fd, rc.buffer, sizeof(Vector3f) * rc.buffer_size.Area()))
+            {
+                throw Exception::WorkerException("Lost connection to the coordinator.");
+            }
+        }
+    }
+}
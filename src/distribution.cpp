@@ -0,0 +1,204 @@
+#include <RenderToy/distribution.h>
+
+#include <algorithm>
+
+namespace RenderToy
+{
+    AliasTable::AliasTable(const std::vector<float> &weights)
+    {
+        Build(weights);
+    }
+
+    void AliasTable::Build(const std::vector<float> &weights)
+    {
+        const std::size_t n = weights.size();
+        bins.assign(n, Bin{1.0f, 0.0f, 0});
+        if (n == 0)
+        {
+            return;
+        }
+
+        double sum = 0.0;
+        for (auto w : weights)
+        {
+            sum += std::max(w, 0.0f);
+        }
+
+        // Scaled probabilities, 1.0 means "exactly one bin worth".
+        std::vector<double> scaled(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            bins[i].pmf = sum > 0.0 ? float(std::max(weights[i], 0.0f) / sum) : 1.0f / float(n);
+            scaled[i] = sum > 0.0 ? double(std::max(weights[i], 0.0f)) * double(n) / sum : 1.0;
+        }
+
+        std::vector<std::size_t> small, large;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            std::size_t s = small.back();
+            small.pop_back();
+            std::size_t l = large.back();
+
+            bins[s].threshold = float(scaled[s]);
+            bins[s].alias = l;
+
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // Leftovers are full bins up to rounding error.
+        for (auto i : small)
+        {
+            bins[i].threshold = 1.0f;
+            bins[i].alias = i;
+        }
+        for (auto i : large)
+        {
+            bins[i].threshold = 1.0f;
+            bins[i].alias = i;
+        }
+    }
+
+    const std::size_t AliasTable::Sample(const float u, float &pmf_o) const
+    {
+        const float scaled = u * float(bins.size());
+        const std::size_t index = std::min(std::size_t(scaled), bins.size() - 1);
+        const float remapped = scaled - float(index);
+
+        const std::size_t ret = remapped < bins[index].threshold ? index : bins[index].alias;
+        pmf_o = bins[ret].pmf;
+        return ret;
+    }
+
+    const float AliasTable::PMF(const std::size_t index) const
+    {
+        return bins[index].pmf;
+    }
+
+    const std::size_t AliasTable::Size() const
+    {
+        return bins.size();
+    }
+
+    const bool AliasTable::Empty() const
+    {
+        return bins.empty();
+    }
+
+    Distribution1D::Distribution1D(const std::vector<float> &weights)
+    {
+        Build(weights);
+    }
+
+    void Distribution1D::Build(const std::vector<float> &weights_)
+    {
+        const std::size_t n = weights_.size();
+        weights.resize(n);
+        cdf.assign(n + 1, 0.0f);
+        integral = 0.0f;
+        if (n == 0)
+        {
+            return;
+        }
+
+        double sum = 0.0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            weights[i] = std::max(weights_[i], 0.0f);
+            sum += weights[i];
+        }
+        if (sum == 0.0)
+        {
+            weights.assign(n, 1.0f);
+            sum = double(n);
+        }
+        else
+        {
+            integral = float(sum / double(n));
+        }
+
+        double running = 0.0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            running += weights[i];
+            cdf[i + 1] = float(running / sum);
+        }
+        cdf[n] = 1.0f;
+    }
+
+    const float Distribution1D::Sample(const float u, float &pdf_o, std::size_t &index_o) const
+    {
+        const std::size_t n = weights.size();
+        const std::size_t index = std::min(std::size_t(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), n) - 1;
+        const float width = cdf[index + 1] - cdf[index];
+        const float offset = width > 0.0f ? (u - cdf[index]) / width : 0.0f;
+
+        index_o = index;
+        pdf_o = width * float(n);
+        return std::min((float(index) + offset) / float(n), 0.99999994f);
+    }
+
+    const float Distribution1D::PDF(const float x) const
+    {
+        const std::size_t n = weights.size();
+        const std::size_t index = std::min(std::size_t(std::max(x, 0.0f) * float(n)), n - 1);
+        return (cdf[index + 1] - cdf[index]) * float(n);
+    }
+
+    const float Distribution1D::Integral() const
+    {
+        return integral;
+    }
+
+    const std::size_t Distribution1D::Size() const
+    {
+        return weights.size();
+    }
+
+    const bool Distribution1D::Empty() const
+    {
+        return weights.empty();
+    }
+
+    void Distribution2D::Build(const std::vector<float> &weights, const SizeN &size)
+    {
+        conditional.resize(size.height);
+        std::vector<float> row_integrals(size.height);
+        for (std::size_t y = 0; y < size.height; ++y)
+        {
+            conditional[y].Build(std::vector<float>(weights.begin() + y * size.width, weights.begin() + (y + 1) * size.width));
+            row_integrals[y] = conditional[y].Integral();
+        }
+        marginal.Build(row_integrals);
+    }
+
+    const Vector2f Distribution2D::Sample(const float u, const float v, float &pdf_o) const
+    {
+        float pdf_row, pdf_column;
+        std::size_t row, column;
+        const float y = marginal.Sample(v, pdf_row, row);
+        const float x = conditional[row].Sample(u, pdf_column, column);
+        pdf_o = pdf_row * pdf_column;
+        return Vector2f(x, y);
+    }
+
+    const float Distribution2D::PDF(const Vector2f &p) const
+    {
+        const std::size_t row = std::min(std::size_t(std::max(p.y(), 0.0f) * float(conditional.size())), conditional.size() - 1);
+        return marginal.PDF(p.y()) * conditional[row].PDF(p.x());
+    }
+
+    const bool Distribution2D::Empty() const
+    {
+        return conditional.empty();
+    }
+}
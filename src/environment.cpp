@@ -0,0 +1,82 @@
+#include <RenderToy/environment.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace RenderToy
+{
+    EnvironmentMap::EnvironmentMap(const SizeN &resolution_)
+        : resolution(resolution_), texels(resolution_.Area())
+    {
+    }
+
+    Vector3f &EnvironmentMap::operator()(const std::size_t x, const std::size_t y)
+    {
+        return texels[y * resolution.width + x];
+    }
+
+    const Vector3f &EnvironmentMap::operator()(const std::size_t x, const std::size_t y) const
+    {
+        return texels[y * resolution.width + x];
+    }
+
+    const SizeN &EnvironmentMap::Resolution() const
+    {
+        return resolution;
+    }
+
+    void EnvironmentMap::Prepare()
+    {
+        // Rows near the poles cover less solid angle.
+        std::vector<float> weights(texels.size());
+        for (std::size_t y = 0; y < resolution.height; ++y)
+        {
+            const float sin_theta = std::sin(kPi<float> * (float(y) + 0.5f) / float(resolution.height));
+            for (std::size_t x = 0; x < resolution.width; ++x)
+            {
+                weights[y * resolution.width + x] = Convert::Luma((*this)(x, y)) * sin_theta;
+            }
+        }
+        distribution.Build(weights, resolution);
+    }
+
+    const Vector3f EnvironmentMap::Eval(const Vector3f &direction) const
+    {
+        return Texel(ToLatLong(direction)) * intensity;
+    }
+
+    const Vector3f EnvironmentMap::Sample(const float u, const float v, Vector3f &direction_o, float &pdf_o) const
+    {
+        float pdf_uv;
+        const Vector2f uv = distribution.Sample(u, v, pdf_uv);
+        const float theta = uv.y() * kPi<float>;
+        const float phi = uv.x() * 2.0f * kPi<float> - kPi<float>;
+        const float sin_theta = std::sin(theta);
+        direction_o = Vector3f(sin_theta * std::cos(phi), sin_theta * std::sin(phi), std::cos(theta));
+
+        // Jacobian of the lat-long mapping.
+        pdf_o = sin_theta > 0.0f ? pdf_uv / (2.0f * kPi<float> * kPi<float> * sin_theta) : 0.0f;
+        return Texel(uv) * intensity;
+    }
+
+    const float EnvironmentMap::PDF(const Vector3f &direction) const
+    {
+        const Vector2f uv = ToLatLong(direction);
+        const float sin_theta = std::sin(uv.y() * kPi<float>);
+        return sin_theta > 0.0f ? distribution.PDF(uv) / (2.0f * kPi<float> * kPi<float> * sin_theta) : 0.0f;
+    }
+
+    const Vector2f EnvironmentMap::ToLatLong(const Vector3f &direction)
+    {
+        const float theta = std::acos(std::clamp(direction.z(), -1.0f, 1.0f));
+        const float phi = std::atan2(direction.y(), direction.x());
+        return Vector2f((phi + kPi<float>) / (2.0f * kPi<float>), theta / kPi<float>);
+    }
+
+    const Vector3f &EnvironmentMap::Texel(const Vector2f &uv) const
+    {
+        const std::size_t x = std::min(std::size_t(std::max(uv.x(), 0.0f) * float(resolution.width)), resolution.width - 1);
+        const std::size_t y = std::min(std::size_t(std::max(uv.y(), 0.0f) * float(resolution.height)), resolution.height - 1);
+        return (*this)(x, y);
+    }
+}
@@ -14,3 +14,28 @@ RenderToy::Exception::ImageSizeNotMatchException::ImageSizeNotMatchException(con
     : IRenderToyException(exception_what_)
 {
 }
+
+RenderToy::Exception::InvalidCheckpointException::InvalidCheckpointException(const std::string &exception_what_) noexcept
+    : IRenderToyException(exception_what_)
+{
+}
+
+RenderToy::Exception::CheckpointNotMatchException::CheckpointNotMatchException(const std::string &exception_what_) noexcept
+    : IRenderToyException(exception_what_)
+{
+}
+
+RenderToy::Exception::WorkerException::WorkerException(const std::string &exception_what_) noexcept
+    : IRenderToyException(exception_what_)
+{
+}
+
+RenderToy::Exception::InvalidImageException::InvalidImageException(const std::string &exception_what_) noexcept
+    : IRenderToyException(exception_what_)
+{
+}
+
+RenderToy::Exception::TooManyMaterialsException::TooManyMaterialsException(const std::string &exception_what_) noexcept
+    : IRenderToyException(exception_what_)
+{
+}
\ No newline at end of file
@@ -2,11 +2,13 @@
 
 #include <RenderToy/rtmath.h>
 #include <RenderToy/exporter.h>
+#include <RenderToy/trace.h>
 
 namespace RenderToy
 {
     void PPMExporter::Export(std::ostream &os)
     {
+        TRACE_SCOPE("PPMExporter::Export");
         int nx = image.resolution.width;
         int ny = image.resolution.height;
         os << "P3" << std::endl
@@ -35,6 +37,7 @@ namespace RenderToy
 
     void BMPExporter::Export(std::ostream &os)
     {
+        TRACE_SCOPE("BMPExporter::Export");
 #pragma pack(push, 1)
         struct BmpHeader
         {
@@ -108,6 +111,7 @@ namespace RenderToy
 
     void ASCIIExporter::Export(std::ostream &os)
     {
+        TRACE_SCOPE("ASCIIExporter::Export");
         std::size_t ch_count = ascii_characters_by_surface.length();
         for (int i = image.resolution.height - 1; i >= 0; --i)
         {
@@ -0,0 +1,150 @@
+#include <RenderToy/guiding.h>
+#include <RenderToy/trace.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace RenderToy
+{
+    // Fixed point scale of recorded values, and the largest value recorded, keeping sums far from overflow.
+    static constexpr float kFixedPointScale = 65536.0f;
+    static constexpr float kMaxRecordedValue = 1e6f;
+    // Share of every cell spread uniformly over the sphere, so bins with few records are never starved.
+    static constexpr double kUniformShare = 0.5;
+
+    void GuidingField::Reset(const BoundingBox &bounds_, const std::size_t resolution_)
+    {
+        bounds = bounds_;
+        const Vector3f extent = bounds.vmax - bounds.vmin;
+        const float longest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+        const float size = longest > 0.0f ? longest / float(std::max(resolution_, std::size_t(1))) : 1.0f;
+        cell_size = Vector3f(size, size, size);
+
+        std::size_t cell_count = 1;
+        for (int i = 0; i < 3; ++i)
+        {
+            resolution[i] = std::max(std::size_t(std::ceil(extent[i] / size)), std::size_t(1));
+            cell_count *= resolution[i];
+        }
+
+        recorded = std::vector<std::atomic<uint64_t>>(cell_count * kBins);
+        learned.assign(cell_count * kBins, 0);
+        cdf.assign(cell_count * kBins, 0.0f);
+    }
+
+    void GuidingField::Clear()
+    {
+        recorded = std::vector<std::atomic<uint64_t>>();
+        learned.clear();
+        cdf.clear();
+        resolution[0] = resolution[1] = resolution[2] = 0;
+    }
+
+    const bool GuidingField::Empty() const
+    {
+        return cdf.empty();
+    }
+
+    const bool GuidingField::Trained(const Vector3f &position) const
+    {
+        return !cdf.empty() && cdf[Cell(position) * kBins + kBins - 1] > 0.0f;
+    }
+
+    const Vector3f GuidingField::Sample(const Vector3f &position, const Vector3f &normal, float &pdf_o) const
+    {
+        const std::size_t cell = Cell(position);
+        const float *cell_cdf = &cdf[cell * kBins];
+        const std::size_t bin = std::min(std::size_t(std::upper_bound(cell_cdf, cell_cdf + kBins, Random::Float()) - cell_cdf), kBins - 1);
+
+        // Uniform inside the bin.
+        const float cos_theta = -1.0f + 2.0f * (float(bin / kPhiBins) + Random::Float()) / float(kCosThetaBins);
+        const float phi = 2.0f * kPi<float> * (float(bin % kPhiBins) + Random::Float()) / float(kPhiBins) - kPi<float>;
+        const float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+        Vector3f direction(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+
+        const float cos_normal = direction.Dot(normal);
+        if (cos_normal < 0.0f)
+        {
+            direction = direction - normal * (2.0f * cos_normal);
+        }
+        pdf_o = BinPDF(cell, direction) + BinPDF(cell, direction - normal * (2.0f * direction.Dot(normal)));
+        return direction;
+    }
+
+    const float GuidingField::PDF(const Vector3f &position, const Vector3f &normal, const Vector3f &direction) const
+    {
+        const float cos_normal = direction.Dot(normal);
+        if (cdf.empty() || cos_normal < 0.0f)
+        {
+            return 0.0f;
+        }
+        const std::size_t cell = Cell(position);
+        return BinPDF(cell, direction) + BinPDF(cell, direction - normal * (2.0f * cos_normal));
+    }
+
+    void GuidingField::Record(const Vector3f &position, const Vector3f &direction, const float value)
+    {
+        // Also rejects NaN.
+        if (!(value > 0.0f) || recorded.empty())
+        {
+            return;
+        }
+        const uint64_t fixed_point = uint64_t(std::min(value, kMaxRecordedValue) * kFixedPointScale);
+        recorded[Cell(position) * kBins + Bin(direction)].fetch_add(fixed_point, std::memory_order_relaxed);
+    }
+
+    void GuidingField::Update()
+    {
+        TRACE_SCOPE("GuidingField::Update");
+        const std::size_t cell_count = cdf.size() / kBins;
+#pragma omp parallel for
+        for (std::size_t c = 0; c < cell_count; ++c)
+        {
+            uint64_t sum = 0;
+            for (std::size_t b = c * kBins; b < (c + 1) * kBins; ++b)
+            {
+                learned[b] += recorded[b].exchange(0, std::memory_order_relaxed);
+                sum += learned[b];
+            }
+            if (sum == 0)
+            {
+                continue;
+            }
+
+            double running = 0.0;
+            for (std::size_t b = c * kBins; b < (c + 1) * kBins; ++b)
+            {
+                running += (1.0 - kUniformShare) * double(learned[b]) / double(sum) + kUniformShare / double(kBins);
+                cdf[b] = float(running);
+            }
+            cdf[(c + 1) * kBins - 1] = 1.0f;
+        }
+    }
+
+    const std::size_t GuidingField::Cell(const Vector3f &position) const
+    {
+        std::size_t index[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            const float x = (position[i] - bounds.vmin[i]) / cell_size[i];
+            index[i] = x > 0.0f ? std::min(std::size_t(x), resolution[i] - 1) : 0;
+        }
+        return (index[2] * resolution[1] + index[1]) * resolution[0] + index[0];
+    }
+
+    const float GuidingField::BinPDF(const std::size_t cell, const Vector3f &direction) const
+    {
+        const float *cell_cdf = &cdf[cell * kBins];
+        const std::size_t bin = Bin(direction);
+        return (cell_cdf[bin] - (bin > 0 ? cell_cdf[bin - 1] : 0.0f)) * float(kBins) / (4.0f * kPi<float>);
+    }
+
+    const std::size_t GuidingField::Bin(const Vector3f &direction)
+    {
+        const float cos_theta = std::clamp(direction.z(), -1.0f, 1.0f);
+        const std::size_t theta_bin = std::min(std::size_t((cos_theta + 1.0f) * 0.5f * float(kCosThetaBins)), kCosThetaBins - 1);
+        const float phi = std::atan2(direction.y(), direction.x()) + kPi<float>;
+        const std::size_t phi_bin = std::min(std::size_t(phi / (2.0f * kPi<float>) * float(kPhiBins)), kPhiBins - 1);
+        return theta_bin * kPhiBins + phi_bin;
+    }
+}
@@ -2,6 +2,7 @@
 #include <RenderToy/object.h>
 #include <RenderToy/rtmath.h>
 #include <RenderToy/material.h>
+#include <RenderToy/exception.h>
 
 #include <fstream>
 #include <string>
@@ -11,6 +12,9 @@
 #include <limits>
 #include <vector>
 #include <regex>
+#include <cmath>
+#include <filesystem>
+#include <map>
 
 static const std::vector<std::string> Split(const std::string &str, const char delimiter)
 {
@@ -53,6 +57,7 @@ namespace RenderToy
             {
                 if (current_mesh != nullptr)
                 {
+                    current_mesh->ComputeTangents();
                     world.meshes.push_back(current_mesh);
                 }
                 current_mesh = new Mesh();
@@ -141,6 +146,7 @@ namespace RenderToy
         }
         if (current_mesh != nullptr)
         {
+            current_mesh->ComputeTangents();
             world.meshes.push_back(current_mesh);
         }
     }
@@ -153,6 +159,8 @@ namespace RenderToy
 
         std::string identifier;
         PrincipledBSDF *current_material = nullptr;
+        // Maps shared by several materials are imported once, color and data maps apart.
+        std::map<std::pair<std::string, bool>, ImageTexture *> textures;
         while (fs >> identifier)
         {
             if (identifier == "newmtl")
@@ -214,11 +222,54 @@ namespace RenderToy
                 fs >> current_material->anisotropic;
             }
 
-            // TODO: add support for normal map.
-            // if(identifier == "norm")
-            // {
-
-            // }
+            if (identifier == "map_Kd" || identifier == "map_Pr" || identifier == "map_Pm" || identifier == "norm" || identifier == "bump" || identifier == "map_Bump")
+            {
+                // Options come before the file name. Only the bump multiplier is read, the others are skipped.
+                std::string line, token, file;
+                std::getline(fs, line);
+                std::istringstream options(line);
+                while (options >> token)
+                {
+                    if (token == "-bm")
+                    {
+                        options >> current_material->bump_scale;
+                    }
+                    else
+                    {
+                        file = token;
+                    }
+                }
+                const bool srgb = identifier == "map_Kd";
+                auto it = textures.find({file, srgb});
+                if (it == textures.end())
+                {
+                    const std::filesystem::path texture_path = std::filesystem::path(path).parent_path() / file;
+                    ImageTexture *texture = TARGAImporter::Import(texture_path.string(), srgb);
+                    world.textures.push_back(texture);
+                    it = textures.emplace(std::make_pair(file, srgb), texture).first;
+                }
+                if (identifier == "map_Kd")
+                {
+                    current_material->base_color_texture = it->second;
+                }
+                else if (identifier == "map_Pr")
+                {
+                    current_material->roughness_texture = it->second;
+                }
+                else if (identifier == "map_Pm")
+                {
+                    current_material->metallic_texture = it->second;
+                }
+                else if (identifier == "norm")
+                {
+                    current_material->normal_texture = it->second;
+                }
+                else
+                {
+                    current_material->bump_texture = it->second;
+                }
+                continue;
+            }
 
             fs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
         }
@@ -227,4 +278,202 @@ namespace RenderToy
             world.materials.push_back(current_material);
         }
     }
+
+    void RGBEImporter::Import(World &world, const std::string &path)
+    {
+        std::ifstream fs(path, std::ios::binary);
+        if (!fs)
+        {
+            throw Exception::InvalidImageException("Failed to open " + path + ".");
+        }
+
+        std::string line;
+        std::getline(fs, line);
+        if (line.rfind("#?", 0) != 0)
+        {
+            throw Exception::InvalidImageException("Not a Radiance HDR file.");
+        }
+        // Header ends with an empty line.
+        while (std::getline(fs, line) && !line.empty())
+        {
+            if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            {
+                throw Exception::InvalidImageException("Only RGBE pixels are supported.");
+            }
+        }
+
+        // Only the standard orientation, top to bottom and left to right.
+        std::string y_axis, x_axis;
+        std::size_t height = 0, width = 0;
+        std::getline(fs, line);
+        std::istringstream resolution_ss(line);
+        if (!(resolution_ss >> y_axis >> height >> x_axis >> width) || y_axis != "-Y" || x_axis != "+X" || width == 0 || height == 0)
+        {
+            throw Exception::InvalidImageException("Unsupported resolution line.");
+        }
+
+        auto environment = new EnvironmentMap(SizeN(width, height));
+        std::vector<unsigned char> scanline(width * 4);
+        for (std::size_t y = 0; y < height; ++y)
+        {
+            unsigned char head[4];
+            if (!fs.read(reinterpret_cast<char *>(head), 4))
+            {
+                delete environment;
+                throw Exception::InvalidImageException("Unexpected end of file.");
+            }
+
+            if (width >= 8 && width < 32768 && head[0] == 2 && head[1] == 2 && (std::size_t(head[2]) << 8 | head[3]) == width)
+            {
+                // Run length encoded, each channel separately.
+                for (std::size_t c = 0; c < 4; ++c)
+                {
+                    std::size_t x = 0;
+                    while (x < width)
+                    {
+                        const int count = fs.get();
+                        if (count == EOF)
+                        {
+                            break;
+                        }
+                        if (count > 128)
+                        {
+                            const int value = fs.get();
+                            for (int i = 0; i < count - 128 && x < width; ++i)
+                            {
+                                scanline[(x++) * 4 + c] = static_cast<unsigned char>(value);
+                            }
+                        }
+                        else
+                        {
+                            for (int i = 0; i < count && x < width; ++i)
+                            {
+                                scanline[(x++) * 4 + c] = static_cast<unsigned char>(fs.get());
+                            }
+                        }
+                    }
+                }
+            }
+            else
+            {
+                // Flat pixels.
+                std::copy(head, head + 4, scanline.begin());
+                fs.read(reinterpret_cast<char *>(scanline.data() + 4), std::streamsize(width * 4 - 4));
+            }
+            if (!fs)
+            {
+                delete environment;
+                throw Exception::InvalidImageException("Unexpected end of file.");
+            }
+
+            for (std::size_t x = 0; x < width; ++x)
+            {
+                const unsigned char *rgbe = &scanline[x * 4];
+                if (rgbe[3] != 0)
+                {
+                    const float scale = std::ldexp(1.0f, int(rgbe[3]) - (128 + 8));
+                    (*environment)(x, y) = Vector3f(float(rgbe[0]), float(rgbe[1]), float(rgbe[2])) * scale;
+                }
+            }
+        }
+
+        delete world.environment;
+        world.environment = environment;
+    }
+
+    static const float SRGBToLinear(const unsigned char c)
+    {
+        const float x = float(c) / 255.0f;
+        return x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+    }
+
+    ImageTexture *TARGAImporter::Import(const std::string &path, const bool srgb, TileCache *cache)
+    {
+        std::ifstream fs(path, std::ios::binary);
+        if (!fs)
+        {
+            throw Exception::InvalidImageException("Failed to open " + path + ".");
+        }
+
+        unsigned char header[18];
+        if (!fs.read(reinterpret_cast<char *>(header), 18))
+        {
+            throw Exception::InvalidImageException("Unexpected end of file.");
+        }
+        const int id_length = header[0];
+        const int color_map_type = header[1];
+        const int image_type = header[2];
+        const std::size_t width = std::size_t(header[12]) | std::size_t(header[13]) << 8;
+        const std::size_t height = std::size_t(header[14]) | std::size_t(header[15]) << 8;
+        const int depth = header[16];
+        const bool top_to_bottom = (header[17] & 0x20) != 0;
+        const bool right_to_left = (header[17] & 0x10) != 0;
+
+        // 2, 3: true color and grayscale. 10, 11: their run length encoded forms.
+        const bool rle = image_type == 10 || image_type == 11;
+        const bool gray = image_type == 3 || image_type == 11;
+        if (color_map_type != 0 || !(image_type == 2 || image_type == 3 || rle))
+        {
+            throw Exception::InvalidImageException("Only true color and grayscale images are supported.");
+        }
+        if ((gray && depth != 8) || (!gray && depth != 24 && depth != 32) || width == 0 || height == 0)
+        {
+            throw Exception::InvalidImageException("Unsupported pixel depth or resolution.");
+        }
+        fs.ignore(id_length);
+
+        const std::size_t bytes = std::size_t(depth / 8);
+        std::vector<unsigned char> pixels(width * height * bytes);
+        if (rle)
+        {
+            std::size_t i = 0;
+            unsigned char pixel[4];
+            while (i < width * height)
+            {
+                const int packet = fs.get();
+                if (packet == EOF)
+                {
+                    break;
+                }
+                const std::size_t count = std::min(std::size_t(packet & 0x7f) + 1, width * height - i);
+                if (packet & 0x80)
+                {
+                    fs.read(reinterpret_cast<char *>(pixel), std::streamsize(bytes));
+                    for (std::size_t k = 0; k < count; ++k, ++i)
+                    {
+                        std::copy(pixel, pixel + bytes, &pixels[i * bytes]);
+                    }
+                }
+                else
+                {
+                    fs.read(reinterpret_cast<char *>(&pixels[i * bytes]), std::streamsize(count * bytes));
+                    i += count;
+                }
+            }
+        }
+        else
+        {
+            fs.read(reinterpret_cast<char *>(pixels.data()), std::streamsize(pixels.size()));
+        }
+        if (!fs)
+        {
+            throw Exception::InvalidImageException("Unexpected end of file.");
+        }
+
+        // Pixels are stored in BGR(A) order, alpha is dropped.
+        std::vector<Vector3f> texels(width * height);
+        for (std::size_t y = 0; y < height; ++y)
+        {
+            const std::size_t row = top_to_bottom ? y : height - 1 - y;
+            for (std::size_t x = 0; x < width; ++x)
+            {
+                const std::size_t column = right_to_left ? width - 1 - x : x;
+                const unsigned char *p = &pixels[(y * width + x) * bytes];
+                const unsigned char b = p[0], g = gray ? p[0] : p[1], r = gray ? p[0] : p[2];
+                texels[row * width + column] = srgb ? Vector3f(SRGBToLinear(r), SRGBToLinear(g), SRGBToLinear(b))
+                                                    : Vector3f(float(r), float(g), float(b)) / 255.0f;
+            }
+        }
+        return new ImageTexture(texels, SizeN(width, height), cache);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include <RenderToy/lightbvh.h>
+#include <RenderToy/object.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace RenderToy
+{
+    // cos(max(0, a - b)) from sines and cosines.
+    static const float CosSubClamped(const float sin_a, const float cos_a, const float sin_b, const float cos_b)
+    {
+        if (cos_a > cos_b)
+        {
+            return 1.0f;
+        }
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    // sin(max(0, a - b)) from sines and cosines.
+    static const float SinSubClamped(const float sin_a, const float cos_a, const float sin_b, const float cos_b)
+    {
+        if (cos_a > cos_b)
+        {
+            return 0.0f;
+        }
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static const float SafeSin(const float cos)
+    {
+        return std::sqrt(std::max(0.0f, 1.0f - cos * cos));
+    }
+
+    // Rodrigues' rotation of v around the normalized axis k.
+    static const Vector3f Rotate(const Vector3f &v, const Vector3f &k, const float theta)
+    {
+        const float c = std::cos(theta);
+        const float s = std::sin(theta);
+        return v * c + k.Cross(v) * s + k * (k.Dot(v) * (1.0f - c));
+    }
+
+    LightBounds::LightBounds(const BoundingBox &bbox_, const Vector3f &axis_, const float phi_, const float cos_theta_o_, const float cos_theta_e_, const bool two_sided_)
+        : bbox(bbox_), axis(axis_), cos_theta_o(cos_theta_o_), cos_theta_e(cos_theta_e_), phi(phi_), two_sided(two_sided_)
+    {
+    }
+
+    const float LightBounds::Importance(const Vector3f &position, const Vector3f &normal) const
+    {
+        const Vector3f centroid = bbox.Centroid();
+        const Vector3f diagonal = bbox.vmax - bbox.vmin;
+        const float distance2 = std::max((position - centroid).Length2(), diagonal.Length() * 0.5f);
+
+        const Vector3f wi = (position - centroid).Normalized_s();
+        float cos_theta_w = axis.Dot(wi);
+        if (two_sided)
+        {
+            cos_theta_w = std::abs(cos_theta_w);
+        }
+        const float sin_theta_w = SafeSin(cos_theta_w);
+
+        // Cone of directions subtended by the bounding sphere of bbox.
+        float cos_theta_b = -1.0f;
+        const float radius2 = 0.25f * diagonal.Length2();
+        const float center_distance2 = (position - centroid).Length2();
+        if (center_distance2 > radius2)
+        {
+            cos_theta_b = std::sqrt(std::max(0.0f, 1.0f - radius2 / center_distance2));
+        }
+        const float sin_theta_b = SafeSin(cos_theta_b);
+
+        const float sin_theta_o = SafeSin(cos_theta_o);
+        const float cos_theta_x = CosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        const float sin_theta_x = SinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        const float cos_theta_p = CosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= cos_theta_e)
+        {
+            return 0.0f;
+        }
+
+        float importance = phi * cos_theta_p / distance2;
+
+        if (!normal.IsZero())
+        {
+            const float cos_theta_i = std::abs(wi.Dot(normal));
+            const float sin_theta_i = SafeSin(cos_theta_i);
+            importance *= CosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+
+        return std::max(importance, 0.0f);
+    }
+
+    const LightBounds LightBounds::Union(const LightBounds &a, const LightBounds &b)
+    {
+        if (a.phi == 0.0f)
+        {
+            return b;
+        }
+        if (b.phi == 0.0f)
+        {
+            return a;
+        }
+
+        LightBounds ret = a;
+        ret.bbox.ExtendBy(b.bbox);
+        ret.phi = a.phi + b.phi;
+        ret.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+        ret.two_sided = a.two_sided || b.two_sided;
+
+        // Merge normal cones.
+        const float theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0f, 1.0f));
+        const float theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0f, 1.0f));
+        const float theta_d = std::acos(std::clamp(a.axis.Dot(b.axis), -1.0f, 1.0f));
+        if (std::min(theta_d + theta_b, kPi<float>) <= theta_a)
+        {
+            return ret;
+        }
+        if (std::min(theta_d + theta_a, kPi<float>) <= theta_b)
+        {
+            ret.axis = b.axis;
+            ret.cos_theta_o = b.cos_theta_o;
+            return ret;
+        }
+
+        const float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+        const Vector3f rotation_axis = a.axis.Cross(b.axis);
+        if (theta_o >= kPi<float> || rotation_axis.IsZero())
+        {
+            ret.cos_theta_o = -1.0f;
+            return ret;
+        }
+        ret.axis = Rotate(a.axis, rotation_axis.Normalized(), theta_o - theta_a).Normalized();
+        ret.cos_theta_o = std::cos(theta_o);
+        return ret;
+    }
+
+    void LightBVH::Build(const std::vector<const Triangle *> &emitters, const std::vector<float> &power)
+    {
+        nodes.clear();
+        bit_trails.assign(emitters.size(), 0);
+        if (emitters.empty())
+        {
+            return;
+        }
+
+        std::vector<LightBounds> leaf_bounds;
+        leaf_bounds.reserve(emitters.size());
+        for (std::size_t i = 0; i < emitters.size(); ++i)
+        {
+            // Emissive triangles radiate from both faces.
+            leaf_bounds.emplace_back(emitters[i]->BBox(), emitters[i]->GeometricalNormalC(), power[i], 1.0f, 0.0f, true);
+        }
+
+        std::vector<std::size_t> order(emitters.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        nodes.reserve(2 * emitters.size() - 1);
+        Build(order, 0, order.size(), leaf_bounds, 0, 0);
+    }
+
+    std::size_t LightBVH::Build(std::vector<std::size_t> &order, std::size_t begin, std::size_t end, const std::vector<LightBounds> &leaf_bounds, uint64_t bit_trail, int depth)
+    {
+        const std::size_t node_index = nodes.size();
+        nodes.push_back(Node());
+
+        if (end - begin == 1 || depth == 63)
+        {
+            // Depth is bounded by the bit trail; 2^63 emitters are not expected.
+            nodes[node_index].bounds = leaf_bounds[order[begin]];
+            nodes[node_index].index = order[begin];
+            nodes[node_index].is_leaf = true;
+            bit_trails[order[begin]] = bit_trail;
+            return node_index;
+        }
+
+        // Median split along the longest extent of centroids.
+        BoundingBox centroid_bbox(leaf_bounds[order[begin]].bbox.Centroid(), leaf_bounds[order[begin]].bbox.Centroid());
+        for (std::size_t i = begin + 1; i < end; ++i)
+        {
+            const Vector3f c = leaf_bounds[order[i]].bbox.Centroid();
+            centroid_bbox.ExtendBy(BoundingBox(c, c));
+        }
+        const Vector3f extent = centroid_bbox.vmax - centroid_bbox.vmin;
+        int axis = 0;
+        if (extent.y() > extent[axis])
+        {
+            axis = 1;
+        }
+        if (extent.z() > extent[axis])
+        {
+            axis = 2;
+        }
+
+        const std::size_t mid = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&leaf_bounds, axis](const std::size_t a, const std::size_t b) -> bool
+                         { return leaf_bounds[a].bbox.Centroid()[axis] < leaf_bounds[b].bbox.Centroid()[axis]; });
+
+        const std::size_t first = Build(order, begin, mid, leaf_bounds, bit_trail, depth + 1);
+        const std::size_t second = Build(order, mid, end, leaf_bounds, bit_trail | (uint64_t(1) << depth), depth + 1);
+
+        nodes[node_index].bounds = LightBounds::Union(nodes[first].bounds, nodes[second].bounds);
+        nodes[node_index].index = second;
+        nodes[node_index].is_leaf = false;
+        return node_index;
+    }
+
+    template <typename Choose>
+    const float LightBVH::Descend(const Vector3f &position, const Vector3f &normal, Choose &&choose, std::size_t &leaf_o) const
+    {
+        float pmf = 1.0f;
+        std::size_t node_index = 0;
+        while (!nodes[node_index].is_leaf)
+        {
+            const std::size_t first = node_index + 1;
+            const std::size_t second = nodes[node_index].index;
+            const float importance_first = nodes[first].bounds.Importance(position, normal);
+            const float importance_second = nodes[second].bounds.Importance(position, normal);
+            if (importance_first == 0.0f && importance_second == 0.0f)
+            {
+                return 0.0f;
+            }
+
+            const float p_first = importance_first / (importance_first + importance_second);
+            if (choose(p_first))
+            {
+                pmf *= 1.0f - p_first;
+                node_index = second;
+            }
+            else
+            {
+                pmf *= p_first;
+                node_index = first;
+            }
+        }
+
+        // A single emitter is a leaf at the root, reached without weighing it against another.
+        leaf_o = node_index;
+        if (pmf == 0.0f || nodes[node_index].bounds.Importance(position, normal) == 0.0f)
+        {
+            return 0.0f;
+        }
+        return pmf;
+    }
+
+    const bool LightBVH::Sample(const Vector3f &position, const Vector3f &normal, float u, std::size_t &index_o, float &pmf_o) const
+    {
+        pmf_o = 0.0f;
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        std::size_t leaf;
+        const float pmf = Descend(position, normal, [&u](const float p_first) -> bool
+        {
+            if (u < p_first)
+            {
+                u = std::min(u / p_first, 0.99999994f);
+                return false;
+            }
+            u = std::min((u - p_first) / (1.0f - p_first), 0.99999994f);
+            return true;
+        }, leaf);
+        if (pmf == 0.0f)
+        {
+            return false;
+        }
+        index_o = nodes[leaf].index;
+        pmf_o = pmf;
+        return true;
+    }
+
+    const float LightBVH::PMF(const Vector3f &position, const Vector3f &normal, const std::size_t index) const
+    {
+        if (nodes.empty() || index >= bit_trails.size())
+        {
+            return 0.0f;
+        }
+
+        uint64_t bit_trail = bit_trails[index];
+        std::size_t leaf;
+        return Descend(position, normal, [&bit_trail](const float) -> bool
+        {
+            const bool second = (bit_trail & 1) != 0;
+            bit_trail >>= 1;
+            return second;
+        }, leaf);
+    }
+
+    const bool LightBVH::Empty() const
+    {
+        return nodes.empty();
+    }
+}
@@ -32,14 +32,271 @@ namespace RenderToy
         }
     }
 
-    const float PrincipledBSDF::FresnelMix(const float eta, const float VDotH) const
+    EmissiveBSDF::EmissiveBSDF(const Vector3f &emission_, const float strength_)
+        : PrincipledBSDF(Vector3f::O, emission_ * strength_, 0.5f, 0.0f, 0.0f, 1.0f)
     {
-        float metallic_fresnel = SchlickFresnel(VDotH);
-        float dielectric_fresnel = DielectricFresnel(VDotH, eta);
-        return Lerp(dielectric_fresnel, metallic_fresnel, metallic);
     }
 
-    const Vector3f PrincipledBSDF::EvalDiffuse(const Vector3f Csheen, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
+    DiffuseBSDF::DiffuseBSDF(const Vector3f &base_color_, const float roughness_)
+        : PrincipledBSDF(base_color_, Vector3f::O, roughness_)
+    {
+    }
+
+    GlassBSDF::GlassBSDF(const Vector3f &base_color_, const float roughness_, const float ior_)
+        : PrincipledBSDF(base_color_, Vector3f::O, roughness_, 0.0f, 1.0f, ior_)
+    {
+    }
+
+    GlossyBSDF::GlossyBSDF(const Vector3f &base_color_, const float roughness_)
+        : PrincipledBSDF(base_color_, Vector3f::O, roughness_, 1.0f)
+    {
+    }
+
+    const std::size_t BSDFBatch::Push(const RayState &state_, const Vector3f &V, const Vector3f &N, const Vector3f &L)
+    {
+        const std::size_t lane = count++;
+        state[lane] = &state_;
+        v[lane] = V;
+        n[lane] = N;
+        l[lane] = L;
+        return lane;
+    }
+
+    const bool BSDFBatch::Full() const
+    {
+        return count == kLanes;
+    }
+
+    // Lobes of each kind of material. Lobes left out have zero weight for every material of that kind.
+    static constexpr unsigned kDiffuseLobe = 1;
+    static constexpr unsigned kSpecReflectionLobe = 2;
+    static constexpr unsigned kSpecRefractionLobe = 4;
+    static constexpr unsigned kClearcoatLobe = 8;
+
+    static constexpr unsigned Lobes(const PrincipledBSDF::Kind kind)
+    {
+        switch (kind)
+        {
+        case PrincipledBSDF::Kind::kDiffuse:
+            return kDiffuseLobe | kSpecReflectionLobe;
+        case PrincipledBSDF::Kind::kConductor:
+            return kSpecReflectionLobe;
+        case PrincipledBSDF::Kind::kDielectric:
+            return kSpecReflectionLobe | kSpecRefractionLobe;
+        case PrincipledBSDF::Kind::kEmissive:
+            return 0;
+        default:
+            return kDiffuseLobe | kSpecReflectionLobe | kSpecRefractionLobe | kClearcoatLobe;
+        }
+    }
+
+    void PrincipledBSDF::Prepare()
+    {
+        front = Compile(ior);
+        back = Compile(1.0f / ior);
+        for (std::size_t i = 0; i < interface_count; ++i)
+        {
+            // The same divisions the renderer assigns RayState::eta by.
+            interfaces[2 * i] = Compile(ior / outer_iors[i]);
+            interfaces[2 * i + 1] = Compile(outer_iors[i] / ior);
+        }
+        kind = Classify();
+        absorption = extinction == Vector3f::White ? Vector3f::O : -Vector3f::Log(extinction) / at_distance;
+        prepared = true;
+    }
+
+    void PrincipledBSDF::Prepare(const std::vector<float> &media_iors)
+    {
+        interface_count = 0;
+        for (const float outer_ior : media_iors)
+        {
+            if (outer_ior != 1.0f && interface_count < kMaxInterfaces)
+            {
+                outer_iors[interface_count++] = outer_ior;
+            }
+        }
+        Prepare();
+    }
+
+    const PrincipledBSDF::Kind PrincipledBSDF::GetKind() const
+    {
+        return kind;
+    }
+
+    const Medium PrincipledBSDF::GetMedium(const uint16_t material_id) const
+    {
+        if (prepared)
+        {
+            return {material_id, ior, absorption};
+        }
+        return {material_id, ior, extinction == Vector3f::White ? Vector3f::O : -Vector3f::Log(extinction) / at_distance};
+    }
+
+    const bool PrincipledBSDF::Textured() const
+    {
+        return base_color_texture != nullptr || roughness_texture != nullptr || metallic_texture != nullptr;
+    }
+
+    const bool PrincipledBSDF::Perturbed() const
+    {
+        return normal_texture != nullptr || bump_texture != nullptr;
+    }
+
+    void PrincipledBSDF::ApplyTextures(const PrincipledBSDF &shared, const Vector2f &uv, const float footprint, const float eta, uint64_t &misses)
+    {
+        base_color = shared.base_color_texture != nullptr ? shared.base_color_texture->Sample(uv, shared.base_color_texture->Level(footprint), misses) : shared.base_color;
+        emission = shared.emission;
+        roughness = shared.roughness_texture != nullptr ? std::clamp(shared.roughness_texture->Sample(uv, shared.roughness_texture->Level(footprint), misses).x(), 0.0f, 1.0f) : shared.roughness;
+        metallic = shared.metallic_texture != nullptr ? std::clamp(shared.metallic_texture->Sample(uv, shared.metallic_texture->Level(footprint), misses).x(), 0.0f, 1.0f) : shared.metallic;
+        anisotropic = shared.anisotropic;
+        subsurface = shared.subsurface;
+        specular_tint = shared.specular_tint;
+        sheen = shared.sheen;
+        sheen_tint = shared.sheen_tint;
+        clearcoat = shared.clearcoat;
+        clearcoat_roughness = shared.clearcoat_roughness;
+        spec_trans = shared.spec_trans;
+        ior = shared.ior;
+        at_distance = shared.at_distance;
+        extinction = shared.extinction;
+        base_color_texture = shared.base_color_texture;
+        roughness_texture = shared.roughness_texture;
+        metallic_texture = shared.metallic_texture;
+        normal_texture = shared.normal_texture;
+        bump_texture = shared.bump_texture;
+        bump_scale = shared.bump_scale;
+
+        kind = Classify();
+        absorption = shared.prepared ? shared.absorption : (extinction == Vector3f::White ? Vector3f::O : -Vector3f::Log(extinction) / at_distance);
+        interface_count = 0;
+        prepared = true;
+        // Roughness is read by the lobes, the constants only depend on the base color and metallic.
+        if (shared.base_color_texture == nullptr && shared.metallic_texture == nullptr)
+        {
+            base = &shared;
+            return;
+        }
+        base = nullptr;
+        // Keep the Fresnel tables of shared, looking them up again takes a lock.
+        front = shared.GetConstants(eta, front);
+        CompileTerms(front);
+        back = front;
+    }
+
+    const PrincipledBSDF::Kind PrincipledBSDF::Classify() const
+    {
+        if (metallic == 1.0f)
+        {
+            return Kind::kConductor;
+        }
+        if (metallic != 0.0f || clearcoat != 0.0f)
+        {
+            return Kind::kPrincipled;
+        }
+        // Index matched, so the Fresnel term of the specular reflection vanishes.
+        if (base_color == Vector3f::O && ior == 1.0f)
+        {
+            return Kind::kEmissive;
+        }
+        if (spec_trans == 1.0f)
+        {
+            return Kind::kDielectric;
+        }
+        if (spec_trans == 0.0f && sheen == 0.0f && subsurface == 0.0f)
+        {
+            return Kind::kDiffuse;
+        }
+        return Kind::kPrincipled;
+    }
+
+    const PrincipledBSDF::Constants PrincipledBSDF::Compile(const float eta) const
+    {
+        Constants c;
+        c.eta = eta;
+        CompileTerms(c);
+#ifdef RENDERTOY_FRESNEL_TABLES
+        static const FresnelTable &clearcoat_fresnel = FresnelTable::Get(1.0f / 1.5f);
+        c.fresnel = &FresnelTable::Get(eta);
+        c.clearcoat_fresnel = &clearcoat_fresnel;
+#endif
+        return c;
+    }
+
+    void PrincipledBSDF::CompileTerms(Constants &c) const
+    {
+        const float eta = c.eta;
+        const float lum = Convert::Luma(base_color);
+        const Vector3f ctint = lum > 0.0f ? base_color / lum : Vector3f(1.0f);
+        const float F0 = (1.0f - eta) / (1.0f + eta);
+        c.spec_color = Lerp(F0 * F0 * Lerp(Vector3f::White, ctint, Vector3f(specular_tint)), Vector3f(base_color), Vector3f(metallic));
+        c.spec_luma = Convert::Luma(c.spec_color);
+        c.sheen_color = sheen * Lerp(Vector3f::White, Vector3f(ctint), Vector3f(sheen_tint));
+
+        c.diffuse_color = (1.0f / kPi<float>) * base_color;
+        c.diffuse_scale = (1.0f - metallic) * (1.0f - spec_trans);
+        c.refraction_color = Vector3f::Pow(base_color, Vector3f(0.5)) * ((1.0f - metallic) * spec_trans);
+
+        c.diffuse_weight = lum * c.diffuse_scale;
+        c.spec_refract_weight = (1.0f - metallic) * spec_trans * lum;
+        c.clearcoat_weight = clearcoat * (1.0f - metallic);
+        c.clearcoat_log = std::log(clearcoat_roughness * clearcoat_roughness);
+    }
+
+    const PrincipledBSDF::Constants &PrincipledBSDF::GetConstants(const float eta, Constants &scratch) const
+    {
+        if (base != nullptr)
+        {
+            return base->GetConstants(eta, scratch);
+        }
+        if (prepared)
+        {
+            if (eta == front.eta)
+            {
+                return front;
+            }
+            if (eta == back.eta)
+            {
+                return back;
+            }
+            for (std::size_t i = 0; i < 2 * interface_count; ++i)
+            {
+                if (eta == interfaces[i].eta)
+                {
+                    return interfaces[i];
+                }
+            }
+        }
+        // Unprepared, shaded at another eta than the textured one or more media than kMaxInterfaces. Compiling takes a lock with RENDERTOY_FRESNEL_TABLES.
+        scratch = Compile(eta);
+        return scratch;
+    }
+
+    const float PrincipledBSDF::Dielectric(const Constants &c, const float cos_theta_i)
+    {
+        return c.fresnel != nullptr ? c.fresnel->Eval(cos_theta_i) : DielectricFresnel(cos_theta_i, c.eta);
+    }
+
+    template <PrincipledBSDF::Kind K>
+    const float PrincipledBSDF::FresnelMix(const Constants &c, const float VDotH) const
+    {
+        if constexpr (K == Kind::kConductor)
+        {
+            return SchlickFresnel(VDotH);
+        }
+        else if constexpr (K == Kind::kPrincipled)
+        {
+            float metallic_fresnel = SchlickFresnel(VDotH);
+            float dielectric_fresnel = Dielectric(c, VDotH);
+            return Lerp(dielectric_fresnel, metallic_fresnel, metallic);
+        }
+        else
+        {
+            return Dielectric(c, VDotH);
+        }
+    }
+
+    template <PrincipledBSDF::Kind K>
+    const Vector3f PrincipledBSDF::EvalDiffuse(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
     {
         pdf = 0.0f;
         if (L.z() <= 0.0f)
@@ -48,30 +305,39 @@ namespace RenderToy
         // Diffuse
         float FL = SchlickFresnel(L.z());
         float FV = SchlickFresnel(V.z());
-        float FH = SchlickFresnel(Vector3f::Dot(L, H));
         float Fd90 = 0.5f + 2.0f * Vector3f::Dot(L, H) * Vector3f::Dot(L, H) * roughness;
         float Fd = Lerp(1.0f, Fd90, FL) * Lerp(1.0f, Fd90, FV);
 
-        // Fake Subsurface TODO: Replace with volumetric scattering
-        float Fss90 = Vector3f::Dot(L, H) * Vector3f::Dot(L, H) * roughness;
-        float Fss = Lerp(1.0f, Fss90, FL) * Lerp(1.0f, Fss90, FV);
-        float ss = 1.25f * (Fss * (1.0f / (L.z() + V.z()) - 0.5f) + 0.5f);
+        pdf = L.z() * (1.0f / kPi<float>);
+        if constexpr (K != Kind::kPrincipled)
+        {
+            // No subsurface and no sheen.
+            return Fd * c.diffuse_color * c.diffuse_scale;
+        }
+        else
+        {
+            // Fake Subsurface TODO: Replace with volumetric scattering
+            float Fss90 = Vector3f::Dot(L, H) * Vector3f::Dot(L, H) * roughness;
+            float Fss = Lerp(1.0f, Fss90, FL) * Lerp(1.0f, Fss90, FV);
+            float ss = 1.25f * (Fss * (1.0f / (L.z() + V.z()) - 0.5f) + 0.5f);
 
-        // Sheen
-        Vector3f Fsheen = FH * sheen * Csheen;
+            // Sheen
+            float FH = SchlickFresnel(Vector3f::Dot(L, H));
+            Vector3f Fsheen = FH * c.sheen_color;
 
-        pdf = L.z() * (1.0f / kPi<float>);
-        return ((1.0f / kPi<float>) * Lerp(Fd, ss, subsurface) * base_color + Fsheen) * (1.0f - metallic) * (1.0f - spec_trans);
+            return (Lerp(Fd, ss, subsurface) * c.diffuse_color + Fsheen) * c.diffuse_scale;
+        }
     }
 
-    const Vector3f PrincipledBSDF::EvalSpecReflection(const float eta, const Vector3f specCol, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
+    template <PrincipledBSDF::Kind K>
+    const Vector3f PrincipledBSDF::EvalSpecReflection(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
     {
         pdf = 0.0f;
         if (L.z() <= 0.0f)
             return Vector3f(0.0f);
 
-        float FM = FresnelMix(eta, Vector3f::Dot(L, H));
-        Vector3f F = Lerp(specCol, Vector3f(1.0f), Vector3f(FM));
+        float FM = FresnelMix<K>(c, Vector3f::Dot(L, H));
+        Vector3f F = Lerp(c.spec_color, Vector3f(1.0f), Vector3f(FM));
         float D = GTR2(H.z(), roughness);
         float G1 = SmithG(std::abs(V.z()), roughness);
         float G2 = G1 * SmithG(std::abs(L.z()), roughness);
@@ -81,13 +347,14 @@ namespace RenderToy
         return F * D * G2 / (4.0f * L.z() * V.z());
     }
 
-    const Vector3f PrincipledBSDF::EvalSpecRefraction(const float eta, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
+    const Vector3f PrincipledBSDF::EvalSpecRefraction(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
     {
+        const float eta = c.eta;
         pdf = 0.0f;
         if (L.z() >= 0.0f)
             return Vector3f::O;
 
-        float F = DielectricFresnel(std::abs(Vector3f::Dot(V, H)), eta);
+        float F = Dielectric(c, std::abs(Vector3f::Dot(V, H)));
         float D = GTR2(H.z(), roughness);
         float denom = Vector3f::Dot(L, H) + Vector3f::Dot(V, H) * eta;
         denom *= denom;
@@ -97,19 +364,20 @@ namespace RenderToy
 
         pdf = G1 * std::max(0.0f, Vector3f::Dot(V, H)) * D * jacobian / V.z();
 
-        Vector3f spec_color = Vector3f::Pow(base_color, Vector3f(0.5));
-        return spec_color * (1.0 - metallic) * spec_trans * (1.0 - F) * D * G2 * std::abs(Vector3f::Dot(V, H)) * std::abs(Vector3f::Dot(L, H)) * eta * eta / (denom * std::abs(L.z()) * std::abs(V.z()));
+        return c.refraction_color * (1.0 - F) * D * G2 * std::abs(Vector3f::Dot(V, H)) * std::abs(Vector3f::Dot(L, H)) * eta * eta / (denom * std::abs(L.z()) * std::abs(V.z()));
     }
 
-    const Vector3f PrincipledBSDF::EvalClearcoat(const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
+    const Vector3f PrincipledBSDF::EvalClearcoat(const Constants &c, const Vector3f V, const Vector3f L, const Vector3f H, float &pdf) const
     {
         pdf = 0.0f;
         if (L.z() <= 0.0f)
             return Vector3f::O;
 
-        float FH = DielectricFresnel(Vector3f::Dot(V, H), 1.0f / 1.5f);
+        float FH = c.clearcoat_fresnel != nullptr ? c.clearcoat_fresnel->Eval(Vector3f::Dot(V, H)) : DielectricFresnel(Vector3f::Dot(V, H), 1.0f / 1.5f);
         float F = Lerp(0.04f, 1.0f, FH);
-        float D = GTR1(H.z(), clearcoat_roughness);
+        // GTR1 with the log taken once in Compile().
+        float a2 = clearcoat_roughness * clearcoat_roughness;
+        float D = clearcoat_roughness >= 1.0f ? 1.0f / kPi<float> : (a2 - 1.0f) / (kPi<float> * c.clearcoat_log * (1.0f + (a2 - 1.0f) * H.z() * H.z()));
         float G = SmithG(L.z(), 0.25f) * SmithG(V.z(), 0.25f);
         float jacobian = 1.0f / (4.0f * Vector3f::Dot(V, H));
 
@@ -117,21 +385,15 @@ namespace RenderToy
         return Vector3f(0.25f) * clearcoat * F * D * G / (4.0f * L.z() * V.z());
     }
 
-    void PrincipledBSDF::GetSpecColor(const float eta, Vector3f &spec_col, Vector3f &sheen_col) const
-    {
-        float lum = Convert::Luma(base_color);
-        Vector3f ctint = lum > 0.0f ? base_color / lum : Vector3f(1.0f);
-        float F0 = (1.0f - eta) / (1.0f + eta);
-        spec_col = Lerp(F0 * F0 * Lerp(Vector3f::White, ctint, Vector3f(specular_tint)), Vector3f(base_color), Vector3f(metallic));
-        sheen_col = Lerp(Vector3f::White, Vector3f(ctint), Vector3f(sheen_tint));
-    }
-
-    void PrincipledBSDF::GetLobeProbabilities(const float eta, const Vector3f spec_col, const float approx_fresnel, float &diffuse_weight, float &spec_reflect_weight, float &spec_refract_weight, float &clearcoat_weight) const
+    template <PrincipledBSDF::Kind K>
+    void PrincipledBSDF::GetLobeProbabilities(const Constants &c, const float approx_fresnel, float &diffuse_weight, float &spec_reflect_weight, float &spec_refract_weight, float &clearcoat_weight) const
     {
-        diffuse_weight = Convert::Luma(base_color) * (1.0f - metallic) * (1.0f - spec_trans);
-        spec_reflect_weight = Convert::Luma(Lerp(spec_col, Vector3f::White, Vector3f(approx_fresnel)));
-        spec_refract_weight = (1.0f - approx_fresnel) * (1.0f - metallic) * spec_trans * Convert::Luma(base_color);
-        clearcoat_weight = clearcoat * (1.0f - metallic);
+        constexpr unsigned lobes = Lobes(K);
+        diffuse_weight = (lobes & kDiffuseLobe) ? c.diffuse_weight : 0.0f;
+        // Luma is linear and the luma of white is one.
+        spec_reflect_weight = Lerp(c.spec_luma, 1.0f, approx_fresnel);
+        spec_refract_weight = (lobes & kSpecRefractionLobe) ? (1.0f - approx_fresnel) * c.spec_refract_weight : 0.0f;
+        clearcoat_weight = (lobes & kClearcoatLobe) ? c.clearcoat_weight : 0.0f;
         float total_weight = diffuse_weight + spec_reflect_weight + spec_refract_weight + clearcoat_weight;
 
         diffuse_weight /= total_weight;
@@ -142,13 +404,93 @@ namespace RenderToy
 
     const Vector3f PrincipledBSDF::Eval(const RayState state, Vector3f V, Vector3f N, Vector3f L, float &bsdf_pdf) const
     {
+        Constants scratch;
+        switch (kind)
+        {
+        case Kind::kDiffuse:
+            return EvalKernel<Kind::kDiffuse>(GetConstants(state.eta, scratch), state, V, N, L, bsdf_pdf);
+        case Kind::kConductor:
+            return EvalKernel<Kind::kConductor>(GetConstants(state.eta, scratch), state, V, N, L, bsdf_pdf);
+        case Kind::kDielectric:
+            return EvalKernel<Kind::kDielectric>(GetConstants(state.eta, scratch), state, V, N, L, bsdf_pdf);
+        case Kind::kEmissive:
+            bsdf_pdf = 0.0f;
+            return Vector3f::O;
+        default:
+            return EvalKernel<Kind::kPrincipled>(GetConstants(state.eta, scratch), state, V, N, L, bsdf_pdf);
+        }
+    }
+
+    const float PrincipledBSDF::PDF(const RayState state, Vector3f V, Vector3f N, Vector3f L) const
+    {
+        Constants scratch;
+        switch (kind)
+        {
+        case Kind::kDiffuse:
+            return PDFKernel<Kind::kDiffuse>(GetConstants(state.eta, scratch), state, V, N, L);
+        case Kind::kConductor:
+            return PDFKernel<Kind::kConductor>(GetConstants(state.eta, scratch), state, V, N, L);
+        case Kind::kDielectric:
+            return PDFKernel<Kind::kDielectric>(GetConstants(state.eta, scratch), state, V, N, L);
+        case Kind::kEmissive:
+            return 0.0f;
+        default:
+            return PDFKernel<Kind::kPrincipled>(GetConstants(state.eta, scratch), state, V, N, L);
+        }
+    }
+
+    const bool PrincipledBSDF::Sample(const Vector3f &in_dir, Vector3f &out_dir, Vector3f &color_o, float &pdf, RayState &state) const
+    {
+        switch (kind)
+        {
+        case Kind::kDiffuse:
+            return SampleKernel<Kind::kDiffuse>(in_dir, out_dir, color_o, pdf, state);
+        case Kind::kConductor:
+            return SampleKernel<Kind::kConductor>(in_dir, out_dir, color_o, pdf, state);
+        case Kind::kDielectric:
+            return SampleKernel<Kind::kDielectric>(in_dir, out_dir, color_o, pdf, state);
+        case Kind::kEmissive:
+            pdf = 0.0f;
+            return false;
+        default:
+            return SampleKernel<Kind::kPrincipled>(in_dir, out_dir, color_o, pdf, state);
+        }
+    }
+
+    void PrincipledBSDF::EvalBatch(BSDFBatch &batch) const
+    {
+        switch (kind)
+        {
+        case Kind::kDiffuse:
+            EvalBatchKernel<Kind::kDiffuse>(batch);
+            break;
+        case Kind::kConductor:
+            EvalBatchKernel<Kind::kConductor>(batch);
+            break;
+        case Kind::kDielectric:
+            EvalBatchKernel<Kind::kDielectric>(batch);
+            break;
+        case Kind::kEmissive:
+            std::fill_n(batch.color.begin(), batch.count, Vector3f::O);
+            std::fill_n(batch.pdf.begin(), batch.count, 0.0f);
+            break;
+        default:
+            EvalBatchKernel<Kind::kPrincipled>(batch);
+            break;
+        }
+    }
+
+    template <PrincipledBSDF::Kind K>
+    const Vector3f PrincipledBSDF::EvalKernel(const Constants &c, const RayState &state, Vector3f V, Vector3f N, Vector3f L, float &bsdf_pdf) const
+    {
+        constexpr unsigned lobes = Lobes(K);
         float eta = state.eta;
 
         bsdf_pdf = 0.0;
         Vector3f f = Vector3f::O;
 
         Vector3f T, B;
-        Onb(N, T, B);
+        state.Frame(N, T, B);
         V = ToLocal(T, B, N, V); // NDotL = L.z(); N_dot_V = V.z(); N_dot_H = H.z()
         L = ToLocal(T, B, N, L);
 
@@ -161,50 +503,133 @@ namespace RenderToy
         if (H.z() < 0.0)
             H = -H;
 
-        // Specular and sheen color
-        Vector3f spec_color, sheen_color;
-        GetSpecColor(eta, spec_color, sheen_color);
-
         // Lobe weights
         float diffuse_weight, spec_reflect_weight, spec_refract_weight, clearcoat_weight;
-        float fresnel = FresnelMix(eta, Vector3f::Dot(V, H));
-        GetLobeProbabilities(eta, spec_color, fresnel, diffuse_weight, spec_reflect_weight, spec_refract_weight, clearcoat_weight);
+        float fresnel = FresnelMix<K>(c, Vector3f::Dot(V, H));
+        GetLobeProbabilities<K>(c, fresnel, diffuse_weight, spec_reflect_weight, spec_refract_weight, clearcoat_weight);
 
         float pdf;
 
         // Diffuse
-        if (diffuse_weight > 0.0f && L.z() > 0.0f)
+        if constexpr ((lobes & kDiffuseLobe) != 0)
         {
-            f += EvalDiffuse(sheen_color, V, L, H, pdf);
-            bsdf_pdf += pdf * diffuse_weight;
+            if (diffuse_weight > 0.0f && L.z() > 0.0f)
+            {
+                f += EvalDiffuse<K>(c, V, L, H, pdf);
+                bsdf_pdf += pdf * diffuse_weight;
+            }
         }
 
         // Specular Reflection
         if (spec_reflect_weight > 0.0f && L.z() > 0.0f && V.z() > 0.0f)
         {
-            f += EvalSpecReflection(eta, spec_color, V, L, H, pdf);
+            f += EvalSpecReflection<K>(c, V, L, H, pdf);
             bsdf_pdf += pdf * spec_reflect_weight;
         }
 
         // Specular Refraction
-        if (spec_refract_weight > 0.0f && L.z() < 0.0f)
+        if constexpr ((lobes & kSpecRefractionLobe) != 0)
         {
-            f += EvalSpecRefraction(eta, V, L, H, pdf);
-            bsdf_pdf += pdf * spec_refract_weight;
+            if (spec_refract_weight > 0.0f && L.z() < 0.0f)
+            {
+                f += EvalSpecRefraction(c, V, L, H, pdf);
+                bsdf_pdf += pdf * spec_refract_weight;
+            }
         }
 
         // Clearcoat
-        if (clearcoat_weight > 0.0f && L.z() > 0.0f && V.z() > 0.0f)
+        if constexpr ((lobes & kClearcoatLobe) != 0)
         {
-            f += EvalClearcoat(V, L, H, pdf);
-            bsdf_pdf += pdf * clearcoat_weight;
+            if (clearcoat_weight > 0.0f && L.z() > 0.0f && V.z() > 0.0f)
+            {
+                f += EvalClearcoat(c, V, L, H, pdf);
+                bsdf_pdf += pdf * clearcoat_weight;
+            }
         }
 
         return f * std::abs(L.z());
     }
 
-    const bool PrincipledBSDF::Sample(const Vector3f &in_dir, Vector3f &out_dir, Vector3f &color_o, float &pdf, RayState &state) const
+    template <PrincipledBSDF::Kind K>
+    void PrincipledBSDF::EvalBatchKernel(BSDFBatch &batch) const
+    {
+        // Lanes of a batch mostly share a side of the surface, and with it eta.
+        Constants scratch;
+        const Constants *c = nullptr;
+        for (std::size_t i = 0; i < batch.count; ++i)
+        {
+            const RayState &state = *batch.state[i];
+            if (c == nullptr || state.eta != c->eta)
+            {
+                c = &GetConstants(state.eta, scratch);
+            }
+            batch.color[i] = EvalKernel<K>(*c, state, batch.v[i], batch.n[i], batch.l[i], batch.pdf[i]);
+        }
+    }
+
+    template <PrincipledBSDF::Kind K>
+    const float PrincipledBSDF::PDFKernel(const Constants &c, const RayState &state, Vector3f V, Vector3f N, Vector3f L) const
     {
+        constexpr unsigned lobes = Lobes(K);
+        float eta = state.eta;
+
+        Vector3f T, B;
+        state.Frame(N, T, B);
+        V = ToLocal(T, B, N, V);
+        L = ToLocal(T, B, N, L);
+
+        Vector3f H;
+        if (L.z() > 0.0)
+            H = (L + V).Normalized();
+        else
+            H = (L + V * eta).Normalized();
+
+        if (H.z() < 0.0)
+            H = -H;
+
+        // Sample() picks a lobe before H is known, by the Fresnel term at V.N.
+        float diffuse_weight, spec_reflect_weight, spec_refract_weight, clearcoat_weight;
+        GetLobeProbabilities<K>(c, FresnelMix<K>(c, V.z()), diffuse_weight, spec_reflect_weight, spec_refract_weight, clearcoat_weight);
+
+        float ret = 0.0f;
+        float pdf;
+        if constexpr ((lobes & kDiffuseLobe) != 0)
+        {
+            if (diffuse_weight > 0.0f && L.z() > 0.0f)
+            {
+                // Cosine-weighted, the value of the lobe is not needed.
+                pdf = L.z() * (1.0f / kPi<float>);
+                ret += pdf * diffuse_weight;
+            }
+        }
+        if (spec_reflect_weight > 0.0f && L.z() > 0.0f && V.z() > 0.0f)
+        {
+            EvalSpecReflection<K>(c, V, L, H, pdf);
+            ret += pdf * spec_reflect_weight;
+        }
+        if constexpr ((lobes & kSpecRefractionLobe) != 0)
+        {
+            if (spec_refract_weight > 0.0f && L.z() < 0.0f)
+            {
+                EvalSpecRefraction(c, V, L, H, pdf);
+                ret += pdf * spec_refract_weight;
+            }
+        }
+        if constexpr ((lobes & kClearcoatLobe) != 0)
+        {
+            if (clearcoat_weight > 0.0f && L.z() > 0.0f && V.z() > 0.0f)
+            {
+                EvalClearcoat(c, V, L, H, pdf);
+                ret += pdf * clearcoat_weight;
+            }
+        }
+        return ret;
+    }
+
+    template <PrincipledBSDF::Kind K>
+    const bool PrincipledBSDF::SampleKernel(const Vector3f &in_dir, Vector3f &out_dir, Vector3f &color_o, float &pdf, RayState &state) const
+    {
+        constexpr unsigned lobes = Lobes(K);
         pdf = 0.0f;
         Vector3f f(0.0f);
         auto N = state.ffnormal;
@@ -215,21 +640,19 @@ namespace RenderToy
         float r2 = Random::Float();
 
         Vector3f T, B;
-        Onb(N, T, B);
+        state.Frame(N, T, B);
         V = ToLocal(T, B, N, V); // NDotL = L.z(); N_dot_V = V.z(); N_dot_H = H.z()
 
-        // Specular and sheen color
-        Vector3f specCol, sheenCol;
-
         float eta = state.eta;
-        GetSpecColor(eta, specCol, sheenCol);
+        Constants scratch;
+        const Constants &c = GetConstants(eta, scratch);
 
         // Lobe weights
         float diffuseWt, specReflectWt, specRefractWt, clearcoatWt;
         // TODO: Recheck fresnel. Not sure if correct. VDotN produces fireflies with rough dielectric.
         // VDotH matches Mitsuba and gets rid of all fireflies but H isn't available at this stage
-        float approxFresnel = FresnelMix(eta, V.z());
-        GetLobeProbabilities(eta, specCol, approxFresnel, diffuseWt, specReflectWt, specRefractWt, clearcoatWt);
+        float approxFresnel = FresnelMix<K>(c, V.z());
+        GetLobeProbabilities<K>(c, approxFresnel, diffuseWt, specReflectWt, specRefractWt, clearcoatWt);
 
         // CDF for picking a lobe
         float cdf[4];
@@ -238,17 +661,17 @@ namespace RenderToy
         cdf[2] = cdf[1] + specRefractWt;
         cdf[3] = cdf[2] + clearcoatWt;
 
-        if (r1 < cdf[0]) // Diffuse Reflection Lobe
+        if ((lobes & kDiffuseLobe) != 0 && r1 < cdf[0]) // Diffuse Reflection Lobe
         {
             r1 /= cdf[0];
             out_dir = CosineSampleHemisphere(r1, r2);
 
             Vector3f H = (out_dir + V).Normalized();
 
-            f = EvalDiffuse(sheenCol, V, out_dir, H, pdf);
+            f = EvalDiffuse<K>(c, V, out_dir, H, pdf);
             pdf *= diffuseWt;
         }
-        else if (r1 < cdf[1]) // Specular Reflection Lobe
+        else if ((lobes & (kSpecRefractionLobe | kClearcoatLobe)) == 0 || r1 < cdf[1]) // Specular Reflection Lobe
         {
             r1 = (r1 - cdf[0]) / (cdf[1] - cdf[0]);
             Vector3f H = SampleGGXVNDF(V, roughness, r1, r2);
@@ -258,10 +681,10 @@ namespace RenderToy
 
             out_dir = (Reflect(-V, H)).Normalized();
 
-            f = EvalSpecReflection(eta, specCol, V, out_dir, H, pdf);
+            f = EvalSpecReflection<K>(c, V, out_dir, H, pdf);
             pdf *= specReflectWt;
         }
-        else if (r1 < cdf[2]) // Specular Refraction Lobe
+        else if ((lobes & kClearcoatLobe) == 0 || r1 < cdf[2]) // Specular Refraction Lobe
         {
             r1 = (r1 - cdf[1]) / (cdf[2] - cdf[1]);
             Vector3f H = SampleGGXVNDF(V, roughness, r1, r2);
@@ -271,7 +694,7 @@ namespace RenderToy
 
             out_dir = Refract(-V, H, eta).Normalized();
 
-            f = EvalSpecRefraction(eta, V, out_dir, H, pdf);
+            f = EvalSpecRefraction(c, V, out_dir, H, pdf);
             pdf *= specRefractWt;
         }
         else // Clearcoat Lobe
@@ -284,7 +707,7 @@ namespace RenderToy
 
             out_dir = Reflect(-V, H).Normalized();
 
-            f = EvalClearcoat(V, out_dir, H, pdf);
+            f = EvalClearcoat(c, V, out_dir, H, pdf);
             pdf *= clearcoatWt;
         }
 
@@ -1,19 +1,23 @@
 #include <RenderToy/object.h>
 
+#include <array>
 #include <limits>
+#include <map>
 #include <cmath>
 #include <iostream>
 
 namespace RenderToy
 {
     Geometry::Geometry()
-        : object_to_world(Matrix4x4f::I), world_to_object(Matrix4x4f::I)
+        : object_to_world(Matrix4x4f::I), world_to_object(Matrix4x4f::I), object_to_world_close(Matrix4x4f::I)
     {
     }
 
     void Geometry::SetO2W(const Matrix4x4f &object_to_world_)
     {
         object_to_world = object_to_world_;
+        object_to_world_close = object_to_world_;
+        moving = false;
         Matrix3x3f R = object_to_world.ComplementMinor(3, 3);
         Vector3f C = {object_to_world[0][3], object_to_world[1][3], object_to_world[2][3]};
         R.Transpose();
@@ -29,11 +33,45 @@ namespace RenderToy
         world_to_object[3][3] = 1.0f;
     }
 
+    void Geometry::SetO2W(const Matrix4x4f &object_to_world_, const Matrix4x4f &object_to_world_close_)
+    {
+        Geometry::SetO2W(object_to_world_);
+        object_to_world_close = object_to_world_close_;
+        moving = object_to_world_close_ != object_to_world_;
+    }
+
     const Matrix4x4f &Geometry::GetO2W() const
     {
         return object_to_world;
     }
 
+    const Matrix4x4f &Geometry::GetO2WClose() const
+    {
+        return object_to_world_close;
+    }
+
+    const Matrix4x4f Geometry::GetO2W(const float time) const
+    {
+        if (!moving)
+        {
+            return object_to_world;
+        }
+        Matrix4x4f ret;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                ret[i][j] = Lerp(object_to_world[i][j], object_to_world_close[i][j], time);
+            }
+        }
+        return ret;
+    }
+
+    const bool Geometry::IsMoving() const
+    {
+        return moving;
+    }
+
     const Matrix4x4f &Geometry::GetW2O() const
     {
         return world_to_object;
@@ -47,6 +85,17 @@ namespace RenderToy
         return Vector3f(vec4[0], vec4[1], vec4[2]);
     }
 
+    const Vector3f Geometry::O2WTransform(const Vector3f &vec, const float time) const
+    {
+        if (!moving)
+        {
+            return O2WTransform(vec);
+        }
+        Vector4f vec4(vec.x(), vec.y(), vec.z(), 1.0f);
+        vec4 = GetO2W(time) * vec4;
+        return Vector3f(vec4[0], vec4[1], vec4[2]);
+    }
+
     const Vector3f Geometry::W2OTransform(const Vector3f &vec) const
     {
         // Vector4f vec4(vec, 1.0f);
@@ -57,7 +106,7 @@ namespace RenderToy
 
     const Ray Geometry::O2WTransform(const Ray &ray) const
     {
-        Ray ret(O2WTransform(ray.src), O2WTransform(ray.direction));
+        Ray ret(O2WTransform(ray.src, ray.time), O2WTransform(ray.direction, ray.time), ray.time);
         ret.direction -= ret.src;
         ret.direction.Normalize();
         return ret;
@@ -65,7 +114,7 @@ namespace RenderToy
 
     const Ray Geometry::W2OTransform(const Ray &ray) const
     {
-        Ray ret(W2OTransform(ray.src), W2OTransform(ray.direction));
+        Ray ret(W2OTransform(ray.src), W2OTransform(ray.direction), ray.time);
         ret.direction -= ret.src;
         ret.direction.Normalize();
         return ret;
@@ -81,10 +130,27 @@ namespace RenderToy
     }
 
     const BoundingBox Triangle::BBox() const
+    {
+        BoundingBox ret = BBox(0.0f);
+        if (moving)
+        {
+            // Vertices move linearly, so the boxes at both ends bound the whole sweep.
+            ret.ExtendBy(BBox(1.0f));
+        }
+        return ret;
+    }
+
+    const BoundingBox Triangle::BBox(const float time) const
     {
         Vector3f v0 = vert_w[0];
         Vector3f v1 = vert_w[1];
         Vector3f v2 = vert_w[2];
+        if (moving)
+        {
+            v0 = Lerp(v0, vert_w_close[0], time);
+            v1 = Lerp(v1, vert_w_close[1], time);
+            v2 = Lerp(v2, vert_w_close[2], time);
+        }
 
         Vector3f bmax = {
             std::max(v0.x(), std::max(v1.x(), v2.x())),
@@ -106,19 +172,28 @@ namespace RenderToy
 
     const bool Triangle::Intersect(const Ray &ray, float &t, float &u, float &v) const
     {
-        Vector3f pvec = ray.direction.Cross(v0v2_w);
-        float det = v0v1_w.Dot(pvec);
+        if (moving)
+        {
+            return Intersect(ray, Lerp(vert_w[0], vert_w_close[0], ray.time), Lerp(v0v1_w, v0v1_w_close, ray.time), Lerp(v0v2_w, v0v2_w_close, ray.time), t, u, v);
+        }
+        return Intersect(ray, vert_w[0], v0v1_w, v0v2_w, t, u, v);
+    }
+
+    const bool Triangle::Intersect(const Ray &ray, const Vector3f &v0, const Vector3f &v0v1, const Vector3f &v0v2, float &t, float &u, float &v)
+    {
+        Vector3f pvec = ray.direction.Cross(v0v2);
+        float det = v0v1.Dot(pvec);
 
         if (det > 0.0f)
         {
-            Vector3f tvec = ray.src - vert_w[0];
+            Vector3f tvec = ray.src - v0;
             auto alpha = pvec.Dot(tvec);
             if (alpha < 0.0f || alpha > det)
             {
                 return false;
             }
 
-            Vector3f qvec = tvec.Cross(v0v1_w);
+            Vector3f qvec = tvec.Cross(v0v1);
             auto beta = qvec.Dot(ray.direction);
             if (beta < 0.0f || alpha + beta > det)
             {
@@ -126,7 +201,7 @@ namespace RenderToy
             }
 
             float inv_det = 1.0f / det;
-            t = v0v2_w.Dot(qvec) * inv_det;
+            t = v0v2.Dot(qvec) * inv_det;
             if (t < 0.0f)
             {
                 return false;
@@ -138,14 +213,14 @@ namespace RenderToy
         }
         else if (det < 0.0f)
         {
-            Vector3f tvec = ray.src - vert_w[0];
+            Vector3f tvec = ray.src - v0;
             auto alpha = pvec.Dot(tvec);
             if (alpha > 0.0f || alpha < det)
             {
                 return false;
             }
 
-            Vector3f qvec = tvec.Cross(v0v1_w);
+            Vector3f qvec = tvec.Cross(v0v1);
             auto beta = qvec.Dot(ray.direction);
             if (beta > 0.0f || alpha + beta < det)
             {
@@ -153,7 +228,7 @@ namespace RenderToy
             }
 
             float inv_det = 1.0f / det;
-            t = v0v2_w.Dot(qvec) * inv_det;
+            t = v0v2.Dot(qvec) * inv_det;
             if (t < 0.0f)
             {
                 return false;
@@ -166,7 +241,7 @@ namespace RenderToy
         return false;
     }
 
-    const Vector3f Triangle::GetSamplePoint() const
+    const Vector3f Triangle::GetSamplePoint(const float time) const
     {
         float sqr1 = std::sqrt(Random::Float());
         float r2 = Random::Float();
@@ -174,9 +249,32 @@ namespace RenderToy
         float a = 1.0f - sqr1;
         float b = (1.0f - r2) * sqr1;
 
+        if (moving)
+        {
+            return Lerp(v0v1_w, v0v1_w_close, time) * a + Lerp(v0v2_w, v0v2_w_close, time) * b + Lerp(vert_w[0], vert_w_close[0], time);
+        }
         return v0v1_w * a + v0v2_w * b + vert_w[0];
     }
 
+    void Triangle::Barycentric(const Vector3f &position, float &u, float &v, const float time) const
+    {
+        Vector3f e1 = v0v1_w, e2 = v0v2_w, d = position - vert_w[0];
+        if (moving)
+        {
+            e1 = Lerp(v0v1_w, v0v1_w_close, time);
+            e2 = Lerp(v0v2_w, v0v2_w_close, time);
+            d = position - Lerp(vert_w[0], vert_w_close[0], time);
+        }
+        const float d00 = e1.Dot(e1);
+        const float d01 = e1.Dot(e2);
+        const float d11 = e2.Dot(e2);
+        const float d20 = d.Dot(e1);
+        const float d21 = d.Dot(e2);
+        const float inv_denom = 1.0f / (d00 * d11 - d01 * d01);
+        u = (d11 * d20 - d01 * d21) * inv_denom;
+        v = (d00 * d21 - d01 * d20) * inv_denom;
+    }
+
     const Vector3f Triangle::Tangent() const
     {
         return v0v1_w.Normalized();
@@ -194,33 +292,71 @@ namespace RenderToy
         return v0v1_w.Cross(v0v2_w).Length() * 0.5f;
     }
 
-    const float Triangle::AreaC() const
+    const float Triangle::AreaC(const float time) const
     {
-        return area;
+        return moving ? Lerp(area, area_close, time) : area;
     }
 
-    const Vector3f Triangle::TangentC() const
+    const Vector3f Triangle::TangentC(const float u, const float v, const float time) const
     {
+        const Vector3f tangent = (1 - u - v) * tang_w[0] + u * tang_w[1] + v * tang_w[2];
+        if (moving)
+        {
+            return Lerp(tangent, (1 - u - v) * tang_w_close[0] + u * tang_w_close[1] + v * tang_w_close[2], time);
+        }
         return tangent;
     }
 
-    const Vector3f Triangle::NormalC(const float u, const float v) const
+    const Vector3f Triangle::NormalC(const float u, const float v, const float time) const
     {
         if (parent->smooth)
         {
-            return ((1 - u - v) * norm[0] + u * norm[1] + v * norm[2]).Normalized();
+            const Vector3f normal_open = (1 - u - v) * norm_w[0] + u * norm_w[1] + v * norm_w[2];
+            if (moving)
+            {
+                // Nlerp like the geometrical normal.
+                return Lerp(normal_open, (1 - u - v) * norm_w_close[0] + u * norm_w_close[1] + v * norm_w_close[2], time).Normalized();
+            }
+            return normal_open.Normalized();
         }
         else
         {
-            return normal;
+            return GeometricalNormalC(time);
         }
     }
 
-    const Vector3f Triangle::GeometricalNormalC() const
+    const Vector3f Triangle::GeometricalNormalC(const float time) const
     {
+        if (moving)
+        {
+            // Nlerp, exact at both ends of the shutter interval.
+            return Lerp(normal, normal_close, time).Normalized();
+        }
         return normal;
     }
 
+    const bool Triangle::IsMoving() const
+    {
+        return moving;
+    }
+
+    // Transform a direction by the linear part of o2w.
+    static const Vector3f TransformDirection(const Matrix4x4f &o2w, const Vector3f &direction)
+    {
+        const Vector4f ret = o2w * Vector4f(direction.x(), direction.y(), direction.z(), 0.0f);
+        return Vector3f(ret[0], ret[1], ret[2]);
+    }
+
+    // Transform a normal by the inverse transpose of the linear part of o2w, normalized. Its cofactor matrix, the inverse transpose scaled
+    // by the determinant, turns normals the same way the cross product of transformed edges turns the geometrical normal.
+    static const Vector3f TransformNormal(const Matrix4x4f &o2w, const Vector3f &normal)
+    {
+        const Vector3f a(o2w[0][0], o2w[1][0], o2w[2][0]);
+        const Vector3f b(o2w[0][1], o2w[1][1], o2w[2][1]);
+        const Vector3f c(o2w[0][2], o2w[1][2], o2w[2][2]);
+        return (normal.x() * b.Cross(c) + normal.y() * c.Cross(a) + normal.z() * a.Cross(b)).Normalized_s();
+    }
+
     void Triangle::UpdateCache()
     {
         if (parent != nullptr)
@@ -238,8 +374,45 @@ namespace RenderToy
         v0v1_w = vert_w[1] - vert_w[0];
         v0v2_w = vert_w[2] - vert_w[0];
         area = Area();
-        tangent = Tangent();
         normal = Normal();
+        for (int i = 0; i < 3; ++i)
+        {
+            if (parent != nullptr)
+            {
+                tang_w[i] = TransformDirection(parent->GetO2W(), tang[i]);
+                norm_w[i] = TransformNormal(parent->GetO2W(), norm[i]);
+            }
+            else
+            {
+                tang_w[i] = tang[i];
+                norm_w[i] = norm[i].Normalized_s();
+            }
+        }
+
+        moving = parent != nullptr && parent->IsMoving();
+        if (moving)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                vert_w_close[i] = parent->O2WTransform(vert[i], 1.0f);
+                tang_w_close[i] = TransformDirection(parent->GetO2WClose(), tang[i]);
+                norm_w_close[i] = TransformNormal(parent->GetO2WClose(), norm[i]);
+            }
+            v0v1_w_close = vert_w_close[1] - vert_w_close[0];
+            v0v2_w_close = vert_w_close[2] - vert_w_close[0];
+            area_close = v0v1_w_close.Cross(v0v2_w_close).Length() * 0.5f;
+            normal_close = v0v1_w_close.Normalized().Cross(vert_w_close[2] - vert_w_close[1]).Normalized();
+        }
+        else
+        {
+            vert_w_close = vert_w;
+            tang_w_close = tang_w;
+            norm_w_close = norm_w;
+            v0v1_w_close = v0v1_w;
+            v0v2_w_close = v0v2_w;
+            area_close = area;
+            normal_close = normal;
+        }
     }
 
     const std::vector<float> Triangle::GetVBO(const std::vector<GLAttributeObject> &attrib_list) const
@@ -307,6 +480,79 @@ namespace RenderToy
         }
     }
 
+    void Mesh::SetO2W(const Matrix4x4f &object_to_world_, const Matrix4x4f &object_to_world_close_)
+    {
+        Geometry::SetO2W(object_to_world_, object_to_world_close_);
+        for (auto tri : tris)
+        {
+            tri->UpdateCache();
+        }
+    }
+
+    void Mesh::ComputeTangents()
+    {
+        // Corners are told apart by position, normal and handedness, so tangents stay split along hard edges and mirrored seams.
+        std::map<std::array<float, 7>, std::size_t> corner_ids;
+        std::vector<Vector3f> sums;
+        std::vector<std::size_t> corners(tris.size() * 3);
+        for (std::size_t i = 0; i < tris.size(); ++i)
+        {
+            Triangle *tri = tris[i];
+            const Vector3f e1 = tri->vert[1] - tri->vert[0];
+            const Vector3f e2 = tri->vert[2] - tri->vert[0];
+            const Vector2f d1 = tri->uv[1] - tri->uv[0];
+            const Vector2f d2 = tri->uv[2] - tri->uv[0];
+            const float det = d1.x() * d2.y() - d1.y() * d2.x();
+
+            // Face normal on the side of the vertex normals, if there are any.
+            Vector3f face_normal = e1.Cross(e2).Normalized();
+            if (face_normal.Dot(tri->norm[0] + tri->norm[1] + tri->norm[2]) < 0.0f)
+            {
+                face_normal = -face_normal;
+            }
+
+            // Derivatives of the position along u and v.
+            Vector3f tangent, bitangent;
+            if (det != 0.0f)
+            {
+                tangent = ((e1 * d2.y() - e2 * d1.y()) / det).Normalized();
+                bitangent = (e2 * d1.x() - e1 * d2.x()) / det;
+                tri->tangent_sign = face_normal.Cross(tangent).Dot(bitangent) < 0.0f ? -1.0f : 1.0f;
+            }
+
+            for (int j = 0; j < 3; ++j)
+            {
+                const Vector3f &p = tri->vert[j], &n = tri->norm[j];
+                const std::array<float, 7> key = {p.x(), p.y(), p.z(), n.x(), n.y(), n.z(), tri->tangent_sign};
+                auto it = corner_ids.try_emplace(key, sums.size()).first;
+                if (it->second == sums.size())
+                {
+                    sums.push_back(Vector3f::O);
+                }
+                // Not a number if det is zero or tiny.
+                if (std::isfinite(tangent.x() + tangent.y() + tangent.z()))
+                {
+                    sums[it->second] += tangent;
+                }
+                corners[i * 3 + j] = it->second;
+            }
+        }
+
+        for (std::size_t i = 0; i < tris.size(); ++i)
+        {
+            Triangle *tri = tris[i];
+            const Vector3f face_normal = (tri->vert[1] - tri->vert[0]).Cross(tri->vert[2] - tri->vert[0]).Normalized();
+            for (int j = 0; j < 3; ++j)
+            {
+                const Vector3f n = tri->norm[j] == Vector3f::O ? face_normal : tri->norm[j].Normalized();
+                const Vector3f tangent = sums[corners[i * 3 + j]];
+                const Vector3f projected = tangent - n * n.Dot(tangent);
+                tri->tang[j] = projected.Length() > 0.0f ? projected.Normalized() : Vector3f::O;
+            }
+            tri->UpdateCache();
+        }
+    }
+
     const std::vector<float> Mesh::GetVBO(const std::vector<GLAttributeObject> &attrib_list) const
     {
         std::vector<float> ret;
@@ -356,6 +602,44 @@ namespace RenderToy
         return {object_to_world[0][3], object_to_world[1][3], object_to_world[2][3]};
     }
 
+    const Vector3f DeltaLight::Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const
+    {
+        const Vector3f to_light = GetSamplePoint() - position;
+        const float distance2 = to_light.Length2();
+        distance_o = std::sqrt(distance2);
+        dir_to_light_o = to_light / distance_o;
+        return color * intensity / distance2;
+    }
+
+    SpotLight::SpotLight(Vector3f color_, float intensity_, float spot_size_, float spot_blend_)
+        : DeltaLight(color_, intensity_), spot_size(spot_size_), spot_blend(spot_blend_)
+    {
+    }
+
+    const Vector3f SpotLight::Illuminate(const Vector3f &position, Vector3f &dir_to_light_o, float &distance_o) const
+    {
+        const Vector3f irradiance = DeltaLight::Illuminate(position, dir_to_light_o, distance_o);
+
+        // Spot axis is -z of object space, i.e. the negated third column of O2W.
+        const Vector3f axis = -Vector3f(object_to_world[0][2], object_to_world[1][2], object_to_world[2][2]).Normalized();
+        const float cos_angle = -dir_to_light_o.Dot(axis);
+        const float cos_spot = std::cos(0.5f * spot_size);
+        if (cos_angle <= cos_spot)
+        {
+            return Vector3f::O;
+        }
+
+        // Smoothstep towards the cone edge, as Blender does.
+        const float smooth = (1.0f - cos_spot) * spot_blend;
+        const float t = cos_angle - cos_spot;
+        if (t < smooth)
+        {
+            const float x = t / smooth;
+            return irradiance * (x * x * (3.0f - 2.0f * x));
+        }
+        return irradiance;
+    }
+
     DirectionalLight::DirectionalLight(Vector3f color_, float intensity_)
         : Light(color_, intensity_)
     {
@@ -365,4 +649,12 @@ namespace RenderToy
     {
         return O2WTransform(kFloatInfinity * Vector3f(0.0f,0.0f,1.0f));
     }
+
+    const Vector3f DirectionalLight::Illuminate(const Vector3f & /*position*/, Vector3f &dir_to_light_o, float &distance_o) const
+    {
+        // Light travels along -z of object space, so the receiver looks towards +z.
+        dir_to_light_o = Vector3f(object_to_world[0][2], object_to_world[1][2], object_to_world[2][2]).Normalized();
+        distance_o = kFloatInfinity;
+        return color * intensity;
+    }
 }
\ No newline at end of file
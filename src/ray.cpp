@@ -1,10 +1,108 @@
 #include <RenderToy/ray.h>
+#include <RenderToy/pbr.h>
+
+#include <algorithm>
+#include <cmath>
 
 namespace RenderToy
 {
-    Ray::Ray(Vector3f src_, Vector3f normalized_direction_) : src(src_), direction(normalized_direction_) {}
+    // Shorter projected tangents are too close to the normal to give a direction.
+    static constexpr float kMinTangentLength = 1e-4f;
+
+    Ray::Ray(Vector3f src_, Vector3f normalized_direction_, float time_) : src(src_), direction(normalized_direction_), time(time_) {}
     const Ray Ray::operator-(const Ray &ray)
     {
-        return Ray(src, -direction);
+        return Ray(src, -direction, time);
+    }
+
+    void RayState::Travel(const float distance)
+    {
+        cone_width += cone_spread * distance;
+    }
+
+    void RayState::Scatter(const float pdf)
+    {
+        // Full angle of a cone subtending a solid angle of 1 / pdf, no wider than a hemisphere.
+        cone_spread = std::min(cone_spread + 2.0f / std::sqrt(kPi<float> * pdf), kPi<float>);
+    }
+
+    void RayState::SetFrame(const Vector3f &normal, const Vector3f &tangent)
+    {
+        ffnormal = normal;
+        const Vector3f projected = tangent - normal * normal.Dot(tangent);
+        const float length = projected.Length();
+        if (length > kMinTangentLength)
+        {
+            fftangent = projected / length;
+            ffbitangent = normal.Cross(fftangent);
+        }
+        else
+        {
+            Onb(normal, fftangent, ffbitangent);
+        }
+    }
+
+    void RayState::Enter(const Medium &medium)
+    {
+        // Rays cannot be inside the same medium twice, an earlier entry was not left cleanly.
+        Leave(medium.material_id);
+        if (medium_count == kMaxMedia)
+        {
+            std::copy(media.begin() + 1, media.end(), media.begin());
+            --medium_count;
+        }
+        media[medium_count++] = medium;
+        absorption = medium.absorption;
+    }
+
+    void RayState::Leave(const uint16_t material_id)
+    {
+        for (std::size_t i = medium_count; i-- > 0;)
+        {
+            if (media[i].material_id == material_id)
+            {
+                std::copy(media.begin() + i + 1, media.begin() + medium_count, media.begin() + i);
+                --medium_count;
+                absorption = medium_count > 0 ? media[medium_count - 1].absorption : Vector3f::O;
+                return;
+            }
+        }
+    }
+
+    const float RayState::Ior() const
+    {
+        return medium_count > 0 ? media[medium_count - 1].ior : 1.0f;
+    }
+
+    const float RayState::OuterIor(const uint16_t material_id) const
+    {
+        // Only the innermost medium is revealed by leaving, any other one leaves the innermost in place.
+        std::size_t count = medium_count;
+        if (count > 0 && media[count - 1].material_id == material_id)
+        {
+            --count;
+        }
+        return count > 0 ? media[count - 1].ior : 1.0f;
+    }
+
+    const Vector3f RayState::Transmittance(const float distance) const
+    {
+        if (absorption == Vector3f::O)
+        {
+            return Vector3f::White;
+        }
+        return Vector3f(std::exp(-absorption.x() * distance), std::exp(-absorption.y() * distance), std::exp(-absorption.z() * distance));
+    }
+
+    void RayState::Frame(const Vector3f &N, Vector3f &T, Vector3f &B) const
+    {
+        // States built without SetFrame() have no frame.
+        if (N == ffnormal && !(fftangent == Vector3f::O))
+        {
+            T = fftangent;
+            B = ffbitangent;
+            return;
+        }
+        Onb(N, T, B);
     }
 }
\ No newline at end of file
@@ -5,10 +5,15 @@
 #include <RenderToy/bvh.h>
 #include <RenderToy/surfacepoint.h>
 #include <RenderToy/pbr.h>
+#include <RenderToy/checkpoint.h>
+#include <RenderToy/trace.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <optional>
 
 namespace RenderToy
 {
@@ -19,18 +24,21 @@ namespace RenderToy
 
     void IntersectTestRenderer::Render()
     {
+        BeginStats(1);
+        TRACE_SCOPE("IntersectTestRenderer::Render");
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
         Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
         float top, right;
         PrepareScreenSpace(cam, top, right);
         float div_resolution_width = 1.0f / float(render_context->format_settings.resolution.width);
         float div_resolution_height = 1.0f / float(render_context->format_settings.resolution.height);
 
-        for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+        for (int y = 0; y < render_context->buffer_size.height; ++y)
         {
-            for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+            for (int x = 0; x < render_context->buffer_size.width; ++x)
             {
-                // (x, y) is the point in Raster Space.
-                Vector2f NDC_coord = {float(x) * div_resolution_width, float(y) * div_resolution_height};
+                // (x, y) is the point in the buffer, buffer_origin offsets it into Raster Space.
+                Vector2f NDC_coord = {float(x + render_context->buffer_origin.x) * div_resolution_width, float(y + render_context->buffer_origin.y) * div_resolution_height};
                 Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
 
                 // Blender convention: Camera directing towards -z.
@@ -40,14 +48,15 @@ namespace RenderToy
                 float t, u, v;
                 Vector3f placeholder;
                 auto intersected = render_context->bvh->Intersect(cast_ray, placeholder, t, u, v, nullptr);
+                ++stats.Thread().camera_rays;
 
                 if (intersected != nullptr)
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f::White;
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f::White;
                 }
                 else
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f::O;
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f::O;
                 }
             }
         }
@@ -60,28 +69,76 @@ namespace RenderToy
 
     void TestRenderer::Render()
     {
-        for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+        BeginStats(1);
+        TRACE_SCOPE("TestRenderer::Render");
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
+        for (int y = 0; y < render_context->buffer_size.height; ++y)
         {
-            for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+            for (int x = 0; x < render_context->buffer_size.width; ++x)
             {
-                BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f(float(x) / float(render_context->format_settings.resolution.width), 1.0f, 1.0f);
+                BUFFER(x, y, render_context->buffer_size.width) = Vector3f(float(x + render_context->buffer_origin.x) / float(render_context->format_settings.resolution.width), 1.0f, 1.0f);
             }
         }
     }
 
+    RenderRegion::RenderRegion(const PointN &origin_, const SizeN &size_, const std::size_t overscan_)
+        : origin(origin_), size(size_), overscan(overscan_)
+    {
+    }
+
+    std::vector<RenderRegion> RenderRegion::Buckets(const SizeN &resolution, const SizeN &bucket_size, const std::size_t overscan)
+    {
+        std::vector<RenderRegion> ret;
+        for (std::size_t y = 0; y < resolution.height; y += bucket_size.height)
+        {
+            for (std::size_t x = 0; x < resolution.width; x += bucket_size.width)
+            {
+                ret.emplace_back(PointN(int(x), int(y)), SizeN(std::min(bucket_size.width, resolution.width - x), std::min(bucket_size.height, resolution.height - y)), overscan);
+            }
+        }
+        return ret;
+    }
+
     FormatSettings::FormatSettings(SizeN resolution_, Vector2f aspect_)
         : resolution(resolution_), aspect(aspect_)
     {
     }
 
+    FormatSettings::FormatSettings(SizeN resolution_, Vector2f aspect_, const RenderRegion &region_)
+        : resolution(resolution_), aspect(aspect_), region(region_)
+    {
+    }
+
     RenderContext::RenderContext(World *world_, FormatSettings format_settings_)
-        : world(world_), format_settings(format_settings_)
+        : world(world_), format_settings(format_settings_), buffer(nullptr)
     {
         if (world != nullptr)
         {
+            RenderStats::ScopedTimer timer(build_seconds);
             bvh = new BVH(world->triangles);
         }
-        buffer = new Vector3f[format_settings.resolution.Area()];
+        SetRegion(format_settings.region);
+    }
+
+    void RenderContext::SetRegion(const std::optional<RenderRegion> &region_)
+    {
+        format_settings.region = region_;
+        buffer_origin = PointN();
+        buffer_size = format_settings.resolution;
+        if (format_settings.region.has_value())
+        {
+            // Grow the region by its overscan, then clip it to the frame.
+            const RenderRegion &region = format_settings.region.value();
+            const int overscan = int(region.overscan);
+            const int x0 = std::clamp(region.origin.x - overscan, 0, int(format_settings.resolution.width));
+            const int y0 = std::clamp(region.origin.y - overscan, 0, int(format_settings.resolution.height));
+            const int x1 = std::clamp(region.origin.x + int(region.size.width) + overscan, x0, int(format_settings.resolution.width));
+            const int y1 = std::clamp(region.origin.y + int(region.size.height) + overscan, y0, int(format_settings.resolution.height));
+            buffer_origin = PointN(x0, y0);
+            buffer_size = SizeN(x1 - x0, y1 - y0);
+        }
+        delete[] buffer;
+        buffer = new Vector3f[buffer_size.Area()];
     }
 
     RenderContext::~RenderContext()
@@ -92,12 +149,12 @@ namespace RenderToy
 
     Vector3f &RenderContext::operator()(const std::size_t x, const std::size_t y)
     {
-        return buffer[y * format_settings.resolution.width + x];
+        return buffer[y * buffer_size.width + x];
     }
 
     const Vector3f &RenderContext::operator()(const std::size_t x, const std::size_t y) const
     {
-        return buffer[y * format_settings.resolution.width + x];
+        return buffer[y * buffer_size.width + x];
     }
 
     void Renderer::PrepareScreenSpace(Camera *cam, float &top, float &right)
@@ -123,6 +180,29 @@ namespace RenderToy
         top *= yscale;
     }
 
+    const Ray Renderer::GenerateCameraRay(const Camera *cam, const float top, const float right, const int x, const int y, const float time) const
+    {
+        // (x, y) is the point in Raster Space.
+        Vector2f NDC_coord = {float(x) / float(render_context->format_settings.resolution.width), float(y) / float(render_context->format_settings.resolution.height)};
+        Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
+        // Blender convention: Camera directing towards -z.
+        Ray cast_ray(Vector3f::O, Vector3f(screen_coord.x(), screen_coord.y(), -1.0f), time);
+        return cam->O2WTransform(cast_ray);
+    }
+
+    const float Renderer::PixelSpread(const float top) const
+    {
+        return 2.0f * top / float(render_context->format_settings.resolution.height);
+    }
+
+    void Renderer::BeginStats(const std::size_t samples_per_pixel)
+    {
+        stats.Reset();
+        stats.pixels = render_context->buffer_size.Area();
+        stats.samples = stats.pixels * samples_per_pixel;
+        stats.Seconds(RenderStats::Phase::kBuild) = render_context->build_seconds;
+    }
+
     Renderer::Renderer(RenderContext *render_context_)
         : render_context(render_context_)
     {
@@ -137,6 +217,9 @@ namespace RenderToy
 
     void DepthBufferRenderer::Render()
     {
+        BeginStats(1);
+        TRACE_SCOPE("DepthBufferRenderer::Render");
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
         Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
         float top, right;
         PrepareScreenSpace(cam, top, right);
@@ -145,12 +228,12 @@ namespace RenderToy
         float div_resolution_width = 1.0f / float(render_context->format_settings.resolution.width);
         float div_resolution_height = 1.0f / float(render_context->format_settings.resolution.height);
 
-        for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+        for (int y = 0; y < render_context->buffer_size.height; ++y)
         {
-            for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+            for (int x = 0; x < render_context->buffer_size.width; ++x)
             {
-                // (x, y) is the point in Raster Space.
-                Vector2f NDC_coord = {float(x) * div_resolution_width, float(y) * div_resolution_height};
+                // (x, y) is the point in the buffer, buffer_origin offsets it into Raster Space.
+                Vector2f NDC_coord = {float(x + render_context->buffer_origin.x) * div_resolution_width, float(y + render_context->buffer_origin.y) * div_resolution_height};
                 Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
 
                 // Blender convention: Camera directing towards -z.
@@ -160,14 +243,15 @@ namespace RenderToy
                 float t, u, v;
                 Vector3f placeholder;
                 auto intersected = render_context->bvh->Intersect(cast_ray, placeholder, t, u, v, nullptr);
+                ++stats.Thread().camera_rays;
 
                 if (intersected != nullptr)
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f(std::clamp((t - near) * div_far_minus_near, 0.0f, 1.0f));
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f(std::clamp((t - near) * div_far_minus_near, 0.0f, 1.0f));
                 }
                 else
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f(1.0f);
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f(1.0f);
                 }
             }
         }
@@ -185,6 +269,9 @@ namespace RenderToy
 
     void NormalRenderer::Render()
     {
+        BeginStats(1);
+        TRACE_SCOPE("NormalRenderer::Render");
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
         Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
         float top, right;
         PrepareScreenSpace(cam, top, right);
@@ -192,12 +279,12 @@ namespace RenderToy
         float div_resolution_width = 1.0f / float(render_context->format_settings.resolution.width);
         float div_resolution_height = 1.0f / float(render_context->format_settings.resolution.height);
 
-        for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+        for (int y = 0; y < render_context->buffer_size.height; ++y)
         {
-            for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+            for (int x = 0; x < render_context->buffer_size.width; ++x)
             {
-                // (x, y) is the point in Raster Space.
-                Vector2f NDC_coord = {float(x) * div_resolution_width, float(y) * div_resolution_height};
+                // (x, y) is the point in the buffer, buffer_origin offsets it into Raster Space.
+                Vector2f NDC_coord = {float(x + render_context->buffer_origin.x) * div_resolution_width, float(y + render_context->buffer_origin.y) * div_resolution_height};
                 Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
 
                 // Blender convention: Camera directing towards -z.
@@ -207,6 +294,7 @@ namespace RenderToy
                 float t, u, v;
                 Vector3f position;
                 auto intersected = render_context->bvh->Intersect(cast_ray, position, t, u, v, nullptr);
+                ++stats.Thread().camera_rays;
                 SurfacePoint sp(intersected, position, u, v);
 
                 if (intersected != nullptr)
@@ -218,11 +306,11 @@ namespace RenderToy
                     {
                         normal = -normal;
                     }
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = (normal + Vector3f::White) / 2.0f;
+                    BUFFER(x, y, render_context->buffer_size.width) = (normal + Vector3f::White) / 2.0f;
                 }
                 else
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f::O;
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f::O;
                 }
             }
         }
@@ -233,45 +321,168 @@ namespace RenderToy
     {
     }
 
+    void AccumulationBuffer::Resize(const SizeN &size_)
+    {
+        size = size_;
+        tiles_x = (size.width + kTileSize - 1) / kTileSize;
+        const std::size_t tiles_y = (size.height + kTileSize - 1) / kTileSize;
+        sums.assign(tiles_x * tiles_y * kTileSize * kTileSize, Vector3d());
+    }
+
+    const SizeN &AccumulationBuffer::Size() const
+    {
+        return size;
+    }
+
+    const std::size_t AccumulationBuffer::TileCount() const
+    {
+        return sums.size() / (kTileSize * kTileSize);
+    }
+
+    void AccumulationBuffer::Tile(const std::size_t t, PointN &origin_o, SizeN &size_o) const
+    {
+        const std::size_t x = (t % tiles_x) * kTileSize;
+        const std::size_t y = (t / tiles_x) * kTileSize;
+        origin_o = PointN(int(x), int(y));
+        size_o = SizeN(std::min(kTileSize, size.width - x), std::min(kTileSize, size.height - y));
+    }
+
+    Vector3d &AccumulationBuffer::operator()(const std::size_t x, const std::size_t y)
+    {
+        const std::size_t tile = (y / kTileSize) * tiles_x + x / kTileSize;
+        return sums[tile * kTileSize * kTileSize + (y % kTileSize) * kTileSize + x % kTileSize];
+    }
+
+    const Vector3d &AccumulationBuffer::operator()(const std::size_t x, const std::size_t y) const
+    {
+        const std::size_t tile = (y / kTileSize) * tiles_x + x / kTileSize;
+        return sums[tile * kTileSize * kTileSize + (y % kTileSize) * kTileSize + x % kTileSize];
+    }
+
+    void AccumulationBuffer::Resolve(Vector3f *dst, const double scale) const
+    {
+        TRACE_SCOPE("AccumulationBuffer::Resolve");
+#pragma omp parallel for
+        for (int y = 0; y < int(size.height); ++y)
+        {
+            for (std::size_t x = 0; x < size.width; ++x)
+            {
+                const Vector3d &sum = (*this)(x, y);
+                dst[y * size.width + x] = Vector3f(sum.x() * scale, sum.y() * scale, sum.z() * scale);
+            }
+        }
+    }
+
     void PathTracingRenderer::Render()
+    {
+        TRACE_SCOPE("PathTracingRenderer::Render");
+        if (accumulation.Size() != render_context->buffer_size)
+        {
+            accumulation.Resize(render_context->buffer_size);
+        }
+        if (path_guiding && guiding.Empty())
+        {
+            BoundingBox bounds = render_context->bvh->octree->root->bbox;
+            bounds.ExtendBy(render_context->bvh->octree->root->bbox_close);
+            guiding.Reset(bounds);
+            guiding_iterations = 0;
+        }
+
+        const int first_iteration = finished_iterations;
+        BeginStats(0);
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
+        while (finished_iterations < iteration_count)
+        {
+            const int remaining = iteration_count - finished_iterations;
+            int count = checkpoint_interval > 0 ? std::min(checkpoint_interval, remaining) : remaining;
+            if (path_guiding)
+            {
+                // Passes of 1, 1, 2, 4, ... iterations, each learning as much as all passes before it.
+                count = std::min(count, std::max(guiding_iterations, 1));
+            }
+            RenderIterations(finished_iterations, count);
+            finished_iterations += count;
+            if (path_guiding)
+            {
+                guiding.Update();
+                guiding_iterations += count;
+            }
+
+            // Reduce into the buffer once per pass, it holds the mean over all iterations like before.
+            accumulation.Resolve(render_context->buffer, 1.0 / double(iteration_count));
+
+            if (checkpoint_interval > 0 && !checkpoint_path.empty())
+            {
+                RenderCheckpoint::Save(*this, checkpoint_path);
+            }
+        }
+        stats.samples = stats.pixels * std::size_t(finished_iterations - first_iteration);
+    }
+
+    const int PathTracingRenderer::FinishedIterations() const
+    {
+        return finished_iterations;
+    }
+
+    void PathTracingRenderer::Reset()
+    {
+        finished_iterations = 0;
+        accumulation.Resize(render_context->buffer_size);
+        // The scene may have changed, learn it again.
+        guiding.Clear();
+        guiding_iterations = 0;
+    }
+
+    void PathTracingRenderer::RenderIterations(const int first_iteration, const int count)
     {
         Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
         float top, right;
         PrepareScreenSpace(cam, top, right);
 
-        float div_resolution_width = 1.0f / float(render_context->format_settings.resolution.width);
-        float div_resolution_height = 1.0f / float(render_context->format_settings.resolution.height);
-
-        // int finished_iterations = 0;
+        const std::size_t frame_width = render_context->format_settings.resolution.width;
+        // Static scenes skip drawing sample times, keeping their random sequences unchanged.
+        const bool motion = render_context->world->HasMotion();
+        const float pixel_spread = PixelSpread(top);
 
-#pragma omp parallel for
-        for (int i = 0; i < iteration_count; ++i)
+        // Every tile is rendered by one thread and every pixel sums its samples in order,
+        // so the result does not depend on the thread count.
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t t = 0; t < accumulation.TileCount(); ++t)
         {
-            for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+            TRACE_SCOPE("Tile");
+            RenderStats::ScopedTimer busy(stats.Thread().busy_seconds);
+            PointN tile_origin;
+            SizeN tile_size;
+            accumulation.Tile(t, tile_origin, tile_size);
+            for (std::size_t y = tile_origin.y; y < tile_origin.y + tile_size.height; ++y)
             {
-                for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+                for (std::size_t x = tile_origin.x; x < tile_origin.x + tile_size.width; ++x)
                 {
-                    // (x, y) is the point in Raster Space.
-                    Vector2f NDC_coord = {float(x) * div_resolution_width, float(y) * div_resolution_height};
-                    Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
-                    // Blender convention: Camera directing towards -z.
-                    Ray cast_ray(Vector3f::O, Vector3f(screen_coord.x(), screen_coord.y(), -1.0f));
-                    cast_ray = cam->O2WTransform(cast_ray);
-                    RayState state;
-                    BUFFER(x, y, render_context->format_settings.resolution.width) += Radiance(cast_ray, nullptr, state, 0, 0.0f) / static_cast<float>(iteration_count);
+                    // (x, y) is the point in the buffer, buffer_origin offsets it into Raster Space.
+                    const int raster_x = int(x) + render_context->buffer_origin.x;
+                    const int raster_y = int(y) + render_context->buffer_origin.y;
+                    // Index pixels in the whole frame, so that a render region draws the same samples.
+                    const std::size_t pixel = std::size_t(raster_y) * frame_width + std::size_t(raster_x);
+                    const Ray cast_ray = GenerateCameraRay(cam, top, right, raster_x, raster_y);
+
+                    Vector3d &sum = accumulation(x, y);
+                    for (int i = first_iteration; i < first_iteration + count; ++i)
+                    {
+                        Random::Seed(seed, pixel, std::size_t(sample_offset + i));
+                        RayState state;
+                        state.cone_spread = pixel_spread;
+                        const Vector3f radiance = motion ? Radiance(GenerateCameraRay(cam, top, right, raster_x, raster_y, Random::Float()), nullptr, state, 0, 0.0f)
+                                                         : Radiance(cast_ray, nullptr, state, 0, 0.0f);
+                        sum += Vector3d(radiance.x(), radiance.y(), radiance.z());
+                    }
                 }
             }
-            // #pragma omp critical
-            // {
-            //     ++finished_iterations;
-            //     std::cout<<finished_iterations<<std::endl;
-            // }
         }
     }
 
     const Vector3f PathTracingRenderer::Radiance(const Ray &cast_ray, const Triangle *last_hit, RayState &state, const int depth, const float last_bsdfpdf) const
     {
-        if (depth > 4)
+        if (depth > kMaxDepth)
         {
             return Vector3f::O;
         }
@@ -280,22 +491,31 @@ namespace RenderToy
         Vector3f hitPosition;
         float t, u, v;
         hit_obj = render_context->bvh->Intersect(cast_ray, hitPosition,t, u, v, last_hit);
+        RenderStats::Counters &counters = stats.Thread();
+        ++(depth == 0 ? counters.camera_rays : counters.bounce_rays);
 
         Vector3f radiance;
         if (hit_obj != nullptr)
         {
-            SurfacePoint surface_point(hit_obj, hitPosition, u, v);
-            state.ffnormal = surface_point.GetNormal();
-            if (Vector3f::Dot(cast_ray.direction, state.ffnormal) > 0.0f)
+            // Normal of the previous vertex, used to evaluate its emitter selection probability.
+            const Vector3f last_normal = state.ffnormal;
+            SurfacePoint surface_point(hit_obj, hitPosition, u, v, cast_ray.time, render_context->world->GetMaterial(hit_obj->material_id));
+            state.Travel(t);
+            // The side is told by the interpolated normal, a perturbed one may lean past the ray.
+            const bool leaving = Vector3f::Dot(cast_ray.direction, surface_point.GetNormal()) > 0.0f;
+            if (leaving)
             {
-                state.ffnormal = -state.ffnormal;
-                state.eta = surface_point.GetMaterial()->ior;
-                state.absorption = Vector3f::O;
+                state.eta = surface_point.GetMaterial()->ior / state.OuterIor(hit_obj->material_id);
             }
             else
             {
-                state.eta = 1.0f / surface_point.GetMaterial()->ior;
+                state.eta = state.OuterIor(hit_obj->material_id) / surface_point.GetMaterial()->ior;
             }
+            surface_point.ApplyTextures(cast_ray.direction, state.cone_width, state.eta, counters.texture_misses);
+            // Light absorbed by the medium the ray came through.
+            const Vector3f bounce_ratio = state.Transmittance(t);
+            const Vector3f shading_normal = surface_point.GetShadingNormal();
+            state.SetFrame(leaving ? -shading_normal : shading_normal, surface_point.GetShadingTangent());
 
             float self_emission_pdf;
             auto self_emission = surface_point.GetEmission<true>(cast_ray.src, -cast_ray.direction, self_emission_pdf);
@@ -305,82 +525,620 @@ namespace RenderToy
             }
             else
             {
+                self_emission_pdf *= render_context->world->EmitterPMF(cast_ray.src, last_normal, hit_obj);
                 radiance += PowerHeuristic(last_bsdfpdf, self_emission_pdf) * self_emission;
             }
 
-            auto bounce_ratio = Vector3f::Pow(Vector3f(M_Ef32), -state.absorption * (hitPosition - cast_ray.src).Length());
-
             radiance += DirectLight(state, cast_ray.direction, surface_point) * bounce_ratio;
             Vector3f nextDirection;
             Vector3f color;
             float bsdfpdf;
-            if (surface_point.GetMaterial()->Sample(-cast_ray.direction, nextDirection, color, bsdfpdf, state))
+            if (SampleBounce(state, cast_ray.direction, surface_point, nextDirection, color, bsdfpdf))
             {
-                state.absorption = -Vector3f::Log(surface_point.GetMaterial()->extinction) / surface_point.GetMaterial()->at_distance;
+                UpdateMedia(state, leaving, nextDirection, surface_point);
 
                 if (bsdfpdf > 0.0f)
                 {
-                    radiance += bounce_ratio * color / bsdfpdf * Radiance(Ray(surface_point.GetPosition(), nextDirection), surface_point.GetHitTriangle(), state, depth + 1, bsdfpdf);
+                    state.Scatter(bsdfpdf);
+                    const Vector3f incident = Radiance(Ray(surface_point.GetPosition(), nextDirection, cast_ray.time), surface_point.GetHitTriangle(), state, depth + 1, bsdfpdf);
+                    radiance += bounce_ratio * color / bsdfpdf * incident;
+                    if (Guided(surface_point))
+                    {
+                        guiding.Record(surface_point.GetPosition(), nextDirection, Convert::Luma(incident) / bsdfpdf);
+                    }
                 }
             }
         }
         else
         {
             radiance = render_context->world->GetDefaultEmission(-cast_ray.direction);
+            const EnvironmentMap *environment = render_context->world->environment;
+            if (depth > 0 && environment != nullptr)
+            {
+                radiance = radiance * PowerHeuristic(last_bsdfpdf, environment->PDF(cast_ray.direction));
+            }
         }
 
         return radiance;
     }
 
-    const Vector3f PathTracingRenderer::DirectLight(const RayState state, const Vector3f &original_ray_dir, const SurfacePoint &surface_point) const
+    const Vector3f PathTracingRenderer::DirectLight(const RayState &state, const Vector3f &original_ray_dir, const SurfacePoint &surface_point) const
     {
+        // Reused across calls to keep the megakernel free of allocations.
+        thread_local std::vector<ShadowQuery> queries;
+        queries.clear();
+        SampleDirectLight(state, original_ray_dir, surface_point, queries);
 
         Vector3f ret;
-        auto tri = surface_point.GetHitTriangle();
+        for (const auto &query : queries)
+        {
+            if (Unoccluded(query))
+            {
+                ret += query.contribution;
+            }
+        }
+        return ret;
+    }
+
+    void PathTracingRenderer::SampleDirectLight(const RayState &state, const Vector3f &original_ray_dir, const SurfacePoint &surface_point, std::vector<ShadowQuery> &queries) const
+    {
+        thread_local std::vector<LightSample> samples;
+        samples.clear();
+        SampleLights(state, surface_point, samples);
+
+        for (const auto &sample : samples)
+        {
+            /*
+            -original_ray_dir     sample.direction
+                        ^         ^
+                         \normal /
+                          \  |  /
+                           \ | /
+                            \|/
+                      -------*-------
+                      surface_point
+            */
+            float bsdfpdf;
+            const Vector3f f = surface_point.GetMaterial()->Eval(state, -original_ray_dir, state.ffnormal, sample.direction, bsdfpdf);
+            ShadowQuery query;
+            if (LightQuery(state, original_ray_dir, surface_point, sample, f, bsdfpdf, query))
+            {
+                queries.push_back(query);
+            }
+        }
+    }
+
+    void PathTracingRenderer::SampleLights(const RayState &state, const SurfacePoint &surface_point, std::vector<LightSample> &samples) const
+    {
+        const Vector3f &position = surface_point.GetPosition();
+        const float time = surface_point.GetTime();
 
         Vector3f emit_pos;
         const Triangle *emit_triangle = nullptr;
-        render_context->world->SampleEmitter(emit_pos, emit_triangle);
+        float emit_pmf;
+        render_context->world->SampleEmitter(position, state.ffnormal, emit_pos, emit_triangle, emit_pmf, time);
 
         if (emit_triangle != nullptr)
         {
-            const Vector3f dir_to_emitter((emit_pos - surface_point.GetPosition()).Normalized());
+            const Vector3f dir_to_emitter((emit_pos - position).Normalized());
 
-            const Triangle *test_triangle = nullptr;
-            Vector3f test_triangle_hit;
-            float t, u, v;
-            test_triangle = render_context->bvh->Intersect(Ray(surface_point.GetPosition(), dir_to_emitter), test_triangle_hit, t, u, v, tri);
+            float u, v;
+            emit_triangle->Barycentric(emit_pos, u, v, time);
+            float lightpdf;
+            Vector3f emission_in = SurfacePoint(emit_triangle, emit_pos, u, v, time, render_context->world->GetMaterial(emit_triangle->material_id)).GetEmission<true>(position, -dir_to_emitter, lightpdf);
+            lightpdf *= emit_pmf;
+            samples.push_back({dir_to_emitter, kFloatInfinity, emit_triangle, emission_in, lightpdf, false});
+        }
 
-            if ((test_triangle == nullptr) | (test_triangle == emit_triangle))
+        // Environment map, weighted against escaped bounces.
+        const EnvironmentMap *environment = render_context->world->environment;
+        if (environment != nullptr)
+        {
+            Vector3f dir_to_environment;
+            float environment_pdf;
+            const float u = Random::Float();
+            const Vector3f environment_in = environment->Sample(u, Random::Float(), dir_to_environment, environment_pdf);
+            if (environment_pdf > 0.0f)
             {
+                samples.push_back({dir_to_environment, kFloatInfinity, nullptr, environment_in, environment_pdf, false});
+            }
+        }
 
-                float lightpdf;
-                Vector3f emission_in = SurfacePoint(emit_triangle, emit_pos, u, v).GetEmission<true>(surface_point.GetPosition(), -dir_to_emitter, lightpdf);
-
-                /*
-                -original_ray_dir     dir_to_emitter
-                            ^         ^
-                             \normal /
-                              \  |  /
-                               \ | /
-                                \|/
-                          -------*-------
-                          surface_point
-                */
-                float bsdfpdf;
-                auto f = surface_point.GetMaterial()->Eval(state, -original_ray_dir, state.ffnormal, dir_to_emitter, bsdfpdf);
-
-                float weight = 1.0f;
-                weight = PowerHeuristic(lightpdf, bsdfpdf);
+        // Analytic lights are delta distributions: no area pdf and no MIS, only one occlusion ray each.
+        for (const auto light : render_context->world->lights)
+        {
+            Vector3f dir_to_light;
+            float distance;
+            const Vector3f irradiance = light->Illuminate(position, dir_to_light, distance);
+            if (irradiance == Vector3f::O)
+            {
+                continue;
+            }
+            samples.push_back({dir_to_light, distance, nullptr, irradiance, 0.0f, true});
+        }
+    }
 
-                if (bsdfpdf > 0.0f)
+    const bool PathTracingRenderer::LightQuery(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, const LightSample &sample, const Vector3f &f, const float bsdf_pdf, ShadowQuery &query_o) const
+    {
+        const Triangle *tri = surface_point.GetHitTriangle();
+        const Vector3f &position = surface_point.GetPosition();
+        if (sample.delta)
+        {
+            if (f == Vector3f::O)
+            {
+                return false;
+            }
+            query_o = {position, sample.direction, sample.distance, tri, sample.target, f * sample.radiance, surface_point.GetTime()};
+            return true;
+        }
+        if (bsdf_pdf > 0.0f)
+        {
+            float weight = PowerHeuristic(sample.pdf, BouncePDF(state, ray_dir, surface_point, sample.direction, bsdf_pdf));
+            query_o = {position, sample.direction, sample.distance, tri, sample.target, weight * f * sample.radiance / sample.pdf, surface_point.GetTime()};
+            return true;
+        }
+        return false;
+    }
+
+    const bool PathTracingRenderer::Guided(const SurfacePoint &surface_point) const
+    {
+        if (!path_guiding || guiding.Empty())
+        {
+            return false;
+        }
+        const PrincipledBSDF *material = surface_point.GetMaterial();
+        return material->spec_trans == 0.0f && material->roughness >= kGuidingMinRoughness;
+    }
+
+    const bool PathTracingRenderer::SampleBounce(RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, Vector3f &direction_o, Vector3f &color_o, float &pdf_o) const
+    {
+        const PrincipledBSDF *material = surface_point.GetMaterial();
+        const Vector3f &position = surface_point.GetPosition();
+        if (!Guided(surface_point) || !guiding.Trained(position))
+        {
+            return material->Sample(-ray_dir, direction_o, color_o, pdf_o, state);
+        }
+
+        if (Random::Float() < guiding_fraction)
+        {
+            direction_o = guiding.Sample(position, state.ffnormal, pdf_o);
+        }
+        else if (!material->Sample(-ray_dir, direction_o, color_o, pdf_o, state))
+        {
+            return false;
+        }
+
+        // One-sample MIS over both strategies needs the whole BSDF and its pdf.
+        float eval_pdf;
+        color_o = material->Eval(state, -ray_dir, state.ffnormal, direction_o, eval_pdf);
+        pdf_o = BouncePDF(state, ray_dir, surface_point, direction_o, 0.0f);
+        return pdf_o > 0.0f && color_o != Vector3f::O;
+    }
+
+    void PathTracingRenderer::UpdateMedia(RayState &state, const bool leaving, const Vector3f &direction, const SurfacePoint &surface_point) const
+    {
+        // Reflections stay in the medium they came through. The surface itself tells the side, the shading normal may be perturbed past the bounce.
+        const Vector3f normal = leaving ? -surface_point.GetGeometricalNormal() : surface_point.GetGeometricalNormal();
+        if (Vector3f::Dot(direction, normal) >= 0.0f)
+        {
+            return;
+        }
+        const uint16_t material_id = surface_point.GetHitTriangle()->material_id;
+        if (leaving)
+        {
+            state.Leave(material_id);
+        }
+        else
+        {
+            state.Enter(surface_point.GetMaterial()->GetMedium(material_id));
+        }
+    }
+
+    const float PathTracingRenderer::BouncePDF(const RayState &state, const Vector3f &ray_dir, const SurfacePoint &surface_point, const Vector3f &direction, const float bsdf_pdf) const
+    {
+        const Vector3f &position = surface_point.GetPosition();
+        if (!Guided(surface_point) || !guiding.Trained(position))
+        {
+            return bsdf_pdf;
+        }
+        const float sample_pdf = surface_point.GetMaterial()->PDF(state, -ray_dir, state.ffnormal, direction);
+        return guiding_fraction * guiding.PDF(position, state.ffnormal, direction) + (1.0f - guiding_fraction) * sample_pdf;
+    }
+
+    const bool PathTracingRenderer::Unoccluded(const ShadowQuery &query) const
+    {
+        Vector3f occluder_hit;
+        float t, u, v;
+        const Triangle *occluder = render_context->bvh->Intersect(Ray(query.origin, query.direction, query.time), occluder_hit, t, u, v, query.exclude);
+        ++stats.Thread().shadow_rays;
+        return (occluder == nullptr) | (occluder == query.target) | (t >= query.distance);
+    }
+
+    WavefrontPathTracingRenderer::WavefrontPathTracingRenderer(RenderContext *render_context_, const int iteration_count_, const std::size_t batch_size_)
+        : PathTracingRenderer(render_context_, iteration_count_), batch_size(batch_size_)
+    {
+    }
+
+    void WavefrontPathTracingRenderer::PathStates::Resize(const std::size_t size, const std::size_t queries_per_path)
+    {
+        origin.resize(size);
+        direction.resize(size);
+        throughput.resize(size);
+        radiance.resize(size);
+        state.resize(size);
+        last_hit.resize(size);
+        last_bsdfpdf.resize(size);
+        depth.resize(size);
+        pixel.resize(size);
+        alive.resize(size);
+        rng.resize(size);
+        time.resize(size);
+        guiding_vertices.resize(size * kMaxDepth);
+        guiding_count.resize(size);
+        hit.resize(size);
+        hit_position.resize(size);
+        hit_u.resize(size);
+        hit_v.resize(size);
+        shadow_queries.resize(size * queries_per_path);
+        shadow_count.resize(size);
+    }
+
+    void WavefrontPathTracingRenderer::RenderIterations(const int first_iteration, const int count)
+    {
+        Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
+        float top, right;
+        PrepareScreenSpace(cam, top, right);
+
+        // One emitter sample plus one sample per analytic light.
+        queries_per_path = 1 + render_context->world->lights.size() + (render_context->world->environment != nullptr ? 1 : 0);
+
+        const std::size_t pixel_count = render_context->buffer_size.Area();
+        const std::size_t begin_path = pixel_count * std::size_t(first_iteration);
+        const std::size_t end_path = begin_path + pixel_count * std::size_t(count);
+
+        PathStates paths;
+        paths.Resize(std::min(batch_size, end_path - begin_path), queries_per_path);
+        std::vector<std::size_t> active;
+
+        for (std::size_t first_path = begin_path; first_path < end_path; first_path += batch_size)
+        {
+            const std::size_t path_count = std::min(batch_size, end_path - first_path);
+            Generate(paths, first_path, path_count, cam, top, right);
+
+            active.resize(path_count);
+            for (std::size_t i = 0; i < path_count; ++i)
+            {
+                active[i] = i;
+            }
+
+            while (!active.empty())
+            {
+                {
+                    RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kTrace));
+                    Extend(paths, active);
+                }
                 {
-                    ret += weight * f * emission_in * static_cast<float>(render_context->world->CountEmitters()) / lightpdf;
+                    RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kShade));
+                    Shade(paths, active);
                 }
+                {
+                    RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kTrace));
+                    Shadow(paths, active);
+                }
+
+                // Compact the surviving paths.
+                active.erase(std::remove_if(active.begin(), active.end(), [&paths](const std::size_t k) -> bool
+                                            { return !paths.alive[k]; }),
+                             active.end());
+            }
+
+            if (path_guiding)
+            {
+                Learn(paths, path_count);
             }
+            Accumulate(paths, path_count);
         }
+    }
 
-        return ret;
+    void WavefrontPathTracingRenderer::Generate(PathStates &paths, const std::size_t first_path, const std::size_t count, const Camera *cam, const float top, const float right) const
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Generate");
+        const std::size_t width = render_context->buffer_size.width;
+        const std::size_t pixel_count = render_context->buffer_size.Area();
+        const std::size_t frame_width = render_context->format_settings.resolution.width;
+        const bool motion = render_context->world->HasMotion();
+        const float pixel_spread = PixelSpread(top);
+
+#pragma omp parallel for
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            // Paths are ordered sample-major, so a batch sweeps the frame in scanline order.
+            const std::size_t pixel = (first_path + k) % pixel_count;
+            const std::size_t sample = (first_path + k) / pixel_count;
+            const int raster_x = int(pixel % width) + render_context->buffer_origin.x;
+            const int raster_y = int(pixel / width) + render_context->buffer_origin.y;
+
+            Random::Seed(seed, std::size_t(raster_y) * frame_width + std::size_t(raster_x), std::size_t(sample_offset) + sample);
+            // Same draw as the megakernel, so both renderers agree sample by sample.
+            paths.time[k] = motion ? Random::Float() : 0.0f;
+            paths.rng[k] = Random::Engine();
+            const Ray cast_ray = GenerateCameraRay(cam, top, right, raster_x, raster_y, paths.time[k]);
+
+            paths.origin[k] = cast_ray.src;
+            paths.direction[k] = cast_ray.direction;
+            paths.throughput[k] = Vector3f::White;
+            paths.radiance[k] = Vector3f::O;
+            paths.state[k] = RayState();
+            paths.state[k].cone_spread = pixel_spread;
+            paths.last_hit[k] = nullptr;
+            paths.last_bsdfpdf[k] = 0.0f;
+            paths.depth[k] = 0;
+            paths.pixel[k] = pixel;
+            paths.alive[k] = true;
+            paths.guiding_count[k] = 0;
+        }
+    }
+
+    void WavefrontPathTracingRenderer::Extend(PathStates &paths, std::vector<std::size_t> &active) const
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Extend");
+        // Group rays by direction octant so neighbouring threads walk similar parts of the tree.
+        auto octant = [&paths](const std::size_t k) -> int
+        {
+            const Vector3f &d = paths.direction[k];
+            return (d.x() < 0.0f ? 4 : 0) | (d.y() < 0.0f ? 2 : 0) | (d.z() < 0.0f ? 1 : 0);
+        };
+        std::stable_sort(active.begin(), active.end(), [&octant](const std::size_t a, const std::size_t b) -> bool
+                         { return octant(a) < octant(b); });
+
+#pragma omp parallel
+        {
+            RenderStats::ScopedTimer busy(stats.Thread().busy_seconds);
+#pragma omp for schedule(dynamic, 256) nowait
+            for (std::size_t i = 0; i < active.size(); ++i)
+            {
+                const std::size_t k = active[i];
+                float t;
+                paths.hit[k] = render_context->bvh->Intersect(Ray(paths.origin[k], paths.direction[k], paths.time[k]), paths.hit_position[k], t, paths.hit_u[k], paths.hit_v[k], paths.last_hit[k]);
+                RenderStats::Counters &counters = stats.Thread();
+                ++(paths.depth[k] == 0 ? counters.camera_rays : counters.bounce_rays);
+            }
+        }
+    }
+
+    void WavefrontPathTracingRenderer::Shade(PathStates &paths, std::vector<std::size_t> &active) const
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Shade");
+        // Group hits by material for coherent shading; escaped rays come first.
+        auto material = [&paths](const std::size_t k) -> uint32_t
+        {
+            return paths.hit[k] == nullptr ? 0 : uint32_t(paths.hit[k]->material_id) + 1;
+        };
+        std::stable_sort(active.begin(), active.end(), [&material](const std::size_t a, const std::size_t b) -> bool
+                         { return material(a) < material(b); });
+
+#pragma omp parallel
+        {
+            RenderStats::ScopedTimer busy(stats.Thread().busy_seconds);
+            // Reused across chunks to keep the stage free of allocations.
+            thread_local std::vector<LightSample> samples;
+            thread_local std::vector<std::size_t> sample_hits;
+#pragma omp for schedule(dynamic, 8) nowait
+            for (std::size_t first = 0; first < active.size(); first += kShadeChunk)
+            {
+                const std::size_t chunk = std::min(kShadeChunk, active.size() - first);
+                std::array<std::optional<SurfacePoint>, kShadeChunk> surface_points;
+                std::array<bool, kShadeChunk> leaving;
+                std::array<Vector3f, kShadeChunk> bounce_ratio;
+                samples.clear();
+                sample_hits.clear();
+
+                // Emission and light samples of every hit.
+                for (std::size_t j = 0; j < chunk; ++j)
+                {
+                    const std::size_t k = active[first + j];
+                    paths.shadow_count[k] = 0;
+                    paths.alive[k] = false;
+
+                    // Everything the path gathered at its previous bounce is in, close that bounce for learning.
+                    if (paths.guiding_count[k] > 0)
+                    {
+                        GuidingVertex &vertex = paths.guiding_vertices[k * kMaxDepth + paths.guiding_count[k] - 1];
+                        if (vertex.depth == paths.depth[k] - 1)
+                        {
+                            vertex.radiance = paths.radiance[k];
+                        }
+                    }
+
+                    const Vector3f ray_dir = paths.direction[k];
+                    if (paths.hit[k] == nullptr)
+                    {
+                        Vector3f emission = render_context->world->GetDefaultEmission(-ray_dir);
+                        const EnvironmentMap *environment = render_context->world->environment;
+                        if (paths.depth[k] > 0 && environment != nullptr)
+                        {
+                            emission = emission * PowerHeuristic(paths.last_bsdfpdf[k], environment->PDF(ray_dir));
+                        }
+                        paths.radiance[k] += paths.throughput[k] * emission;
+                        continue;
+                    }
+
+                    // Continue the random sequence of this path.
+                    Random::Engine() = paths.rng[k];
+
+                    RayState &state = paths.state[k];
+                    const Vector3f last_normal = state.ffnormal;
+                    SurfacePoint &surface_point = surface_points[j].emplace(paths.hit[k], paths.hit_position[k], paths.hit_u[k], paths.hit_v[k], paths.time[k], render_context->world->GetMaterial(paths.hit[k]->material_id));
+                    const float distance = (paths.hit_position[k] - paths.origin[k]).Length();
+                    state.Travel(distance);
+                    leaving[j] = Vector3f::Dot(ray_dir, surface_point.GetNormal()) > 0.0f;
+                    if (leaving[j])
+                    {
+                        state.eta = surface_point.GetMaterial()->ior / state.OuterIor(paths.hit[k]->material_id);
+                    }
+                    else
+                    {
+                        state.eta = state.OuterIor(paths.hit[k]->material_id) / surface_point.GetMaterial()->ior;
+                    }
+                    surface_point.ApplyTextures(ray_dir, state.cone_width, state.eta, stats.Thread().texture_misses);
+                    bounce_ratio[j] = state.Transmittance(distance);
+                    const Vector3f shading_normal = surface_point.GetShadingNormal();
+                    state.SetFrame(leaving[j] ? -shading_normal : shading_normal, surface_point.GetShadingTangent());
+
+                    float self_emission_pdf;
+                    auto self_emission = surface_point.GetEmission<true>(paths.origin[k], -ray_dir, self_emission_pdf);
+                    if (paths.depth[k] == 0)
+                    {
+                        paths.radiance[k] += paths.throughput[k] * self_emission;
+                    }
+                    else
+                    {
+                        self_emission_pdf *= render_context->world->EmitterPMF(paths.origin[k], last_normal, paths.hit[k]);
+                        paths.radiance[k] += paths.throughput[k] * PowerHeuristic(paths.last_bsdfpdf[k], self_emission_pdf) * self_emission;
+                    }
+
+                    SampleLights(state, surface_point, samples);
+                    sample_hits.resize(samples.size(), j);
+                    paths.rng[k] = Random::Engine();
+                }
+
+                // BSDF values towards the light samples, a batch per run of samples with the same material.
+                // Hits are sorted by material, textured ones have a material of their own.
+                BSDFBatch batch;
+                const PrincipledBSDF *batch_material = nullptr;
+                std::size_t batch_first = 0;
+                for (std::size_t i = 0; i <= samples.size(); ++i)
+                {
+                    const PrincipledBSDF *material = i < samples.size() ? surface_points[sample_hits[i]]->GetMaterial() : nullptr;
+                    if (batch.count > 0 && (material != batch_material || batch.Full()))
+                    {
+                        batch_material->EvalBatch(batch);
+                        for (std::size_t lane = 0; lane < batch.count; ++lane)
+                        {
+                            const std::size_t j = sample_hits[batch_first + lane];
+                            const std::size_t k = active[first + j];
+                            ShadowQuery query;
+                            if (LightQuery(paths.state[k], paths.direction[k], *surface_points[j], samples[batch_first + lane], batch.color[lane], batch.pdf[lane], query))
+                            {
+                                query.contribution = query.contribution * bounce_ratio[j] * paths.throughput[k];
+                                paths.shadow_queries[k * queries_per_path + paths.shadow_count[k]++] = query;
+                            }
+                        }
+                        batch.count = 0;
+                    }
+                    if (material == nullptr)
+                    {
+                        break;
+                    }
+                    if (batch.count == 0)
+                    {
+                        batch_material = material;
+                        batch_first = i;
+                    }
+                    const std::size_t k = active[first + sample_hits[i]];
+                    batch.Push(paths.state[k], -paths.direction[k], paths.state[k].ffnormal, samples[i].direction);
+                }
+
+                // Bounces, continuing the random sequences after the light samples.
+                for (std::size_t j = 0; j < chunk; ++j)
+                {
+                    if (!surface_points[j].has_value())
+                    {
+                        continue;
+                    }
+                    const std::size_t k = active[first + j];
+                    const SurfacePoint &surface_point = *surface_points[j];
+                    RayState &state = paths.state[k];
+                    Random::Engine() = paths.rng[k];
+
+                    Vector3f next_direction;
+                    Vector3f color;
+                    float bsdfpdf;
+                    const bool sampled = SampleBounce(state, paths.direction[k], surface_point, next_direction, color, bsdfpdf);
+                    paths.rng[k] = Random::Engine();
+                    if (sampled)
+                    {
+                        UpdateMedia(state, leaving[j], next_direction, surface_point);
+
+                        if (bsdfpdf > 0.0f && paths.depth[k] < kMaxDepth)
+                        {
+                            paths.throughput[k] = paths.throughput[k] * bounce_ratio[j] * color / bsdfpdf;
+                            if (Guided(surface_point))
+                            {
+                                paths.guiding_vertices[k * kMaxDepth + paths.guiding_count[k]++] = {surface_point.GetPosition(), next_direction, paths.throughput[k], Vector3f::O, bsdfpdf, paths.depth[k]};
+                            }
+                            paths.origin[k] = surface_point.GetPosition();
+                            paths.direction[k] = next_direction;
+                            paths.last_hit[k] = paths.hit[k];
+                            paths.last_bsdfpdf[k] = bsdfpdf;
+                            state.Scatter(bsdfpdf);
+                            ++paths.depth[k];
+                            paths.alive[k] = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void WavefrontPathTracingRenderer::Shadow(PathStates &paths, const std::vector<std::size_t> &active) const
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Shadow");
+#pragma omp parallel
+        {
+            RenderStats::ScopedTimer busy(stats.Thread().busy_seconds);
+#pragma omp for schedule(dynamic, 256) nowait
+            for (std::size_t i = 0; i < active.size(); ++i)
+            {
+                const std::size_t k = active[i];
+                for (std::size_t j = 0; j < paths.shadow_count[k]; ++j)
+                {
+                    const ShadowQuery &query = paths.shadow_queries[k * queries_per_path + j];
+                    if (Unoccluded(query))
+                    {
+                        paths.radiance[k] += query.contribution;
+                    }
+                }
+            }
+        }
+    }
+
+    void WavefrontPathTracingRenderer::Accumulate(const PathStates &paths, const std::size_t count)
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Accumulate");
+        // Paths k, k + pixel_count, ... of a batch belong to the same pixel. Give each pixel to one thread and add its samples in order.
+        const std::size_t width = render_context->buffer_size.width;
+        const std::size_t pixel_count = render_context->buffer_size.Area();
+#pragma omp parallel for
+        for (std::size_t j = 0; j < std::min(count, pixel_count); ++j)
+        {
+            Vector3d &sum = accumulation(paths.pixel[j] % width, paths.pixel[j] / width);
+            for (std::size_t k = j; k < count; k += pixel_count)
+            {
+                sum += Vector3d(paths.radiance[k].x(), paths.radiance[k].y(), paths.radiance[k].z());
+            }
+        }
+    }
+
+    void WavefrontPathTracingRenderer::Learn(const PathStates &paths, const std::size_t count)
+    {
+        TRACE_SCOPE("WavefrontPathTracingRenderer::Learn");
+#pragma omp parallel for
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            for (int j = 0; j < paths.guiding_count[k]; ++j)
+            {
+                const GuidingVertex &vertex = paths.guiding_vertices[k * kMaxDepth + j];
+                // Radiance gathered after the bounce, divided by the throughput it was gathered with.
+                const Vector3f gathered = paths.radiance[k] - vertex.radiance;
+                Vector3f incident;
+                for (int c = 0; c < 3; ++c)
+                {
+                    incident[c] = vertex.throughput[c] > 0.0f ? gathered[c] / vertex.throughput[c] : 0.0f;
+                }
+                guiding.Record(vertex.position, vertex.direction, Convert::Luma(incident) / vertex.pdf);
+            }
+        }
     }
 
     AlbedoRenderer::AlbedoRenderer(RenderContext *render_context_)
@@ -390,6 +1148,9 @@ namespace RenderToy
 
     void AlbedoRenderer::Render()
     {
+        BeginStats(1);
+        TRACE_SCOPE("AlbedoRenderer::Render");
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
         Camera *cam = &(render_context->world->cameras[render_context->camera_id]);
         float top, right;
         PrepareScreenSpace(cam, top, right);
@@ -398,12 +1159,12 @@ namespace RenderToy
         float div_resolution_height = 1.0f / float(render_context->format_settings.resolution.height);
 
 #pragma omp parallel for
-        for (int y = 0; y < render_context->format_settings.resolution.height; ++y)
+        for (int y = 0; y < render_context->buffer_size.height; ++y)
         {
-            for (int x = 0; x < render_context->format_settings.resolution.width; ++x)
+            for (int x = 0; x < render_context->buffer_size.width; ++x)
             {
-                // (x, y) is the point in Raster Space.
-                Vector2f NDC_coord = {float(x) * div_resolution_width, float(y) * div_resolution_height};
+                // (x, y) is the point in the buffer, buffer_origin offsets it into Raster Space.
+                Vector2f NDC_coord = {float(x + render_context->buffer_origin.x) * div_resolution_width, float(y + render_context->buffer_origin.y) * div_resolution_height};
                 Vector2f screen_coord = {2.0f * right * NDC_coord.x() - right, 2.0f * top * NDC_coord.y() - top};
 
                 // Blender convention: Camera directing towards -z.
@@ -413,14 +1174,15 @@ namespace RenderToy
                 float t, u, v;
                 Vector3f placeholder;
                 auto intersected = render_context->bvh->Intersect(cast_ray, placeholder, t, u, v, nullptr);
+                ++stats.Thread().camera_rays;
 
                 if (intersected != nullptr)
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = intersected->parent->tex->base_color;
+                    BUFFER(x, y, render_context->buffer_size.width) = render_context->world->GetMaterial(intersected->material_id)->base_color;
                 }
                 else
                 {
-                    BUFFER(x, y, render_context->format_settings.resolution.width) = Vector3f::O;
+                    BUFFER(x, y, render_context->buffer_size.width) = Vector3f::O;
                 }
             }
         }
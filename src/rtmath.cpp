@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <cmath>
 #include <immintrin.h>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <unordered_map>
 
 #include <RenderToy/rtmath.h>
 #include <RenderToy/pbr.h>
@@ -288,6 +292,56 @@ namespace RenderToy
         return 0.5f * (rs * rs + rp * rp);
     }
 
+    FresnelTable::FresnelTable(const float eta_)
+        : eta(eta_)
+    {
+        // Everything below the critical cosine is reflected, the table only spans the rest.
+        cos_critical = eta > 1.0f ? std::sqrt(1.0f - 1.0f / (eta * eta)) : 0.0f;
+        scale = float(kSize) / (1.0f - cos_critical);
+        cos_table = eta > 1.0f ? cos_critical + float(kExactBins) / scale : 0.0f;
+        for (std::size_t i = 0; i <= kSize; ++i)
+        {
+            values[i] = DielectricFresnel(std::min(cos_critical + float(i) / scale, 1.0f), eta);
+        }
+    }
+
+    const FresnelTable &FresnelTable::Get(const float eta)
+    {
+        // Materials look up the same few etas over and over.
+        thread_local const FresnelTable *last = nullptr;
+        if (last != nullptr && last->eta == eta)
+        {
+            return *last;
+        }
+
+        static std::mutex mutex;
+        static std::unordered_map<float, std::unique_ptr<FresnelTable>> tables;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &table = tables[eta];
+        if (!table)
+        {
+            table = std::make_unique<FresnelTable>(eta);
+        }
+        last = table.get();
+        return *table;
+    }
+
+    const float FresnelTable::Eval(const float cos_theta_i) const
+    {
+        if (!(cos_theta_i >= cos_table))
+        {
+            return DielectricFresnel(cos_theta_i, eta);
+        }
+        const float x = (std::min(cos_theta_i, 1.0f) - cos_critical) * scale;
+        const std::size_t i = std::min(std::size_t(x), kSize - 1);
+        return Lerp(values[i], values[i + 1], x - float(i));
+    }
+
+    const float FresnelTable::Eta() const
+    {
+        return eta;
+    }
+
     const Vector3f CosineSampleHemisphere(const float r1, const float r2)
     {
         Vector3f dir;
@@ -352,7 +406,38 @@ namespace RenderToy
             return eta * incident_vec - (eta * N_dot_I + sqrtf(k)) * normal;
     }
 
-    static std::mt19937 random_device;
+    Random::PCG32::PCG32(const uint64_t seed, const uint64_t stream)
+    {
+        Seed(seed, stream);
+    }
+
+    void Random::PCG32::Seed(const uint64_t seed, const uint64_t stream)
+    {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        (*this)();
+        state += seed;
+        (*this)();
+    }
+
+    Random::PCG32::result_type Random::PCG32::operator()()
+    {
+        const uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + inc;
+        const uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+        const uint32_t rot = uint32_t(old_state >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31u));
+    }
+
+    // SplitMix64 finalizer, spreads neighbouring pixel and sample indices over the whole state space.
+    static const uint64_t MixBits(uint64_t v)
+    {
+        v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+        return v ^ (v >> 31);
+    }
+
+    static thread_local Random::PCG32 random_device;
 
     /// @brief Generates an int between min and max.
     /// @param min
@@ -368,8 +453,18 @@ namespace RenderToy
     /// @return
     const float Random::Float()
     {
-        std::uniform_real_distribution<float> distrib(0.0f, 1.0f);
-        return distrib(random_device);
+        // 24 random bits fill the mantissa exactly, the result is in [0, 1).
+        return float(random_device() >> 8) * 0x1p-24f;
+    }
+
+    void Random::Seed(const uint64_t seed, const uint64_t pixel, const uint64_t sample)
+    {
+        random_device.Seed(MixBits(seed ^ MixBits(pixel)), MixBits(sample + 0x9e3779b97f4a7c15ULL * (seed + 1)));
+    }
+
+    Random::PCG32 &Random::Engine()
+    {
+        return random_device;
     }
 
     const bool SizeN::operator==(const SizeN &a) const
@@ -0,0 +1,136 @@
+#include <RenderToy/sequence.h>
+#include <RenderToy/exporter.h>
+
+#include <fstream>
+#include <memory>
+
+namespace RenderToy
+{
+    SequenceRenderer::SequenceRenderer(World *world_, const FormatSettings &format_settings_, const int iteration_count_)
+        : render_context(world_, format_settings_), iteration_count(iteration_count_), renderer(&render_context, iteration_count_)
+    {
+    }
+
+    SequenceRenderer::~SequenceRenderer()
+    {
+        // Never leave a write running on a frame buffer we are about to free.
+        for (auto &write : pending_writes)
+        {
+            if (write.valid())
+            {
+                write.wait();
+            }
+        }
+    }
+
+    void SequenceRenderer::Render(const int first_frame, const int last_frame)
+    {
+        for (int frame = first_frame; frame <= last_frame; ++frame)
+        {
+            SetFrame(frame);
+
+            renderer.Reset();
+            renderer.seed = seed + uint64_t(frame);
+            renderer.Render();
+
+            // Writes must not pile up if the disk is slower than the renderer.
+            if (pending_writes.size() >= 2)
+            {
+                pending_writes.front().get();
+                pending_writes.erase(pending_writes.begin());
+            }
+
+            auto image = std::make_shared<Image>(&render_context);
+            const std::string path = FramePath(frame);
+            pending_writes.push_back(std::async(std::launch::async, [image, path, post = post_process]() -> void
+                                                {
+                if (post)
+                {
+                    post(*image);
+                }
+                std::ofstream os(path, std::ios::binary);
+                if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".ppm") == 0)
+                {
+                    PPMExporter(*image).Export(os);
+                }
+                else
+                {
+                    BMPExporter(*image).Export(os);
+                } }));
+        }
+        Flush();
+    }
+
+    const std::string SequenceRenderer::FramePath(const int frame) const
+    {
+        const std::size_t begin = output_path.find('#');
+        if (begin == std::string::npos)
+        {
+            return output_path + std::to_string(frame);
+        }
+        std::size_t end = begin;
+        while (end < output_path.size() && output_path[end] == '#')
+        {
+            ++end;
+        }
+        std::string number = std::to_string(frame);
+        if (number.size() < end - begin)
+        {
+            number.insert(0, end - begin - number.size(), '0');
+        }
+        return output_path.substr(0, begin) + number + output_path.substr(end);
+    }
+
+    const int SequenceRenderer::RebuildCount() const
+    {
+        return rebuild_count;
+    }
+
+    void SequenceRenderer::SetFrame(const int frame)
+    {
+        World *world = render_context.world;
+        const float shutter_open = float(frame) - 0.5f * shutter;
+        const float shutter_close = float(frame) + 0.5f * shutter;
+        if (!camera_track.Empty())
+        {
+            world->cameras[render_context.camera_id].SetO2W(camera_track.Evaluate(shutter_open).O2W(), camera_track.Evaluate(shutter_close).O2W());
+        }
+
+        bool moved = false;
+        for (auto &[mesh, track] : mesh_tracks)
+        {
+            const Matrix4x4f o2w = track.Evaluate(shutter_open).O2W();
+            const Matrix4x4f o2w_close = track.Evaluate(shutter_close).O2W();
+            if (o2w != mesh->GetO2W() || o2w_close != mesh->GetO2WClose())
+            {
+                mesh->SetO2W(o2w, o2w_close);
+                moved = true;
+            }
+        }
+        if (!moved)
+        {
+            return;
+        }
+
+        {
+            RenderStats::ScopedTimer timer(render_context.build_seconds);
+            render_context.bvh->Refit();
+            if (render_context.bvh->Degradation() > rebuild_threshold)
+            {
+                render_context.bvh->Rebuild();
+                ++rebuild_count;
+            }
+        }
+        // Emitter sampling depends on triangle positions and areas.
+        world->PrepareDirectLightSampling();
+    }
+
+    void SequenceRenderer::Flush()
+    {
+        for (auto &write : pending_writes)
+        {
+            write.get();
+        }
+        pending_writes.clear();
+    }
+}
@@ -0,0 +1,123 @@
+#include <RenderToy/stats.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace RenderToy
+{
+    static constexpr const char *kPhaseNames[] = {"build", "trace", "shade", "export", "render"};
+
+    RenderStats::ScopedTimer::ScopedTimer(double &seconds_)
+        : seconds(seconds_), begin(std::chrono::steady_clock::now())
+    {
+    }
+
+    RenderStats::ScopedTimer::~ScopedTimer()
+    {
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    RenderStats::RenderStats()
+    {
+        Reset();
+    }
+
+    void RenderStats::Reset()
+    {
+        pixels = 0;
+        samples = 0;
+#ifdef _OPENMP
+        threads.assign(std::size_t(omp_get_max_threads()), Counters());
+#else
+        threads.assign(1, Counters());
+#endif
+        for (auto &s : seconds)
+        {
+            s = 0.0;
+        }
+    }
+
+    RenderStats::Counters &RenderStats::Thread()
+    {
+#ifdef _OPENMP
+        return threads[std::size_t(omp_get_thread_num())];
+#else
+        return threads[0];
+#endif
+    }
+
+    double &RenderStats::Seconds(const Phase phase)
+    {
+        return seconds[std::size_t(phase)];
+    }
+
+    const double RenderStats::Seconds(const Phase phase) const
+    {
+        return seconds[std::size_t(phase)];
+    }
+
+    const RenderStats::Counters RenderStats::Total() const
+    {
+        Counters ret;
+        for (const auto &thread : threads)
+        {
+            ret.camera_rays += thread.camera_rays;
+            ret.bounce_rays += thread.bounce_rays;
+            ret.shadow_rays += thread.shadow_rays;
+            ret.texture_misses += thread.texture_misses;
+            ret.busy_seconds += thread.busy_seconds;
+        }
+        return ret;
+    }
+
+    const std::size_t RenderStats::ThreadCount() const
+    {
+        return threads.size();
+    }
+
+    const double RenderStats::Utilization(const std::size_t thread) const
+    {
+        const double render_seconds = Seconds(Phase::kRender);
+        return render_seconds > 0.0 ? threads[thread].busy_seconds / render_seconds : 0.0;
+    }
+
+    const double RenderStats::RaysPerSecond() const
+    {
+        const Counters total = Total();
+        const double render_seconds = Seconds(Phase::kRender);
+        return render_seconds > 0.0 ? double(total.camera_rays + total.bounce_rays + total.shadow_rays) / render_seconds : 0.0;
+    }
+
+    const double RenderStats::SamplesPerPixel() const
+    {
+        return pixels > 0 ? double(samples) / double(pixels) : 0.0;
+    }
+
+    void RenderStats::ExportJSON(std::ostream &os) const
+    {
+        const Counters total = Total();
+        os << "{\n";
+        os << "  \"threads\": " << threads.size() << ",\n";
+        os << "  \"pixels\": " << pixels << ",\n";
+        os << "  \"samples\": " << samples << ",\n";
+        os << "  \"samples_per_pixel\": " << SamplesPerPixel() << ",\n";
+        os << "  \"rays\": {\"camera\": " << total.camera_rays << ", \"bounce\": " << total.bounce_rays << ", \"shadow\": " << total.shadow_rays
+           << ", \"total\": " << total.camera_rays + total.bounce_rays + total.shadow_rays << "},\n";
+        os << "  \"rays_per_second\": " << RaysPerSecond() << ",\n";
+        os << "  \"texture_misses\": " << total.texture_misses << ",\n";
+        os << "  \"seconds\": {";
+        for (std::size_t p = 0; p < std::size_t(Phase::kCount); ++p)
+        {
+            os << (p > 0 ? ", " : "") << '"' << kPhaseNames[p] << "\": " << seconds[p];
+        }
+        os << "},\n";
+        os << "  \"thread_utilization\": [";
+        for (std::size_t t = 0; t < threads.size(); ++t)
+        {
+            os << (t > 0 ? ", " : "") << Utilization(t);
+        }
+        os << "]\n";
+        os << "}\n";
+    }
+}
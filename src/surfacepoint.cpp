@@ -1,12 +1,19 @@
 #include <RenderToy/surfacepoint.h>
 #include <RenderToy/object.h>
 
+#include <algorithm>
 #include <cmath>
 
 namespace RenderToy
 {
-    SurfacePoint::SurfacePoint(const Triangle *triangle_, const Vector3f &position_, const float u_, const float v_)
-        : triangle(triangle_), position(position_), u(u_), v(v_)
+    static constexpr float kMinFootprintCos = 0.05f;
+    // Shortest step of the bump map slope, in UV units.
+    static constexpr float kMinBumpDelta = 1.0f / 4096.0f;
+    // Shorter projected tangents are too close to the normal to orient a map by.
+    static constexpr float kMinTangentLength = 1e-4f;
+
+    SurfacePoint::SurfacePoint(const Triangle *triangle_, const Vector3f &position_, const float u_, const float v_, const float time_, const PrincipledBSDF *material_)
+        : triangle(triangle_), material(material_ != nullptr || triangle_ == nullptr ? material_ : triangle_->parent->tex), position(position_), u(u_), v(v_), time(time_)
     {
     }
 
@@ -37,16 +44,120 @@ namespace RenderToy
 
     const PrincipledBSDF *SurfacePoint::GetMaterial() const
     {
-        return triangle->parent->tex;
+        return textured_material.has_value() ? &*textured_material : material;
+    }
+
+    void SurfacePoint::ApplyTextures(const Vector3f &direction, const float width, const float eta, uint64_t &misses)
+    {
+        if (material == nullptr || !(material->Textured() || material->Perturbed()))
+        {
+            return;
+        }
+
+        // Scale the cone width into UV units by the ratio of texture to surface area of the triangle.
+        float footprint = 0.0f, uv_per_world = 0.0f;
+        const float area = triangle->AreaC(time);
+        if (area > 0.0f)
+        {
+            const Vector2f e1 = triangle->uv[1] - triangle->uv[0];
+            const Vector2f e2 = triangle->uv[2] - triangle->uv[0];
+            const float uv_area = 0.5f * std::abs(e1.x() * e2.y() - e1.y() * e2.x());
+            uv_per_world = std::sqrt(uv_area / area);
+        }
+        if (width > 0.0f)
+        {
+            // Grazing hits stretch the footprint, bounded so they do not fall through to the coarsest level.
+            const float cos_theta = std::max(std::abs(direction.Dot(GetGeometricalNormal())), kMinFootprintCos);
+            footprint = width / cos_theta * uv_per_world;
+        }
+
+        const Vector2f uv = GetUV();
+        if (material->Perturbed())
+        {
+            Perturb(uv, footprint, uv_per_world, misses);
+        }
+        if (material->Textured())
+        {
+            textured_material.emplace();
+            textured_material->ApplyTextures(*material, uv, footprint, eta, misses);
+        }
+    }
+
+    void SurfacePoint::Perturb(const Vector2f &uv, const float footprint, const float uv_per_world, uint64_t &misses)
+    {
+        const Vector3f N = GetNormal();
+        const Vector3f tangent = GetTangent();
+        const Vector3f projected = tangent - N * N.Dot(tangent);
+        if (!(projected.Length() > kMinTangentLength))
+        {
+            // Without tangents there is nothing to orient the map by.
+            return;
+        }
+        const Vector3f T = projected.Normalized();
+        const Vector3f B = N.Cross(T) * triangle->tangent_sign;
+
+        Vector3f normal;
+        if (material->normal_texture != nullptr)
+        {
+            const ITexture *map = material->normal_texture;
+            const Vector3f c = map->Sample(uv, map->Level(footprint), misses) * 2.0f - Vector3f(1.0f);
+            normal = c.x() * T + c.y() * B + c.z() * N;
+        }
+        else
+        {
+            // Forward differences across the footprint, so the slope is filtered like the heights.
+            const ITexture *map = material->bump_texture;
+            const float delta = std::max(footprint, kMinBumpDelta);
+            const float lod = map->Level(delta);
+            const float height = map->Sample(uv, lod, misses).x();
+            const float slope_u = (map->Sample(uv + Vector2f(delta, 0.0f), lod, misses).x() - height) / delta;
+            const float slope_v = (map->Sample(uv + Vector2f(0.0f, delta), lod, misses).x() - height) / delta;
+            // Heights are in world units, steps in UV units.
+            const float scale = material->bump_scale * uv_per_world;
+            normal = N - (slope_u * T + slope_v * B) * scale;
+        }
+
+        // Maps pointing below the surface are ignored.
+        if (normal.Dot(N) > 0.0f)
+        {
+            shading_normal = normal.Normalized();
+            shading_tangent = T;
+            perturbed = true;
+        }
+    }
+
+    const Vector2f SurfacePoint::GetUV() const
+    {
+        return (1 - u - v) * triangle->uv[0] + u * triangle->uv[1] + v * triangle->uv[2];
     }
 
     const Vector3f SurfacePoint::GetNormal() const
     {
-        return triangle->NormalC(u, v);
+        return triangle->NormalC(u, v, time);
+    }
+
+    const Vector3f SurfacePoint::GetShadingNormal() const
+    {
+        return perturbed ? shading_normal : GetNormal();
+    }
+
+    const Vector3f SurfacePoint::GetShadingTangent() const
+    {
+        return perturbed ? shading_tangent : Vector3f::O;
+    }
+
+    const Vector3f SurfacePoint::GetTangent() const
+    {
+        return triangle->TangentC(u, v, time);
     }
     
     const Vector3f SurfacePoint::GetGeometricalNormal() const
     {
-        return triangle->GeometricalNormalC();
+        return triangle->GeometricalNormalC(time);
+    }
+
+    const float SurfacePoint::GetTime() const
+    {
+        return time;
     }
 }
\ No newline at end of file
@@ -0,0 +1,375 @@
+#include <RenderToy/texture.h>
+#include <RenderToy/exception.h>
+#include <RenderToy/trace.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace RenderToy
+{
+    // Layout of cache keys, from the most significant bits: texture id, level, tile row, tile column.
+    static constexpr int kTileBits = 17;
+    static constexpr int kLevelBits = 5;
+    static constexpr std::size_t kTileBytes = sizeof(TileCache::Tile);
+
+    static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Tiles are paged as packed floats.");
+
+    static std::atomic<uint64_t> next_texture_id = 0;
+
+    static const long Wrap(const long x, const long size)
+    {
+        const long r = x % size;
+        return r < 0 ? r + size : r;
+    }
+
+    static const bool WriteAll(const int fd, const void *data, std::size_t size)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            const ssize_t n = write(fd, ptr, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            ptr += n;
+            size -= std::size_t(n);
+        }
+        return true;
+    }
+
+    // pread() does not move the file offset, so threads can share fd.
+    static const bool ReadAllAt(const int fd, void *data, std::size_t size, uint64_t offset)
+    {
+        char *ptr = static_cast<char *>(data);
+        while (size > 0)
+        {
+            const ssize_t n = pread(fd, ptr, size, off_t(offset));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            ptr += n;
+            size -= std::size_t(n);
+            offset += uint64_t(n);
+        }
+        return true;
+    }
+
+    TileCache::TileCache(const std::size_t capacity_)
+        : shard_capacity(std::max((capacity_ + kShards - 1) / kShards, std::size_t(1)))
+    {
+    }
+
+    const std::shared_ptr<const TileCache::Tile> TileCache::Find(const uint64_t key)
+    {
+        Shard &shard = shards[ShardOf(key)];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return it->second->second;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    const std::shared_ptr<const TileCache::Tile> TileCache::Insert(const uint64_t key, std::shared_ptr<const Tile> tile)
+    {
+        Shard &shard = shards[ShardOf(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+        shard.lru.emplace_front(key, std::move(tile));
+        shard.index.emplace(key, shard.lru.begin());
+        shard.Evict(shard_capacity.load(std::memory_order_relaxed));
+        return shard.lru.front().second;
+    }
+
+    void TileCache::Clear()
+    {
+        for (auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.Evict(0);
+        }
+    }
+
+    void TileCache::SetCapacity(const std::size_t capacity_)
+    {
+        const std::size_t capacity = std::max((capacity_ + kShards - 1) / kShards, std::size_t(1));
+        shard_capacity.store(capacity, std::memory_order_relaxed);
+        for (auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.Evict(capacity);
+        }
+    }
+
+    const std::size_t TileCache::Capacity() const
+    {
+        return shard_capacity.load(std::memory_order_relaxed) * kShards;
+    }
+
+    const std::size_t TileCache::Size() const
+    {
+        std::size_t size = 0;
+        for (const auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            size += shard.lru.size();
+        }
+        return size;
+    }
+
+    const uint64_t TileCache::Misses() const
+    {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+    TileCache &TileCache::Global()
+    {
+        static TileCache cache;
+        return cache;
+    }
+
+    void TileCache::Shard::Evict(const std::size_t capacity)
+    {
+        while (lru.size() > capacity)
+        {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+
+    const std::size_t TileCache::ShardOf(const uint64_t key)
+    {
+        // Fibonacci hashing, neighbouring tiles land in different shards.
+        return std::size_t((key * 0x9E3779B97F4A7C15ull) >> 60) % kShards;
+    }
+
+    TiledTexture::TiledTexture(const SizeN &resolution_, TileCache *cache_)
+        : cache(cache_), id(next_texture_id.fetch_add(1, std::memory_order_relaxed))
+    {
+        if (resolution_.Area() == 0)
+        {
+            throw Exception::InvalidImageException("Texture is empty.");
+        }
+        if (std::max(resolution_.width, resolution_.height) > (std::size_t(1) << kTileBits) * TileCache::kTileSize)
+        {
+            throw Exception::InvalidImageException("Texture is too large.");
+        }
+
+        SizeN resolution = resolution_;
+        while (true)
+        {
+            const std::size_t tiles_x = (resolution.width + TileCache::kTileSize - 1) / TileCache::kTileSize;
+            const std::size_t tiles_y = (resolution.height + TileCache::kTileSize - 1) / TileCache::kTileSize;
+            levels.push_back({resolution, tiles_x, tile_count});
+            tile_count += tiles_x * tiles_y;
+            if ((resolution.width == 1 && resolution.height == 1) || levels.size() == (std::size_t(1) << kLevelBits))
+            {
+                break;
+            }
+            resolution = SizeN(std::max(resolution.width / 2, std::size_t(1)), std::max(resolution.height / 2, std::size_t(1)));
+        }
+    }
+
+    const Vector3f TiledTexture::Sample(const Vector2f &uv, const float lod, uint64_t &misses) const
+    {
+        const float level = std::clamp(lod, 0.0f, float(levels.size() - 1));
+        const std::size_t level0 = std::size_t(level);
+        const float t = level - float(level0);
+        const Vector3f value = Bilinear(level0, uv, misses);
+        if (t == 0.0f)
+        {
+            return value;
+        }
+        return value * (1.0f - t) + Bilinear(level0 + 1, uv, misses) * t;
+    }
+
+    const float TiledTexture::Level(const float footprint) const
+    {
+        const float texels = footprint * float(std::max(levels[0].resolution.width, levels[0].resolution.height));
+        return texels > 1.0f ? std::min(std::log2(texels), float(levels.size() - 1)) : 0.0f;
+    }
+
+    const Vector3f TiledTexture::Texel(const std::size_t level, const long x, const long y, uint64_t &misses) const
+    {
+        const SizeN &resolution = levels[level].resolution;
+        const std::size_t wx = std::size_t(Wrap(x, long(resolution.width)));
+        const std::size_t wy = std::size_t(Wrap(y, long(resolution.height)));
+        const auto tile = GetTile(level, wx / TileCache::kTileSize, wy / TileCache::kTileSize, misses);
+        return tile->texels[(wy % TileCache::kTileSize) * TileCache::kTileSize + wx % TileCache::kTileSize];
+    }
+
+    const std::size_t TiledTexture::LevelCount() const
+    {
+        return levels.size();
+    }
+
+    const SizeN &TiledTexture::Resolution(const std::size_t level) const
+    {
+        return levels[level].resolution;
+    }
+
+    void TiledTexture::Invalidate()
+    {
+        id = next_texture_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const std::size_t TiledTexture::TileIndex(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y) const
+    {
+        return levels[level].first_tile + tile_y * levels[level].tiles_x + tile_x;
+    }
+
+    const Vector3f TiledTexture::Bilinear(const std::size_t level, const Vector2f &uv, uint64_t &misses) const
+    {
+        const SizeN &resolution = levels[level].resolution;
+        // Texel centers sit at half integers.
+        const float x = (uv.x() - std::floor(uv.x())) * float(resolution.width) - 0.5f;
+        const float y = (std::ceil(uv.y()) - uv.y()) * float(resolution.height) - 0.5f;
+        const float fx0 = std::floor(x), fy0 = std::floor(y);
+        const float dx = x - fx0, dy = y - fy0;
+        const long x0 = long(fx0), y0 = long(fy0);
+
+        // The four texels usually share a tile, look it up once.
+        const long tile_size = long(TileCache::kTileSize);
+        const long wx0 = Wrap(x0, long(resolution.width)), wy0 = Wrap(y0, long(resolution.height));
+        const long wx1 = Wrap(x0 + 1, long(resolution.width)), wy1 = Wrap(y0 + 1, long(resolution.height));
+        if (wx0 / tile_size == wx1 / tile_size && wy0 / tile_size == wy1 / tile_size)
+        {
+            const auto tile = GetTile(level, std::size_t(wx0 / tile_size), std::size_t(wy0 / tile_size), misses);
+            auto At = [&tile, tile_size](const long tx, const long ty) -> const Vector3f &
+            { return tile->texels[(ty % tile_size) * tile_size + tx % tile_size]; };
+            return (At(wx0, wy0) * (1.0f - dx) + At(wx1, wy0) * dx) * (1.0f - dy) + (At(wx0, wy1) * (1.0f - dx) + At(wx1, wy1) * dx) * dy;
+        }
+        return (Texel(level, x0, y0, misses) * (1.0f - dx) + Texel(level, x0 + 1, y0, misses) * dx) * (1.0f - dy) +
+               (Texel(level, x0, y0 + 1, misses) * (1.0f - dx) + Texel(level, x0 + 1, y0 + 1, misses) * dx) * dy;
+    }
+
+    const std::shared_ptr<const TileCache::Tile> TiledTexture::GetTile(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, uint64_t &misses) const
+    {
+        const uint64_t key = (id << (kLevelBits + 2 * kTileBits)) | (uint64_t(level) << (2 * kTileBits)) | (uint64_t(tile_y) << kTileBits) | uint64_t(tile_x);
+        std::shared_ptr<const TileCache::Tile> tile = cache->Find(key);
+        if (tile != nullptr)
+        {
+            return tile;
+        }
+
+        ++misses;
+        auto loaded = std::make_shared<TileCache::Tile>();
+        if (!Load(level, tile_x, tile_y, *loaded))
+        {
+            // Never leaves a half loaded tile in the cache.
+            std::fill(std::begin(loaded->texels), std::end(loaded->texels), Vector3f(1.0f, 0.0f, 1.0f));
+            return loaded;
+        }
+        return cache->Insert(key, std::move(loaded));
+    }
+
+    ImageTexture::ImageTexture(const std::vector<Vector3f> &texels, const SizeN &resolution_, TileCache *cache_)
+        : TiledTexture(resolution_, cache_)
+    {
+        TRACE_SCOPE("ImageTexture::ImageTexture");
+        if (texels.size() < resolution_.Area())
+        {
+            throw Exception::InvalidImageException("Texture is smaller than its resolution.");
+        }
+
+        const std::string pattern = (std::filesystem::temp_directory_path() / "rendertoy-texture-XXXXXX").string();
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        fd = mkstemp(path.data());
+        if (fd < 0)
+        {
+            throw Exception::InvalidImageException("Failed to create a tile file.");
+        }
+        // The file is removed as soon as it is closed, even if the process dies.
+        unlink(path.data());
+
+        // Box filtered pyramid. Only the level being written and the next one are held in memory.
+        std::vector<Vector3f> level_texels(texels.begin(), texels.begin() + long(resolution_.Area()));
+        auto tile = std::make_unique<TileCache::Tile>();
+        for (std::size_t level = 0; level < LevelCount(); ++level)
+        {
+            const SizeN &resolution = Resolution(level);
+            const std::size_t tiles_x = (resolution.width + TileCache::kTileSize - 1) / TileCache::kTileSize;
+            const std::size_t tiles_y = (resolution.height + TileCache::kTileSize - 1) / TileCache::kTileSize;
+            for (std::size_t ty = 0; ty < tiles_y; ++ty)
+            {
+                for (std::size_t tx = 0; tx < tiles_x; ++tx)
+                {
+                    // Texels past the border repeat the last row and column.
+                    for (std::size_t y = 0; y < TileCache::kTileSize; ++y)
+                    {
+                        const std::size_t sy = std::min(ty * TileCache::kTileSize + y, resolution.height - 1);
+                        for (std::size_t x = 0; x < TileCache::kTileSize; ++x)
+                        {
+                            const std::size_t sx = std::min(tx * TileCache::kTileSize + x, resolution.width - 1);
+                            tile->texels[y * TileCache::kTileSize + x] = level_texels[sy * resolution.width + sx];
+                        }
+                    }
+                    if (!WriteAll(fd, tile.get(), kTileBytes))
+                    {
+                        close(fd);
+                        throw Exception::InvalidImageException("Failed to page out a texture.");
+                    }
+                }
+            }
+
+            if (level + 1 == LevelCount())
+            {
+                break;
+            }
+            const SizeN &next = Resolution(level + 1);
+            std::vector<Vector3f> next_texels(next.Area());
+            for (std::size_t y = 0; y < next.height; ++y)
+            {
+                const std::size_t y0 = std::min(2 * y, resolution.height - 1), y1 = std::min(2 * y + 1, resolution.height - 1);
+                for (std::size_t x = 0; x < next.width; ++x)
+                {
+                    const std::size_t x0 = std::min(2 * x, resolution.width - 1), x1 = std::min(2 * x + 1, resolution.width - 1);
+                    next_texels[y * next.width + x] = (level_texels[y0 * resolution.width + x0] + level_texels[y0 * resolution.width + x1] +
+                                                       level_texels[y1 * resolution.width + x0] + level_texels[y1 * resolution.width + x1]) *
+                                                      0.25f;
+                }
+            }
+            level_texels.swap(next_texels);
+        }
+    }
+
+    ImageTexture::~ImageTexture()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    const bool ImageTexture::Load(const std::size_t level, const std::size_t tile_x, const std::size_t tile_y, TileCache::Tile &tile) const
+    {
+        return ReadAllAt(fd, &tile, kTileBytes, uint64_t(TileIndex(level, tile_x, tile_y)) * kTileBytes);
+    }
+}
@@ -0,0 +1,108 @@
+#include <RenderToy/trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RenderToy::Trace
+{
+    struct Event
+    {
+        const char *name;
+        int64_t begin;
+        int64_t duration;
+    };
+
+    struct ThreadRing
+    {
+        int tid;
+        std::vector<Event> events;
+        /// @brief Events ever recorded, the next one goes to events[recorded % kRingCapacity].
+        std::size_t recorded = 0;
+    };
+
+    // Rings are shared with the registry, so events of finished threads can still be written.
+    static std::mutex registry_mutex;
+    static std::vector<std::shared_ptr<ThreadRing>> registry;
+
+    static const int64_t Now()
+    {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    static ThreadRing &Ring()
+    {
+        thread_local std::shared_ptr<ThreadRing> ring;
+        if (ring == nullptr)
+        {
+            ring = std::make_shared<ThreadRing>();
+            ring->events.resize(kRingCapacity);
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            ring->tid = int(registry.size());
+            registry.push_back(ring);
+        }
+        return *ring;
+    }
+
+    Scope::Scope(const char *name_)
+        : name(name_), begin(Now())
+    {
+    }
+
+    Scope::~Scope()
+    {
+        ThreadRing &ring = Ring();
+        ring.events[ring.recorded % kRingCapacity] = {name, begin, Now() - begin};
+        ++ring.recorded;
+    }
+
+    const bool Enabled()
+    {
+#ifdef RENDERTOY_ENABLE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void Write(std::ostream &os)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        const auto flags = os.flags();
+        const auto precision = os.precision();
+        // Timestamps are in microseconds, keep nanoseconds however long the process runs.
+        os << std::fixed << std::setprecision(3);
+        os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        for (const auto &ring : registry)
+        {
+            os << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << ring->tid
+               << ", \"args\": {\"name\": \"thread " << ring->tid << "\"}}";
+            first = false;
+
+            const std::size_t count = std::min(ring->recorded, kRingCapacity);
+            for (std::size_t i = ring->recorded - count; i < ring->recorded; ++i)
+            {
+                const Event &event = ring->events[i % kRingCapacity];
+                os << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"rendertoy\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << ring->tid
+                   << ", \"ts\": " << double(event.begin) * 1e-3 << ", \"dur\": " << double(event.duration) * 1e-3 << "}";
+            }
+        }
+        os << "\n]}\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto &ring : registry)
+        {
+            ring->recorded = 0;
+        }
+    }
+}
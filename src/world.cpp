@@ -1,21 +1,91 @@
 #include <RenderToy/world.h>
+#include <RenderToy/exception.h>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
-void RenderToy::World::SampleEmitter(Vector3f &position_o, const Triangle *&id_o) const
+void RenderToy::World::SampleEmitter(Vector3f &position_o, const Triangle *&id_o, float &pmf_o, const float time) const
 {
     if (!emissive_triangles.empty())
     {
-        id_o = emissive_triangles[Random::Int(0, emissive_triangles.size()-1)];
-        position_o = id_o->GetSamplePoint();
+        id_o = emissive_triangles[emitter_distribution.Sample(Random::Float(), pmf_o)];
+        position_o = id_o->GetSamplePoint(time);
     }
     else
     {
         position_o = Vector3f::O;
         id_o = nullptr;
+        pmf_o = 0.0f;
     }
 }
 
+const float RenderToy::World::EmitterPMF(const Triangle *triangle) const
+{
+    auto it = emitter_index.find(triangle);
+    if (it == emitter_index.end())
+    {
+        return 0.0f;
+    }
+    return emitter_distribution.PMF(it->second);
+}
+
+void RenderToy::World::SampleEmitter(const Vector3f &position, const Vector3f &normal, Vector3f &position_o, const Triangle *&id_o, float &pmf_o, const float time) const
+{
+    if (emitter_sampling == EmitterSampling::kPower)
+    {
+        SampleEmitter(position_o, id_o, pmf_o, time);
+        return;
+    }
+
+    std::size_t index;
+    if (emitter_hierarchy.Sample(position, normal, Random::Float(), index, pmf_o))
+    {
+        id_o = emissive_triangles[index];
+        position_o = id_o->GetSamplePoint(time);
+    }
+    else
+    {
+        position_o = Vector3f::O;
+        id_o = nullptr;
+        pmf_o = 0.0f;
+    }
+}
+
+const float RenderToy::World::EmitterPMF(const Vector3f &position, const Vector3f &normal, const Triangle *triangle) const
+{
+    if (emitter_sampling == EmitterSampling::kPower)
+    {
+        return EmitterPMF(triangle);
+    }
+
+    auto it = emitter_index.find(triangle);
+    if (it == emitter_index.end())
+    {
+        return 0.0f;
+    }
+    return emitter_hierarchy.PMF(position, normal, it->second);
+}
+
+const bool RenderToy::World::HasMotion() const
+{
+    for (const auto &camera : cameras)
+    {
+        if (camera.IsMoving())
+        {
+            return true;
+        }
+    }
+    for (auto m : meshes)
+    {
+        if (m->IsMoving())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 int RenderToy::World::CountEmitters() const
 {
     return emissive_triangles.size();
@@ -24,19 +94,102 @@ int RenderToy::World::CountEmitters() const
 void RenderToy::World::PrepareDirectLightSampling()
 {
     emissive_triangles.clear();
+    emitter_index.clear();
+    std::vector<float> power;
+    PrepareMaterials();
     for(auto m : meshes)
     {
         if(m->tex->emission!=Vector3f::O)
         {
+            // Luma may vanish for saturated colors, keep such emitters reachable.
+            float luma = std::max(Convert::Luma(m->tex->emission), kFloatEpsilon);
             for(auto t : m->tris)
             {
+                emitter_index[t] = emissive_triangles.size();
                 emissive_triangles.push_back(t);
+                power.push_back(t->AreaC() * luma);
+            }
+        }
+    }
+    emitter_distribution.Build(power);
+    emitter_hierarchy.Build(emissive_triangles, power);
+    if (environment != nullptr)
+    {
+        environment->Prepare();
+    }
+}
+
+// Prepare every material for the media of all of them.
+static void PrepareAll(const std::vector<RenderToy::PrincipledBSDF *> &materials)
+{
+    // Rays only get inside materials they can refract into.
+    std::vector<float> iors;
+    for (auto m : materials)
+    {
+        if (m->spec_trans > 0.0f && std::find(iors.begin(), iors.end(), m->ior) == iors.end())
+        {
+            iors.push_back(m->ior);
+        }
+    }
+    for (auto m : materials)
+    {
+        m->Prepare(iors);
+    }
+}
+
+void RenderToy::World::PrepareMaterials()
+{
+    // Material ids are 16 bits, check the table before any id is given out.
+    constexpr std::size_t kMaxMaterials = std::size_t(std::numeric_limits<uint16_t>::max()) + 1;
+    if (materials.size() > kMaxMaterials)
+    {
+        throw Exception::TooManyMaterialsException("Material ids are 16 bits.");
+    }
+    std::unordered_map<const PrincipledBSDF *, uint16_t> ids;
+    for (std::size_t i = 0; i < materials.size(); ++i)
+    {
+        ids.emplace(materials[i], uint16_t(i));
+    }
+    for (auto m : meshes)
+    {
+        auto it = ids.find(m->tex);
+        if (it == ids.end())
+        {
+            if (materials.size() == kMaxMaterials)
+            {
+                throw Exception::TooManyMaterialsException("Material ids are 16 bits.");
             }
+            it = ids.emplace(m->tex, uint16_t(materials.size())).first;
+            materials.push_back(m->tex);
+        }
+        for (auto t : m->tris)
+        {
+            t->material_id = it->second;
         }
     }
+    PrepareAll(materials);
+}
+
+void RenderToy::World::SetMaterial(const uint16_t id, PrincipledBSDF *material)
+{
+    PrincipledBSDF *previous = materials[id];
+    for (auto m : meshes)
+    {
+        if (m->tex == previous)
+        {
+            m->tex = material;
+        }
+    }
+    materials[id] = material;
+    // The ior of the new material may be a medium of any other.
+    PrepareAll(materials);
 }
 
 const RenderToy::Vector3f RenderToy::World::GetDefaultEmission(const RenderToy::Vector3f &back_dir) const
 {
+    if (environment != nullptr)
+    {
+        return environment->Eval(-back_dir);
+    }
     return (back_dir[2] < 0.0f) ? sky_emission : ground_reflection;
 }
@@ -1,7 +1,409 @@
-
 #define CATCH_CONFIG_MAIN
 
 #include "../include/RenderToy/rendertoy.h"
+#include "../include/RenderToy/exception.h"
 #include <catch2/catch_all.hpp>
 
+#include <cmath>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace RenderToy;
+
+// Corner of a room lit from above, with diffuse, glossy, glass and emissive surfaces. Camera 0 looks along +y.
+struct TestScene
+{
+    World world;
+    Mesh meshes[4];
+    DiffuseBSDF floor = DiffuseBSDF(Vector3f(0.8f, 0.8f, 0.8f));
+    GlossyBSDF wall = GlossyBSDF(Vector3f(0.9f, 0.5f, 0.3f), 0.3f);
+    GlassBSDF glass = GlassBSDF(Vector3f::White, 0.1f, 1.5f);
+    EmissiveBSDF light = EmissiveBSDF(Vector3f::White, 8.0f);
+
+    TestScene()
+    {
+        AddQuad(meshes[0], Vector3f(-2.0f, -2.0f, 0.0f), Vector3f(4.0f, 0.0f, 0.0f), Vector3f(0.0f, 4.0f, 0.0f), &floor);
+        AddQuad(meshes[1], Vector3f(-2.0f, 2.0f, 0.0f), Vector3f(4.0f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 3.0f), &wall);
+        AddQuad(meshes[2], Vector3f(-0.8f, 0.0f, 0.2f), Vector3f(1.2f, -0.4f, 0.0f), Vector3f(0.0f, 0.0f, 1.2f), &glass);
+        AddQuad(meshes[3], Vector3f(-0.5f, -0.5f, 2.5f), Vector3f(0.0f, 1.0f, 0.0f), Vector3f(1.0f, 0.0f, 0.0f), &light);
+        world.PrepareDirectLightSampling();
+
+        world.cameras.push_back(academy_format);
+        world.cameras[0].SetO2W(AffineTransformation::Translation({0.0f, -5.0f, 1.2f}) * AffineTransformation::RotationEulerXYZ({Convert::DegreeToRadians(90), 0.0f, 0.0f}));
+    }
+
+    TestScene(const TestScene &) = delete;
+
+    ~TestScene()
+    {
+        for (auto tri : world.triangles)
+        {
+            delete tri;
+        }
+    }
+
+    // Parallelogram spanned by u and v from origin, facing u x v.
+    void AddQuad(Mesh &mesh, const Vector3f &origin, const Vector3f &u, const Vector3f &v, PrincipledBSDF *material)
+    {
+        const Vector3f n = u.Cross(v).Normalized();
+        mesh.tris.push_back(new Triangle({origin, origin + u, origin + u + v}, {n, n, n}, {Vector2f(0.0f, 0.0f), Vector2f(1.0f, 0.0f), Vector2f(1.0f, 1.0f)}, &mesh));
+        mesh.tris.push_back(new Triangle({origin, origin + u + v, origin + v}, {n, n, n}, {Vector2f(0.0f, 0.0f), Vector2f(1.0f, 1.0f), Vector2f(0.0f, 1.0f)}, &mesh));
+        mesh.SetO2W(Matrix4x4f::I);
+        mesh.tex = material;
+        world.meshes.push_back(&mesh);
+        world.triangles.insert(world.triangles.end(), mesh.tris.begin(), mesh.tris.end());
+    }
+
+    const FormatSettings Format() const
+    {
+        return FormatSettings(SizeN(24, 16), Vector2f(1.0f, 1.0f));
+    }
+};
+
+static const std::vector<Vector3f> Pixels(const RenderContext &rc)
+{
+    return std::vector<Vector3f>(rc.buffer, rc.buffer + rc.buffer_size.Area());
+}
+
+static const Vector3f Mean(const std::vector<Vector3f> &pixels)
+{
+    Vector3f sum;
+    for (const auto &pixel : pixels)
+    {
+        sum += pixel;
+    }
+    return sum / float(pixels.size());
+}
+
+TEST_CASE("Wavefront Renderer Test")
+{
+    TestScene scene;
+    RenderContext rc(&scene.world, scene.Format());
+    PathTracingRenderer megakernel(&rc, 16);
+    megakernel.Render();
+    const std::vector<Vector3f> reference = Pixels(rc);
+    REQUIRE(Mean(reference).Length() > 0.01f);
+
+    // Paths draw the same random sequences in both renderers, so pixels only differ by rounding.
+    // Batches smaller than the frame keep paths of one pixel in different batches.
+    for (const std::size_t batch_size : {std::size_t(1) << 16, std::size_t(100)})
+    {
+        RenderContext wavefront_rc(&scene.world, scene.Format());
+        WavefrontPathTracingRenderer wavefront(&wavefront_rc, 16, batch_size);
+        wavefront.Render();
+        const std::vector<Vector3f> pixels = Pixels(wavefront_rc);
+        REQUIRE((Mean(pixels) - Mean(reference)).Length() < 1e-3f * Mean(reference).Length());
+        std::size_t differing = 0;
+        for (std::size_t i = 0; i < pixels.size(); ++i)
+        {
+            REQUIRE(std::isfinite(pixels[i].Length()));
+            if ((pixels[i] - reference[i]).Length() > 1e-3f * std::max(reference[i].Length(), 1.0f))
+            {
+                ++differing;
+            }
+        }
+        // Rounding may flip a few Russian roulette or lobe choices.
+        REQUIRE(differing <= pixels.size() / 50);
+    }
+}
+
+// Killed after a number of passes, like a job hitting its time limit.
+struct InterruptedRenderer : public PathTracingRenderer
+{
+    int passes_left;
+
+    InterruptedRenderer(RenderContext *render_context_, const int iteration_count_, const int passes_)
+        : PathTracingRenderer(render_context_, iteration_count_), passes_left(passes_)
+    {
+    }
+
+protected:
+    void RenderIterations(const int first_iteration, const int count) override
+    {
+        if (passes_left-- == 0)
+        {
+            throw std::runtime_error("Killed.");
+        }
+        PathTracingRenderer::RenderIterations(first_iteration, count);
+    }
+};
+
+TEST_CASE("Checkpoint Test")
+{
+    TestScene scene;
+    RenderContext rc(&scene.world, scene.Format());
+    PathTracingRenderer uninterrupted(&rc, 8);
+    uninterrupted.seed = 5;
+    uninterrupted.Render();
+    const std::vector<Vector3f> reference = Pixels(rc);
+
+    // Resuming from the last checkpoint of a killed render gives the uninterrupted image.
+    const std::string path = (std::filesystem::temp_directory_path() / "rendertoy_checkpoint_test.rtck").string();
+    {
+        RenderContext killed_rc(&scene.world, scene.Format());
+        InterruptedRenderer killed(&killed_rc, 8, 1);
+        killed.seed = 5;
+        killed.checkpoint_interval = 3;
+        killed.checkpoint_path = path;
+        REQUIRE_THROWS_AS(killed.Render(), std::runtime_error);
+        REQUIRE(killed.FinishedIterations() == 3);
+    }
+    RenderContext resumed_rc(&scene.world, scene.Format());
+    PathTracingRenderer resumed(&resumed_rc, 8);
+    RenderCheckpoint::Load(resumed, path);
+    REQUIRE(resumed.FinishedIterations() == 3);
+    REQUIRE(resumed.seed == 5);
+    resumed.Render();
+    REQUIRE(Pixels(resumed_rc) == reference);
+    std::filesystem::remove(path);
+
+    // Saving and loading keeps the state exactly.
+    std::stringstream ss;
+    RenderCheckpoint::Save(uninterrupted, ss);
+    const std::string data = ss.str();
+    {
+        RenderContext loaded_rc(&scene.world, scene.Format());
+        PathTracingRenderer loaded(&loaded_rc, 8);
+        std::istringstream is(data);
+        RenderCheckpoint::Load(loaded, is);
+        REQUIRE(loaded.FinishedIterations() == 8);
+        REQUIRE(Pixels(loaded_rc) == reference);
+    }
+
+    // Rejected checkpoints leave the renderer untouched.
+    auto Reject = [&](const std::string &bytes, PathTracingRenderer &renderer) -> void
+    {
+        std::istringstream is(bytes);
+        RenderCheckpoint::Load(renderer, is);
+    };
+    RenderContext rejected_rc(&scene.world, scene.Format());
+    PathTracingRenderer rejected(&rejected_rc, 8);
+
+    std::string bad_magic = data;
+    bad_magic[0] = 'X';
+    REQUIRE_THROWS_AS(Reject(bad_magic, rejected), Exception::InvalidCheckpointException);
+
+    // The version follows the four magic bytes.
+    std::string other_version = data;
+    ++other_version[4];
+    REQUIRE_THROWS_AS(Reject(other_version, rejected), Exception::InvalidCheckpointException);
+
+    REQUIRE_THROWS_AS(Reject(data.substr(0, data.size() - 1), rejected), Exception::InvalidCheckpointException);
+    REQUIRE_THROWS_AS(Reject(data.substr(0, 20), rejected), Exception::InvalidCheckpointException);
+    REQUIRE_THROWS_AS(Reject("", rejected), Exception::InvalidCheckpointException);
+    REQUIRE(rejected.FinishedIterations() == 0);
+
+    PathTracingRenderer longer(&rejected_rc, 16);
+    REQUIRE_THROWS_AS(Reject(data, longer), Exception::CheckpointNotMatchException);
+    RenderContext smaller_rc(&scene.world, FormatSettings(SizeN(8, 8), Vector2f(1.0f, 1.0f)));
+    PathTracingRenderer smaller(&smaller_rc, 8);
+    REQUIRE_THROWS_AS(Reject(data, smaller), Exception::CheckpointNotMatchException);
+    REQUIRE_THROWS_AS(RenderCheckpoint::Load(rejected, path), Exception::InvalidCheckpointException);
+}
+
+TEST_CASE("Render Coordinator Test")
+{
+    TestScene scene;
+    RenderContext rc(&scene.world, scene.Format());
+    PathTracingRenderer single(&rc, 6);
+    single.seed = 9;
+    single.Render();
+
+    // Workers keep the default of one thread each, a forked child of a process that ran parallel regions cannot start new ones.
+    RenderCoordinator coordinator(&scene.world, scene.Format(), 6, 2);
+    coordinator.seed = 9;
+    coordinator.bucket_size = SizeN(10, 10);
+    const Image tiled = coordinator.Render();
+    REQUIRE(tiled.resolution == rc.buffer_size);
+    for (std::size_t y = 0; y < rc.buffer_size.height; ++y)
+    {
+        for (std::size_t x = 0; x < rc.buffer_size.width; ++x)
+        {
+            REQUIRE(tiled(x, y) == rc(x, y));
+        }
+    }
+
+    // Sample ranges are weighted means of the same samples.
+    coordinator.split = WorkSplit::kSamples;
+    coordinator.sample_chunks = 3;
+    const Image sampled = coordinator.Render();
+    for (std::size_t y = 0; y < rc.buffer_size.height; ++y)
+    {
+        for (std::size_t x = 0; x < rc.buffer_size.width; ++x)
+        {
+            REQUIRE((sampled(x, y) - rc(x, y)).Length() < 1e-5f * std::max(rc(x, y).Length(), 1.0f));
+        }
+    }
+}
+
+#ifdef _OPENMP
+TEST_CASE("Thread Count Test")
+{
+    TestScene scene;
+    const int threads = omp_get_max_threads();
+    auto Render = [&scene](const int thread_count, const bool wavefront) -> std::vector<Vector3f>
+    {
+        omp_set_num_threads(thread_count);
+        RenderContext rc(&scene.world, scene.Format());
+        if (wavefront)
+        {
+            WavefrontPathTracingRenderer renderer(&rc, 4, 100);
+            renderer.seed = 3;
+            renderer.Render();
+        }
+        else
+        {
+            PathTracingRenderer renderer(&rc, 4);
+            renderer.seed = 3;
+            renderer.Render();
+        }
+        return Pixels(rc);
+    };
+
+    for (const bool wavefront : {false, true})
+    {
+        const std::vector<Vector3f> single = Render(1, wavefront);
+        REQUIRE(Render(4, wavefront) == single);
+        REQUIRE(Render(7, wavefront) == single);
+    }
+    omp_set_num_threads(threads);
+}
+#endif
+
+TEST_CASE("Accumulation Buffer Test")
+{
+    // Not a multiple of the tile size, so border tiles are cut.
+    AccumulationBuffer accumulation;
+    accumulation.Resize(SizeN(37, 20));
+    REQUIRE(accumulation.TileCount() == 6);
+    std::size_t covered = 0;
+    for (std::size_t t = 0; t < accumulation.TileCount(); ++t)
+    {
+        PointN origin;
+        SizeN size;
+        accumulation.Tile(t, origin, size);
+        covered += size.Area();
+        for (std::size_t y = origin.y; y < origin.y + size.height; ++y)
+        {
+            for (std::size_t x = origin.x; x < origin.x + size.width; ++x)
+            {
+                REQUIRE(accumulation(x, y) == Vector3d());
+            }
+        }
+    }
+    REQUIRE(covered == SizeN(37, 20).Area());
+
+    // Resolving N passes with a scale of 1 / N gives their mean.
+    constexpr int kPasses = 5;
+    auto Sample = [](const std::size_t x, const std::size_t y, const int pass) -> Vector3d
+    {
+        return Vector3d(double(x) + 0.1 * pass, double(y) * 0.5, 1.0 / double(pass + 1));
+    };
+    for (int pass = 0; pass < kPasses; ++pass)
+    {
+        for (std::size_t y = 0; y < 20; ++y)
+        {
+            for (std::size_t x = 0; x < 37; ++x)
+            {
+                accumulation(x, y) += Sample(x, y, pass);
+            }
+        }
+    }
+    std::vector<Vector3f> resolved(SizeN(37, 20).Area());
+    accumulation.Resolve(resolved.data(), 1.0 / double(kPasses));
+    for (std::size_t y = 0; y < 20; ++y)
+    {
+        for (std::size_t x = 0; x < 37; ++x)
+        {
+            Vector3d mean;
+            for (int pass = 0; pass < kPasses; ++pass)
+            {
+                mean += Sample(x, y, pass);
+            }
+            mean /= double(kPasses);
+            REQUIRE(resolved[y * 37 + x] == Vector3f(mean.x(), mean.y(), mean.z()));
+        }
+    }
+
+    // A render resolved at every pass, and one interrupted and continued in the same renderer, match a single pass render.
+    TestScene scene;
+    RenderContext rc(&scene.world, scene.Format());
+    PathTracingRenderer single_pass(&rc, 6);
+    single_pass.Render();
+    const std::vector<Vector3f> reference = Pixels(rc);
+
+    RenderContext passes_rc(&scene.world, scene.Format());
+    PathTracingRenderer passes(&passes_rc, 6);
+    passes.checkpoint_interval = 2;
+    passes.Render();
+    REQUIRE(Pixels(passes_rc) == reference);
+
+    RenderContext resumed_rc(&scene.world, scene.Format());
+    InterruptedRenderer resumed(&resumed_rc, 6, 2);
+    resumed.checkpoint_interval = 2;
+    REQUIRE_THROWS_AS(resumed.Render(), std::runtime_error);
+    REQUIRE(resumed.FinishedIterations() == 4);
+    resumed.passes_left = 1;
+    resumed.Render();
+    REQUIRE(resumed.FinishedIterations() == 6);
+    REQUIRE(Pixels(resumed_rc) == reference);
+
+    // Reset starts over.
+    resumed.Reset();
+    resumed.passes_left = 3;
+    resumed.Render();
+    REQUIRE(Pixels(resumed_rc) == reference);
+}
+
+TEST_CASE("Sequence Renderer Test")
+{
+    TestScene scene;
+    SequenceRenderer sequence(&scene.world, scene.Format(), 4);
+    sequence.seed = 11;
+    sequence.output_path = (std::filesystem::temp_directory_path() / "rendertoy_sequence_###.ppm").string();
+    REQUIRE(sequence.FramePath(7) == (std::filesystem::temp_directory_path() / "rendertoy_sequence_007.ppm").string());
+    REQUIRE(sequence.FramePath(12345) == (std::filesystem::temp_directory_path() / "rendertoy_sequence_12345.ppm").string());
+
+    // The glass slides to the left wall and back.
+    TransformTrack track;
+    track.Insert(TransformKey(0.0f, Vector3f::O));
+    track.Insert(TransformKey(1.0f, Vector3f(-1.0f, 0.0f, 0.0f)));
+    track.Insert(TransformKey(2.0f, Vector3f::O));
+    sequence.mesh_tracks.push_back({&scene.meshes[2], track});
+
+    std::vector<Vector3f> frame_pixels;
+    sequence.post_process = [&frame_pixels](Image &image) -> void
+    {
+        frame_pixels.assign(image.GetBuffer(), image.GetBuffer() + image.resolution.Area());
+    };
+
+    // Rebuilt at every frame the glass moves in, or only refitted.
+    for (const float threshold : {0.0f, 1e6f})
+    {
+        sequence.rebuild_threshold = threshold;
+        const int rebuilds = sequence.RebuildCount();
+        for (int frame = 0; frame <= 2; ++frame)
+        {
+            // Rendering one frame at a time waits for its write.
+            sequence.Render(frame, frame);
+            REQUIRE(std::filesystem::exists(sequence.FramePath(frame)));
+            std::filesystem::remove(sequence.FramePath(frame));
+
+            // Frames match an independent render of the scene at the frame.
+            RenderContext rc(&scene.world, scene.Format());
+            PathTracingRenderer renderer(&rc, 4);
+            renderer.seed = 11 + uint64_t(frame);
+            renderer.Render();
+            REQUIRE(frame_pixels == Pixels(rc));
+        }
+        REQUIRE(sequence.RebuildCount() - rebuilds == (threshold == 0.0f ? 2 : 0));
+    }
+    REQUIRE(scene.meshes[2].GetO2W() == Matrix4x4f::I);
+}
@@ -2,8 +2,12 @@
 #define CATCH_CONFIG_MAIN
 
 #include <RenderToy/rendertoy.h>
+#include <RenderToy/exception.h>
 #include <catch2/catch_all.hpp>
 
+#include <array>
+#include <limits>
+
 using namespace RenderToy;
 
 TEST_CASE("SetO2W Test")
@@ -33,5 +37,721 @@ TEST_CASE("Light Test")
         DeltaLight d_light;
         d_light.SetO2W(AffineTransformation::Translation({11.0f,45.0f,14.0f}));
         REQUIRE(d_light.GetSamplePoint() == Vector3f(11.0f, 45.0f, 14));
+
+        Vector3f dir;
+        float distance;
+        auto irradiance = d_light.Illuminate(Vector3f(11.0f, 45.0f, 12.0f), dir, distance);
+        REQUIRE(dir == Vector3f::Z);
+        REQUIRE(distance == 2.0f);
+        REQUIRE(irradiance == Vector3f(0.25f));
+    }
+
+    SECTION("Spot Light")
+    {
+        SpotLight s_light;
+        Vector3f dir;
+        float distance;
+        REQUIRE(s_light.Illuminate(Vector3f(0.0f, 0.0f, -1.0f), dir, distance) == Vector3f::White);
+        REQUIRE(s_light.Illuminate(Vector3f(0.0f, 0.0f, 1.0f), dir, distance) == Vector3f::O);
+        REQUIRE(s_light.Illuminate(Vector3f(1.0f, 0.0f, -1.0f), dir, distance) == Vector3f::O);
+    }
+
+    SECTION("Directional Light")
+    {
+        DirectionalLight sun;
+        sun.SetO2W(AffineTransformation::RotationEulerXYZ({kPi<float>, 0.0f, 0.0f}));
+        Vector3f dir;
+        float distance;
+        REQUIRE(sun.Illuminate(Vector3f::O, dir, distance) == Vector3f::White);
+        REQUIRE(dir == -Vector3f::Z);
+        REQUIRE(distance == kFloatInfinity);
+    }
+}
+
+TEST_CASE("Light BVH Test")
+{
+    // Emitters of different power spread over a row, facing up or sideways.
+    Mesh mesh;
+    std::vector<const Triangle *> emitters;
+    std::vector<float> power;
+    for (int i = 0; i < 7; ++i)
+    {
+        const Vector3f offset(float(i) - 3.0f, 0.0f, 2.0f);
+        if (i % 2 == 0)
+        {
+            mesh.tris.push_back(new Triangle({offset + Vector3f(-0.5f, -0.5f, 0.0f), offset + Vector3f(0.5f, -0.5f, 0.0f), offset + Vector3f(0.0f, 0.5f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f::O, Vector2f::O, Vector2f::O}, &mesh));
+        }
+        else
+        {
+            mesh.tris.push_back(new Triangle({offset + Vector3f(0.0f, -0.5f, -0.5f), offset + Vector3f(0.0f, 0.5f, -0.5f), offset + Vector3f(0.0f, 0.0f, 0.5f)}, {Vector3f::X, Vector3f::X, Vector3f::X}, {Vector2f::O, Vector2f::O, Vector2f::O}, &mesh));
+        }
+        // The middle emitter is dark, so it has no importance for any receiver.
+        power.push_back(i == 3 ? 0.0f : 1.0f + float(i));
+    }
+    mesh.SetO2W(Matrix4x4f::I);
+    for (const auto tri : mesh.tris)
+    {
+        emitters.push_back(tri);
+    }
+
+    LightBVH hierarchy;
+    REQUIRE(hierarchy.Empty());
+    hierarchy.Build(emitters, power);
+    REQUIRE(!hierarchy.Empty());
+
+    // The last receiver is behind the row, emitters light both faces.
+    const Vector3f receivers[] = {Vector3f::O, Vector3f(-3.0f, 0.5f, 0.0f), Vector3f(2.5f, -1.0f, 4.0f), Vector3f(0.0f, 0.0f, -3.0f)};
+    for (const auto &position : receivers)
+    {
+        for (const auto &normal : {Vector3f::Z, Vector3f::O})
+        {
+            float sum = 0.0f;
+            for (std::size_t i = 0; i < emitters.size(); ++i)
+            {
+                sum += hierarchy.PMF(position, normal, i);
+            }
+            REQUIRE(std::abs(sum - 1.0f) < 1e-5f);
+            REQUIRE(hierarchy.PMF(position, normal, 3) == 0.0f);
+
+            // Sample() picks every emitter as often as PMF() says, and reports the same probability.
+            int hits[7] = {};
+            constexpr int kSamples = 10000;
+            for (int j = 0; j < kSamples; ++j)
+            {
+                std::size_t index;
+                float pmf;
+                REQUIRE(hierarchy.Sample(position, normal, (float(j) + 0.5f) / float(kSamples), index, pmf));
+                REQUIRE(index < emitters.size());
+                REQUIRE(std::abs(pmf - hierarchy.PMF(position, normal, index)) < 1e-6f);
+                ++hits[index];
+            }
+            for (std::size_t i = 0; i < emitters.size(); ++i)
+            {
+                REQUIRE(std::abs(float(hits[i]) / float(kSamples) - hierarchy.PMF(position, normal, i)) < 1e-3f);
+            }
+        }
+    }
+    REQUIRE(hierarchy.PMF(Vector3f::O, Vector3f::Z, emitters.size()) == 0.0f);
+
+    // A single emitter is a leaf at the root, weighed against nothing. A dark one is rejected by Sample() and PMF() alike.
+    LightBVH single;
+    std::size_t index;
+    float pmf;
+    single.Build({emitters[0]}, {1.0f});
+    REQUIRE(single.Sample(Vector3f(-3.0f, 0.0f, -3.0f), Vector3f::Z, 0.5f, index, pmf));
+    REQUIRE(pmf == single.PMF(Vector3f(-3.0f, 0.0f, -3.0f), Vector3f::Z, index));
+    single.Build({emitters[3]}, {0.0f});
+    REQUIRE(!single.Sample(Vector3f(-3.0f, 0.0f, -3.0f), Vector3f::Z, 0.5f, index, pmf));
+    REQUIRE(single.PMF(Vector3f(-3.0f, 0.0f, -3.0f), Vector3f::Z, 0) == 0.0f);
+
+    for (auto tri : mesh.tris)
+    {
+        delete tri;
+    }
+}
+
+TEST_CASE("TransformTrack Test")
+{
+    TransformTrack track;
+    track.Insert(TransformKey(10.0f, Vector3f(2.0f, 0.0f, 0.0f)));
+    track.Insert(TransformKey(0.0f, Vector3f::O));
+    REQUIRE(track.keys.front().frame == 0.0f);
+
+    REQUIRE(track.Evaluate(5.0f).location == Vector3f(1.0f, 0.0f, 0.0f));
+    REQUIRE(track.Evaluate(-3.0f).location == Vector3f::O);
+    REQUIRE(track.Evaluate(20.0f).location == Vector3f(2.0f, 0.0f, 0.0f));
+    REQUIRE(track.Evaluate(5.0f).O2W() == AffineTransformation::Translation({1.0f, 0.0f, 0.0f}));
+}
+
+TEST_CASE("BVH Refit Test")
+{
+    // A row of triangles, the last of which moves away.
+    Mesh mesh, moving;
+    std::vector<Triangle *> triangles;
+    for (int i = 0; i < 16; ++i)
+    {
+        Mesh *parent = i == 15 ? &moving : &mesh;
+        const Vector3f offset(float(i % 4) * 2.0f, float(i / 4) * 2.0f, 0.0f);
+        parent->tris.push_back(new Triangle({offset + Vector3f(-0.5f, -0.5f, 0.0f), offset + Vector3f(0.5f, -0.5f, 0.0f), offset + Vector3f(0.0f, 0.5f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f::O, Vector2f::O, Vector2f::O}, parent));
+        triangles.push_back(parent->tris.back());
+    }
+    mesh.SetO2W(Matrix4x4f::I);
+    moving.SetO2W(Matrix4x4f::I);
+
+    BVH bvh(triangles);
+    REQUIRE(bvh.Degradation() == 1.0f);
+
+    // Closest hits agree with testing every triangle.
+    auto Check = [&]() -> void
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            const Ray ray(Vector3f(float(i % 20) * 0.4f - 1.0f, float(i / 20) * 0.8f - 1.0f, 5.0f), Vector3f(0.05f, 0.02f, -1.0f).Normalized());
+            const Triangle *expected = nullptr;
+            float expected_t = kFloatInfinity;
+            for (const auto tri : triangles)
+            {
+                float t, u, v;
+                if (tri->Intersect(ray, t, u, v) && t < expected_t)
+                {
+                    expected_t = t;
+                    expected = tri;
+                }
+            }
+            Vector3f position;
+            float t, u, v;
+            REQUIRE(bvh.Intersect(ray, position, t, u, v, nullptr) == expected);
+        }
+    };
+    Check();
+
+    // Hits follow a refitted triangle to where it moved.
+    moving.SetO2W(AffineTransformation::Translation({-20.0f, 9.0f, 1.0f}));
+    bvh.Refit();
+    Check();
+    Vector3f position;
+    float t, u, v;
+    REQUIRE(bvh.Intersect(Ray(Vector3f(-14.0f, 14.9f, 2.0f), -Vector3f::Z), position, t, u, v, nullptr) == moving.tris[0]);
+    REQUIRE(bvh.Intersect(Ray(Vector3f(6.0f, 5.9f, 1.0f), -Vector3f::Z), position, t, u, v, nullptr) == nullptr);
+
+    // Bounds stretched over the gap make traversal more expensive until the tree is rebuilt.
+    REQUIRE(bvh.Degradation() > 1.0f);
+    bvh.Rebuild();
+    REQUIRE(bvh.Degradation() == 1.0f);
+    Check();
+
+    for (auto tri : triangles)
+    {
+        delete tri;
+    }
+}
+
+TEST_CASE("Motion Test")
+{
+    Mesh mesh;
+    mesh.tris.push_back(new Triangle({Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f::O, Vector2f::O, Vector2f::O}, &mesh));
+    mesh.SetO2W(Matrix4x4f::I, AffineTransformation::Translation({4.0f, 0.0f, 0.0f}));
+    REQUIRE(mesh.IsMoving());
+    REQUIRE(mesh.GetO2W(0.5f) == AffineTransformation::Translation({2.0f, 0.0f, 0.0f}));
+
+    const Triangle *tri = mesh.tris[0];
+    float t, u, v;
+    REQUIRE(tri->Intersect(Ray(Vector3f(0.0f, 0.0f, 1.0f), -Vector3f::Z, 0.0f), t, u, v));
+    REQUIRE_FALSE(tri->Intersect(Ray(Vector3f(0.0f, 0.0f, 1.0f), -Vector3f::Z, 1.0f), t, u, v));
+    REQUIRE(tri->Intersect(Ray(Vector3f(4.0f, 0.0f, 1.0f), -Vector3f::Z, 1.0f), t, u, v));
+    REQUIRE(std::abs(t - 1.0f) < kFloatEpsilon);
+
+    // The bounding box covers the whole sweep.
+    const BoundingBox bbox = tri->BBox();
+    REQUIRE(bbox.vmin.x() == -1.0f);
+    REQUIRE(bbox.vmax.x() == 5.0f);
+
+    mesh.SetO2W(Matrix4x4f::I);
+    REQUIRE_FALSE(mesh.IsMoving());
+    REQUIRE_FALSE(tri->IsMoving());
+    delete mesh.tris[0];
+}
+
+TEST_CASE("Material Prepare Test")
+{
+    const Vector3f N(0.0f, 0.0f, 1.0f);
+    const Vector3f V = Vector3f(0.3f, -0.2f, 1.0f).Normalized();
+    const Vector3f Ls[] = {Vector3f(-0.4f, 0.1f, 1.0f).Normalized(), Vector3f(-0.2f, 0.3f, -1.0f).Normalized()};
+    // Prepared and unprepared materials must both match the per-call formulas the kernels replaced.
+    // Reference values are Eval() color and pdf, then PDF(), for eta = ior and 1 / ior, each for both Ls.
+    auto Check = [&](const PrincipledBSDF &material, const PrincipledBSDF::Kind kind, const float (&reference)[4][5]) -> void
+    {
+        PrincipledBSDF prepared = material;
+        prepared.Prepare();
+        REQUIRE(material.GetKind() == PrincipledBSDF::Kind::kPrincipled);
+        REQUIRE(prepared.GetKind() == kind);
+        for (const PrincipledBSDF *bsdf : {&material, static_cast<const PrincipledBSDF *>(&prepared)})
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                const float eta = i < 2 ? material.ior : 1.0f / material.ior;
+                const RayState state = {eta, Vector3f::O, N};
+                const Vector3f &L = Ls[i % 2];
+                const float *expected = reference[i];
+                float pdf;
+                const Vector3f f = bsdf->Eval(state, V, N, L, pdf);
+                REQUIRE((f - Vector3f(expected[0], expected[1], expected[2])).Length() < 1e-5f * std::max(f.Length(), 1.0f));
+                REQUIRE(std::abs(pdf - expected[3]) < 1e-5f * std::max(pdf, 1.0f));
+                REQUIRE(std::abs(bsdf->PDF(state, V, N, L) - expected[4]) < 1e-5f * std::max(pdf, 1.0f));
+            }
+        }
+    };
+
+    const float principled[4][5] = {
+        {0.209635586f, 0.0988101885f, 0.0544800386f, 0.516243696f, 0.516206384f},
+        {1.24589229f, 0.762950182f, 0.440489531f, 0.404744565f, 0.403845221f},
+        {0.209074065f, 0.0981697068f, 0.0538079627f, 0.516088009f, 0.516083002f},
+        {0.553729594f, 0.339088738f, 0.195772976f, 0.910673797f, 0.910936236f}};
+    const float diffuse[4][5] = {
+        {0.25734058f, 0.110201612f, 0.0513460189f, 0.298988461f, 0.298969716f},
+        {0.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+        {0.256923527f, 0.109784551f, 0.0509289615f, 0.298911899f, 0.298908859f},
+        {0.0f, 0.0f, 0.0f, 0.0f, 0.0f}};
+    const float conductor[4][5] = {
+        {0.764070749f, 0.509380877f, 0.169794291f, 0.852202475f, 0.852202475f},
+        {0.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+        {0.764070749f, 0.509380877f, 0.169794291f, 0.852202475f, 0.852202475f},
+        {0.0f, 0.0f, 0.0f, 0.0f, 0.0f}};
+    const float dielectric[4][5] = {
+        {0.136226773f, 0.136226773f, 0.136226773f, 0.131422311f, 0.130753979f},
+        {1.75364745f, 1.75364745f, 1.75364745f, 0.751563191f, 0.750626802f},
+        {0.133348241f, 0.133348241f, 0.133348241f, 0.128636509f, 0.128547087f},
+        {0.779398024f, 0.779398024f, 0.779398024f, 1.69101548f, 1.69128799f}};
+    Check(PrincipledBSDF(Vector3f(0.8f, 0.3f, 0.1f), Vector3f::O, 0.4f, 0.2f, 0.5f, 1.5f, 0.0f, 0.1f, 0.3f, 0.5f, 0.5f, 0.2f, 0.1f), PrincipledBSDF::Kind::kPrincipled, principled);
+    Check(DiffuseBSDF(Vector3f(0.8f, 0.3f, 0.1f)), PrincipledBSDF::Kind::kDiffuse, diffuse);
+    Check(GlossyBSDF(Vector3f(0.9f, 0.6f, 0.2f), 0.3f), PrincipledBSDF::Kind::kConductor, conductor);
+    Check(GlassBSDF(Vector3f::White, 0.2f, 1.5f), PrincipledBSDF::Kind::kDielectric, dielectric);
+
+    // Glass in water, both sides of the surface come from the cache of nested media.
+    const GlassBSDF glass(Vector3f::White, 0.2f, 1.5f);
+    PrincipledBSDF nested = glass;
+    nested.Prepare({1.0f, 1.33f});
+    for (const float eta : {1.5f / 1.33f, 1.33f / 1.5f})
+    {
+        const RayState state = {eta, Vector3f::O, N};
+        for (const auto &L : Ls)
+        {
+            float pdf, nested_pdf;
+            const Vector3f f = glass.Eval(state, V, N, L, pdf);
+            REQUIRE((f - nested.Eval(state, V, N, L, nested_pdf)).Length() < 1e-5f * std::max(f.Length(), 1.0f));
+            REQUIRE(std::abs(pdf - nested_pdf) < 1e-5f * std::max(pdf, 1.0f));
+        }
+    }
+
+    EmissiveBSDF emitter(Vector3f::White, 4.0f);
+    emitter.Prepare();
+    REQUIRE(emitter.GetKind() == PrincipledBSDF::Kind::kEmissive);
+    REQUIRE(emitter.emission == Vector3f(4.0f));
+    RayState state = {1.0f, Vector3f::O, N};
+    Vector3f out_dir, color;
+    float pdf;
+    REQUIRE(!emitter.Sample(V, out_dir, color, pdf, state));
+    REQUIRE(emitter.Eval(state, V, N, Ls[0], pdf) == Vector3f::O);
+    REQUIRE(emitter.PDF(state, V, N, Ls[0]) == 0.0f);
+}
+
+TEST_CASE("Material Batch Test")
+{
+    const PrincipledBSDF materials[] = {
+        PrincipledBSDF(Vector3f(0.8f, 0.3f, 0.1f), Vector3f::O, 0.4f, 0.2f, 0.5f, 1.5f, 0.0f, 0.1f, 0.3f, 0.5f, 0.5f, 0.2f, 0.1f),
+        DiffuseBSDF(Vector3f(0.8f, 0.3f, 0.1f)),
+        GlossyBSDF(Vector3f(0.9f, 0.6f, 0.2f), 0.3f),
+        GlassBSDF(Vector3f::White, 0.2f, 1.5f),
+        EmissiveBSDF(Vector3f::White)};
+    for (const auto &material : materials)
+    {
+        // Unprepared, prepared, and prepared with a medium around it.
+        for (int prepare = 0; prepare < 3; ++prepare)
+        {
+            PrincipledBSDF bsdf = material;
+            if (prepare == 1)
+            {
+                bsdf.Prepare();
+            }
+            else if (prepare == 2)
+            {
+                bsdf.Prepare({1.33f});
+            }
+
+            // Lanes on both sides and at an interface, some with the shading frame of a normal map.
+            BSDFBatch batch;
+            std::array<RayState, BSDFBatch::kLanes> states;
+            for (std::size_t i = 0; !batch.Full(); ++i)
+            {
+                const Vector3f N = Vector3f(0.1f * float(i % 3), -0.2f, 1.0f).Normalized();
+                states[i].SetFrame(N, i % 3 == 0 ? Vector3f(1.0f, 0.2f, 0.0f).Normalized() : Vector3f::O);
+                states[i].eta = i % 4 < 2 ? bsdf.ior : (i % 4 == 2 ? 1.0f / bsdf.ior : bsdf.ior / 1.33f);
+                const Vector3f V = Vector3f(0.3f, 0.05f * float(i) - 0.4f, 1.0f).Normalized();
+                const Vector3f L = Vector3f(-0.4f + 0.07f * float(i), 0.1f, i % 2 == 0 ? 1.0f : -0.8f).Normalized();
+                REQUIRE(batch.Push(states[i], V, N, L) == i);
+            }
+            bsdf.EvalBatch(batch);
+
+            // The same kernels, so the same results as one query at a time.
+            for (std::size_t i = 0; i < BSDFBatch::kLanes; ++i)
+            {
+                float pdf;
+                REQUIRE(bsdf.Eval(states[i], batch.v[i], batch.n[i], batch.l[i], pdf) == batch.color[i]);
+                REQUIRE(pdf == batch.pdf[i]);
+            }
+        }
+    }
+}
+
+TEST_CASE("Material Table Test")
+{
+    PrincipledBSDF red(Vector3f::X), green(Vector3f::Y), blue(Vector3f::Z);
+    Mesh meshes[3];
+    World world;
+    world.materials.push_back(&blue);
+    for (auto &mesh : meshes)
+    {
+        mesh.tris.push_back(new Triangle({Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f::O, Vector2f::O, Vector2f::O}, &mesh));
+        mesh.SetO2W(Matrix4x4f::I);
+        world.meshes.push_back(&mesh);
     }
-}
\ No newline at end of file
+    meshes[0].tex = &red;
+    meshes[1].tex = &green;
+    meshes[2].tex = &red;
+    world.PrepareDirectLightSampling();
+
+    // Materials already in the table keep their ids, the others are added once.
+    REQUIRE(world.materials.size() == 3);
+    REQUIRE(world.GetMaterial(meshes[0].tris[0]->material_id) == &red);
+    REQUIRE(world.GetMaterial(meshes[1].tris[0]->material_id) == &green);
+    REQUIRE(meshes[2].tris[0]->material_id == meshes[0].tris[0]->material_id);
+    REQUIRE(red.GetKind() == PrincipledBSDF::Kind::kDiffuse);
+
+    const Triangle *tri = meshes[1].tris[0];
+    REQUIRE(SurfacePoint(tri, Vector3f::O, 0.0f, 0.0f).GetMaterial() == &green);
+
+    // Swapping keeps ids and meshes in step.
+    const uint16_t green_id = tri->material_id;
+    world.SetMaterial(green_id, &blue);
+    REQUIRE(world.GetMaterial(green_id) == &blue);
+    REQUIRE(meshes[1].tex == &blue);
+    REQUIRE(SurfacePoint(tri, Vector3f::O, 0.0f, 0.0f, 0.0f, world.GetMaterial(tri->material_id)).GetMaterial() == &blue);
+    world.PrepareMaterials();
+    REQUIRE(world.GetMaterial(tri->material_id) == &blue);
+
+    // A table too large for 16-bit ids is rejected before any id is given out.
+    World full;
+    full.materials.assign(std::size_t(std::numeric_limits<uint16_t>::max()) + 2, &red);
+    REQUIRE_THROWS_AS(full.PrepareMaterials(), Exception::TooManyMaterialsException);
+
+    for (auto &mesh : meshes)
+    {
+        delete mesh.tris[0];
+    }
+}
+
+TEST_CASE("Texture Test")
+{
+    // Red ramps along x, green along y, over several tiles.
+    const SizeN resolution(80, 40);
+    std::vector<Vector3f> texels(resolution.Area());
+    for (std::size_t y = 0; y < resolution.height; ++y)
+    {
+        for (std::size_t x = 0; x < resolution.width; ++x)
+        {
+            texels[y * resolution.width + x] = Vector3f(float(x), float(y), 1.0f);
+        }
+    }
+    TileCache cache(32);
+    ImageTexture texture(texels, resolution, &cache);
+    REQUIRE(texture.LevelCount() == 7);
+    REQUIRE(texture.Resolution(1) == SizeN(40, 20));
+    REQUIRE(texture.Resolution(6) == SizeN(1, 1));
+
+    uint64_t misses = 0;
+    REQUIRE(texture.Texel(0, 70, 35, misses) == Vector3f(70.0f, 35.0f, 1.0f));
+    REQUIRE(texture.Texel(0, -1, 40, misses) == Vector3f(79.0f, 0.0f, 1.0f));
+    REQUIRE(texture.Texel(1, 3, 2, misses) == Vector3f(6.5f, 4.5f, 1.0f));
+    const uint64_t loaded = misses;
+    REQUIRE(loaded == cache.Misses());
+    texture.Texel(0, 70, 35, misses);
+    REQUIRE(misses == loaded);
+
+    // Texel centers are exact, between them values are interpolated. v runs from the bottom up.
+    const Vector3f center = texture.Sample(Vector2f(10.5f / 80.0f, 1.0f - 5.5f / 40.0f), 0.0f, misses);
+    REQUIRE((center - Vector3f(10.0f, 5.0f, 1.0f)).Length() < 1e-3f);
+    const Vector3f between = texture.Sample(Vector2f(11.0f / 80.0f, 1.0f - 5.5f / 40.0f), 0.0f, misses);
+    REQUIRE((between - Vector3f(10.5f, 5.0f, 1.0f)).Length() < 1e-3f);
+    const Vector3f blended = texture.Sample(Vector2f(0.5f, 0.5f), 0.5f, misses);
+    const Vector3f fine = texture.Sample(Vector2f(0.5f, 0.5f), 0.0f, misses);
+    const Vector3f coarse = texture.Sample(Vector2f(0.5f, 0.5f), 1.0f, misses);
+    REQUIRE((blended - (fine + coarse) * 0.5f).Length() < 1e-3f);
+
+    // Touching every tile of every level stays within the capacity.
+    for (std::size_t level = 0; level < texture.LevelCount(); ++level)
+    {
+        for (std::size_t y = 0; y < texture.Resolution(level).height; y += TileCache::kTileSize)
+        {
+            for (std::size_t x = 0; x < texture.Resolution(level).width; x += TileCache::kTileSize)
+            {
+                texture.Texel(level, long(x), long(y), misses);
+            }
+        }
+    }
+    REQUIRE(cache.Size() <= cache.Capacity());
+    cache.SetCapacity(1);
+    REQUIRE(cache.Size() <= cache.Capacity());
+    cache.Clear();
+    REQUIRE(cache.Size() == 0);
+    REQUIRE(texture.Texel(0, 70, 35, misses) == Vector3f(70.0f, 35.0f, 1.0f));
+
+    // Textured materials are applied to a copy per surface point.
+    Mesh mesh;
+    mesh.tris.push_back(new Triangle({Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f(10.5f / 80.0f, 1.0f - 5.5f / 40.0f), Vector2f::O, Vector2f::O}, &mesh));
+    mesh.SetO2W(Matrix4x4f::I);
+    PrincipledBSDF material;
+    material.base_color_texture = &texture;
+    material.Prepare();
+    mesh.tex = &material;
+    SurfacePoint surface_point(mesh.tris[0], Vector3f::O, 0.0f, 0.0f);
+    surface_point.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE(surface_point.GetMaterial() != &material);
+    REQUIRE((surface_point.GetMaterial()->base_color - Vector3f(10.0f, 5.0f, 1.0f)).Length() < 1e-3f);
+    REQUIRE(material.base_color == Vector3f::White);
+
+    // Footprints pick the level whose texels are as wide.
+    REQUIRE(texture.Level(0.0f) == 0.0f);
+    REQUIRE(texture.Level(1.0f / 80.0f) == 0.0f);
+    REQUIRE(std::abs(texture.Level(4.0f / 80.0f) - 2.0f) < 1e-5f);
+    REQUIRE(texture.Level(100.0f) == 6.0f);
+
+    // A cone as wide as the triangle reads the coarsest level. UVs cover a quarter of the area per world unit.
+    mesh.tris.push_back(new Triangle({Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f(0.0f, 0.0f), Vector2f(1.0f, 0.0f), Vector2f(0.5f, 1.0f)}, &mesh));
+    mesh.SetO2W(Matrix4x4f::I);
+    SurfacePoint wide(mesh.tris[1], Vector3f::O, 0.25f, 0.25f);
+    wide.ApplyTextures(-Vector3f::Z, 2.0f, 1.0f, misses);
+    REQUIRE((wide.GetMaterial()->base_color - texture.Sample(wide.GetUV(), 6.0f, misses)).Length() < 1e-3f);
+    SurfacePoint narrow(mesh.tris[1], Vector3f::O, 0.25f, 0.25f);
+    narrow.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE((narrow.GetMaterial()->base_color - texture.Sample(narrow.GetUV(), 0.0f, misses)).Length() < 1e-3f);
+
+    // Textured hits shade like the material with the sampled parameters, nested media included.
+    RayState shading;
+    shading.SetFrame(Vector3f::Z, Vector3f::O);
+    const Vector3f V = Vector3f(0.3f, 0.0f, 1.0f).Normalized();
+    const Vector3f L = Vector3f(-0.5f, 0.2f, 1.0f).Normalized();
+    for (const bool color : {false, true})
+    {
+        PrincipledBSDF textured(Vector3f(0.8f, 0.5f, 0.2f), Vector3f::O, 0.3f, 0.2f, 0.5f);
+        (color ? textured.base_color_texture : textured.roughness_texture) = &texture;
+        textured.Prepare({1.33f});
+        SurfacePoint hit(mesh.tris[1], Vector3f::O, 0.25f, 0.25f, 0.0f, &textured);
+        shading.eta = textured.ior / 1.33f;
+        hit.ApplyTextures(-Vector3f::Z, 0.0f, shading.eta, misses);
+        PrincipledBSDF sampled = textured;
+        sampled.base_color_texture = sampled.roughness_texture = nullptr;
+        sampled.base_color = hit.GetMaterial()->base_color;
+        sampled.roughness = hit.GetMaterial()->roughness;
+        sampled.Prepare({1.33f});
+        for (const float eta : {shading.eta, 1.0f / textured.ior})
+        {
+            shading.eta = eta;
+            float pdf, sampled_pdf;
+            const Vector3f f = hit.GetMaterial()->Eval(shading, V, Vector3f::Z, L, pdf);
+            REQUIRE(f == sampled.Eval(shading, V, Vector3f::Z, L, sampled_pdf));
+            REQUIRE(pdf == sampled_pdf);
+            REQUIRE(hit.GetMaterial()->PDF(shading, V, Vector3f::Z, L) == sampled.PDF(shading, V, Vector3f::Z, L));
+        }
+    }
+
+    // Cones widen over distance and open at every bounce, never past a hemisphere.
+    RayState state;
+    state.cone_spread = 0.01f;
+    state.Travel(10.0f);
+    REQUIRE(std::abs(state.cone_width - 0.1f) < 1e-6f);
+    state.Scatter(1e6f);
+    REQUIRE(state.cone_spread > 0.01f);
+    REQUIRE(state.cone_spread < 0.02f);
+    state.Scatter(1e-3f);
+    REQUIRE(state.cone_spread == kPi<float>);
+
+    for (auto tri : mesh.tris)
+    {
+        delete tri;
+    }
+}
+
+TEST_CASE("Baked Procedural Texture Test")
+{
+    ProceduralTexture::CheckerBoard checker_board(4);
+    ProceduralTexture::Input<float> direct(&checker_board);
+    TileCache cache(64);
+    ProceduralTexture::BakedInput<float> baked(&checker_board, SizeN(64, 64), &cache);
+    REQUIRE(baked.LevelCount() == 7);
+
+    // Texel centers of the finest level match the texture.
+    uint64_t misses = 0;
+    for (int i = 0; i < 64; i += 7)
+    {
+        const Vector2f uv((float(i) + 0.5f) / 64.0f, (float(63 - i) + 0.5f) / 64.0f);
+        REQUIRE(baked.Sample(uv, 0.0f, misses) == direct.Sample(uv, 0.0f, misses));
+    }
+    REQUIRE(misses == 4);
+
+    // Baked once, then served from the cache.
+    baked.Sample(Vector2f(0.1f, 0.1f), 0.0f, misses);
+    REQUIRE(misses == 4);
+
+    // Coarse levels average over their area.
+    REQUIRE((baked.Sample(Vector2f(0.3f, 0.6f), 6.0f, misses) - Vector3f(0.5f, 0.5f, 0.5f)).Length() < 1e-5f);
+    REQUIRE(misses == 5);
+
+    baked.Invalidate();
+    baked.Sample(Vector2f(0.1f, 0.1f), 0.0f, misses);
+    REQUIRE(misses == 6);
+}
+
+// Texture rising along u by slope from value, unfiltered.
+struct RampTexture : public ITexture
+{
+    Vector3f value;
+    float slope = 0.0f;
+
+    const Vector3f Sample(const Vector2f &uv, const float /*lod*/, uint64_t & /*misses*/) const override
+    {
+        return value + Vector3f(slope * uv.x());
+    }
+
+    const float Level(const float /*footprint*/) const override
+    {
+        return 0.0f;
+    }
+};
+
+TEST_CASE("Normal Map Test")
+{
+    // UVs follow x and y on the first triangle, and run against x on the mirrored second one.
+    // Smooth, so both shade with the vertex normals although the second is wound the other way.
+    Mesh mesh;
+    mesh.smooth = true;
+    mesh.tris.push_back(new Triangle({Vector3f(0.0f, 0.0f, 0.0f), Vector3f(1.0f, 0.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f(0.0f, 0.0f), Vector2f(1.0f, 0.0f), Vector2f(0.0f, 1.0f)}, &mesh));
+    mesh.tris.push_back(new Triangle({Vector3f(0.0f, 0.0f, 0.0f), Vector3f(-1.0f, 0.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f)}, {Vector3f::Z, Vector3f::Z, Vector3f::Z}, {Vector2f(0.0f, 0.0f), Vector2f(1.0f, 0.0f), Vector2f(0.0f, 1.0f)}, &mesh));
+    mesh.SetO2W(Matrix4x4f::I);
+    mesh.ComputeTangents();
+    REQUIRE((mesh.tris[0]->TangentC(0.25f, 0.25f) - Vector3f::X).Length() < 1e-6f);
+    REQUIRE(mesh.tris[0]->tangent_sign == 1.0f);
+    REQUIRE((mesh.tris[1]->TangentC(0.25f, 0.25f) + Vector3f::X).Length() < 1e-6f);
+    REQUIRE(mesh.tris[1]->tangent_sign == -1.0f);
+
+    // Tangents follow the mesh.
+    mesh.SetO2W(AffineTransformation::RotationEulerXYZ({0.0f, 0.0f, Convert::DegreeToRadians(90)}));
+    REQUIRE((mesh.tris[0]->TangentC(0.25f, 0.25f) - Vector3f::Y).Length() < 1e-6f);
+    mesh.SetO2W(Matrix4x4f::I);
+
+    // Untextured materials shade with the interpolated normal.
+    PrincipledBSDF material;
+    material.Prepare();
+    mesh.tex = &material;
+    uint64_t misses = 0;
+    SurfacePoint plain(mesh.tris[0], Vector3f::O, 0.25f, 0.25f);
+    plain.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE(plain.GetShadingNormal() == Vector3f::Z);
+    REQUIRE(plain.GetShadingTangent() == Vector3f::O);
+
+    // (1, 0.5, 1) leans the normal halfway towards the tangent, which is mirrored on the second triangle.
+    RampTexture normal_map;
+    normal_map.value = Vector3f(1.0f, 0.5f, 1.0f);
+    material.normal_texture = &normal_map;
+    SurfacePoint mapped(mesh.tris[0], Vector3f::O, 0.25f, 0.25f);
+    mapped.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE((mapped.GetShadingNormal() - Vector3f(1.0f, 0.0f, 1.0f).Normalized()).Length() < 1e-5f);
+    REQUIRE(mapped.GetMaterial() == &material);
+    SurfacePoint mirrored(mesh.tris[1], Vector3f::O, 0.25f, 0.25f);
+    mirrored.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE((mirrored.GetShadingNormal() - Vector3f(-1.0f, 0.0f, 1.0f).Normalized()).Length() < 1e-5f);
+
+    // Heights rising by 0.5 world units per unit of u tilt the normal against the tangent.
+    RampTexture bump_map;
+    bump_map.slope = 1.0f;
+    material.normal_texture = nullptr;
+    material.bump_texture = &bump_map;
+    material.bump_scale = 0.5f;
+    SurfacePoint bumped(mesh.tris[0], Vector3f::O, 0.25f, 0.25f);
+    bumped.ApplyTextures(-Vector3f::Z, 0.0f, 1.0f, misses);
+    REQUIRE((bumped.GetShadingNormal() - Vector3f(-0.5f, 0.0f, 1.0f).Normalized()).Length() < 1e-3f);
+
+    // The frame follows rotated and stretched meshes, normals by the inverse transpose and tangents like directions.
+    const Matrix4x4f rotation = AffineTransformation::RotationEulerXYZ({Convert::DegreeToRadians(90), 0.0f, 0.0f});
+    auto Rotate = [&rotation](const Vector3f &direction) -> Vector3f
+    {
+        const Vector4f ret = rotation * Vector4f(direction.x(), direction.y(), direction.z(), 0.0f);
+        return Vector3f(ret[0], ret[1], ret[2]);
+    };
+    Matrix4x4f stretch = Matrix4x4f::I;
+    stretch[0][0] = 2.0f;
+    stretch[2][2] = 3.0f;
+    mesh.SetO2W(rotation * stretch);
+    REQUIRE((mesh.tris[0]->NormalC(0.25f, 0.25f) - Rotate(Vector3f::Z)).Length() < 1e-5f);
+    material.bump_texture = nullptr;
+    material.normal_texture = &normal_map;
+    SurfacePoint transformed(mesh.tris[0], Vector3f::O, 0.25f, 0.25f);
+    transformed.ApplyTextures(-Rotate(Vector3f::Z), 0.0f, 1.0f, misses);
+    REQUIRE((transformed.GetShadingNormal() - Rotate(Vector3f(1.0f, 0.0f, 1.0f).Normalized())).Length() < 1e-5f);
+
+    // And moving ones over the shutter interval.
+    mesh.SetO2W(Matrix4x4f::I, rotation);
+    REQUIRE((mesh.tris[0]->NormalC(0.25f, 0.25f, 1.0f) - Rotate(Vector3f::Z)).Length() < 1e-5f);
+    REQUIRE((mesh.tris[0]->NormalC(0.25f, 0.25f, 0.5f) - (Vector3f::Z + Rotate(Vector3f::Z)).Normalized()).Length() < 1e-5f);
+    mesh.SetO2W(Matrix4x4f::I, AffineTransformation::RotationEulerXYZ({0.0f, 0.0f, Convert::DegreeToRadians(90)}));
+    REQUIRE((mesh.tris[0]->TangentC(0.25f, 0.25f, 1.0f) - Vector3f::Y).Length() < 1e-5f);
+    mesh.SetO2W(Matrix4x4f::I);
+
+    // The shading frame is built once around the perturbed normal and shared by BSDF queries.
+    RayState state;
+    state.SetFrame(bumped.GetShadingNormal(), bumped.GetShadingTangent());
+    REQUIRE(std::abs(state.fftangent.Dot(state.ffnormal)) < 1e-6f);
+    REQUIRE(std::abs(state.fftangent.Length() - 1.0f) < 1e-6f);
+    REQUIRE((state.ffbitangent - Vector3f::Y).Length() < 1e-6f);
+    Vector3f T, B;
+    state.Frame(state.ffnormal, T, B);
+    REQUIRE(T == state.fftangent);
+    REQUIRE(B == state.ffbitangent);
+    state.Frame(Vector3f::X, T, B);
+    REQUIRE(std::abs(T.Dot(Vector3f::X)) < 1e-6f);
+    state.SetFrame(Vector3f::Z);
+    REQUIRE(std::abs(state.fftangent.Length() - 1.0f) < 1e-6f);
+
+    for (auto tri : mesh.tris)
+    {
+        delete tri;
+    }
+}
+
+TEST_CASE("Medium Test")
+{
+    RayState state;
+    REQUIRE(state.Ior() == 1.0f);
+    REQUIRE(state.Transmittance(5.0f) == Vector3f::White);
+
+    // A liquid absorbing red inside a clear glass.
+    PrincipledBSDF glass(Vector3f::White, Vector3f::O, 0.0f, 0.0f, 1.0f, 1.5f);
+    PrincipledBSDF liquid(Vector3f::White, Vector3f::O, 0.0f, 0.0f, 1.0f, 1.33f);
+    liquid.at_distance = 2.0f;
+    liquid.extinction = Vector3f(0.5f, 1.0f, 1.0f);
+    const Medium unprepared = liquid.GetMedium(2);
+    glass.Prepare();
+    liquid.Prepare();
+    REQUIRE(glass.GetMedium(1).absorption == Vector3f::O);
+    REQUIRE(std::abs(liquid.GetMedium(2).absorption.x() - std::log(2.0f) / 2.0f) < 1e-6f);
+    REQUIRE(liquid.GetMedium(2).absorption == unprepared.absorption);
+
+    state.Enter(glass.GetMedium(1));
+    REQUIRE(state.Transmittance(5.0f) == Vector3f::White);
+    state.Enter(liquid.GetMedium(2));
+    REQUIRE(state.Ior() == 1.33f);
+    const Vector3f transmittance = state.Transmittance(2.0f);
+    REQUIRE(std::abs(transmittance.x() - 0.5f) < 1e-6f);
+    REQUIRE(transmittance.y() == 1.0f);
+
+    // Leaving the liquid reveals the glass, leaving the glass from inside the liquid keeps the liquid.
+    REQUIRE(state.OuterIor(2) == 1.5f);
+    REQUIRE(state.OuterIor(1) == 1.33f);
+    state.Leave(1);
+    REQUIRE(state.Ior() == 1.33f);
+    REQUIRE(state.absorption == liquid.GetMedium(2).absorption);
+    state.Leave(1);
+    REQUIRE(state.medium_count == 1);
+    state.Leave(2);
+    REQUIRE(state.Ior() == 1.0f);
+    REQUIRE(state.absorption == Vector3f::O);
+    REQUIRE(state.OuterIor(2) == 1.0f);
+
+    // Too deep, the outermost medium is forgotten.
+    for (uint16_t i = 0; i <= RayState::kMaxMedia; ++i)
+    {
+        state.Enter({i, 1.0f + float(i), Vector3f::O});
+    }
+    REQUIRE(state.medium_count == RayState::kMaxMedia);
+    REQUIRE(state.media[0].material_id == 1);
+    REQUIRE(state.Ior() == 1.0f + float(RayState::kMaxMedia));
+}
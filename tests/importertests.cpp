@@ -8,10 +8,13 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 #include <RenderToy/rendertoy.h>
+#include <RenderToy/exception.h>
 
 #include <sstream>
 #include <string>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
 
 using namespace RenderToy;
 
@@ -42,3 +45,80 @@ TEST_CASE("SStream Feature Test")
         REQUIRE(c == 1);
     }
 }
+
+TEST_CASE("RGBE Importer")
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "rendertoy_importer_test.hdr").string();
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 2 +X 8\n";
+        // First scanline flat, 1.0 and 0.5 alternating.
+        for (int x = 0; x < 8; ++x)
+        {
+            const unsigned char rgbe[4] = {128, 128, 128, static_cast<unsigned char>(x % 2 == 0 ? 129 : 128)};
+            os.write(reinterpret_cast<const char *>(rgbe), 4);
+        }
+        // Second scanline run length encoded, red is 2.0 everywhere, the rest is zero.
+        const unsigned char rle[] = {2, 2, 0, 8, 128 + 8, 128, 128 + 8, 0, 128 + 8, 0, 128 + 8, 130};
+        os.write(reinterpret_cast<const char *>(rle), sizeof(rle));
+    }
+
+    World world;
+    RGBEImporter::Import(world, path);
+    // Importing again replaces the map.
+    const EnvironmentMap *first = world.environment;
+    RGBEImporter::Import(world, path);
+    std::filesystem::remove(path);
+    REQUIRE(world.environment != first);
+    REQUIRE(world.environment != nullptr);
+    REQUIRE(world.environment->Resolution() == SizeN(8, 2));
+    REQUIRE(std::abs((*world.environment)(0, 0).x() - 1.0f) < kFloatEpsilon);
+    REQUIRE(std::abs((*world.environment)(1, 0).y() - 0.5f) < kFloatEpsilon);
+    REQUIRE(std::abs((*world.environment)(7, 1).x() - 2.0f) < kFloatEpsilon);
+    REQUIRE((*world.environment)(7, 1).y() == 0.0f);
+    delete world.environment;
+    world.environment = nullptr;
+
+    REQUIRE_THROWS_AS(RGBEImporter::Import(world, path), Exception::InvalidImageException);
+}
+
+TEST_CASE("TARGA Importer")
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "rendertoy_importer_test.tga").string();
+    {
+        std::ofstream os(path, std::ios::binary);
+        // 3x2 run length encoded true color, bottom to top.
+        const unsigned char header[18] = {0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 2, 0, 24, 0};
+        os.write(reinterpret_cast<const char *>(header), 18);
+        // Bottom row: three blue pixels in a run.
+        const unsigned char run[] = {128 + 2, 255, 0, 0};
+        os.write(reinterpret_cast<const char *>(run), sizeof(run));
+        // Top row: white, black, red as raw pixels.
+        const unsigned char raw[] = {2, 255, 255, 255, 0, 0, 0, 0, 0, 255};
+        os.write(reinterpret_cast<const char *>(raw), sizeof(raw));
+    }
+
+    ImageTexture *texture = TARGAImporter::Import(path, false);
+    REQUIRE(texture->Resolution() == SizeN(3, 2));
+    REQUIRE(texture->LevelCount() == 2);
+    uint64_t misses = 0;
+    REQUIRE(texture->Texel(0, 0, 0, misses) == Vector3f::White);
+    REQUIRE(texture->Texel(0, 2, 0, misses) == Vector3f(1.0f, 0.0f, 0.0f));
+    REQUIRE(texture->Texel(0, 1, 1, misses) == Vector3f(0.0f, 0.0f, 1.0f));
+    REQUIRE(misses > 0);
+    delete texture;
+
+    // sRGB mid gray decodes to about 0.214.
+    {
+        std::ofstream os(path, std::ios::binary);
+        const unsigned char header[18] = {0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 8, 0};
+        os.write(reinterpret_cast<const char *>(header), 18);
+        os.put(char(128));
+    }
+    texture = TARGAImporter::Import(path);
+    REQUIRE(std::abs(texture->Texel(0, 0, 0, misses).y() - 0.2158f) < 1e-3f);
+    delete texture;
+
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(TARGAImporter::Import(path), Exception::InvalidImageException);
+}
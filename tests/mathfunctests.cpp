@@ -1,9 +1,11 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 #include <RenderToy/rendertoy.h>
+#include <RenderToy/pbr.h>
 
 #include <array>
 #include <cmath>
+#include <sstream>
 
 using namespace RenderToy;
 
@@ -257,4 +259,198 @@ TEST_CASE("SobelKernel")
     REQUIRE(knl.kernel_mat[0][0] == 1);
     REQUIRE(knl.kernel_mat[0][2] == 1);
     REQUIRE(knl.kernel_mat[2][1] == -2);
-}
\ No newline at end of file
+}
+
+TEST_CASE("AliasTable")
+{
+    AliasTable table({1.0f, 0.0f, 3.0f});
+    REQUIRE(table.Size() == 3);
+    REQUIRE(std::abs(table.PMF(0) - 0.25f) < kFloatEpsilon);
+    REQUIRE(table.PMF(1) == 0.0f);
+
+    int hits[3] = {0, 0, 0};
+    for (int i = 0; i < 1000; ++i)
+    {
+        float pmf;
+        auto index = table.Sample((float(i) + 0.5f) / 1000.0f, pmf);
+        REQUIRE(pmf == table.PMF(index));
+        ++hits[index];
+    }
+    REQUIRE(hits[1] == 0);
+    REQUIRE(hits[0] == 250);
+    REQUIRE(hits[2] == 750);
+}
+
+TEST_CASE("Distribution2D")
+{
+    Distribution1D line({1.0f, 0.0f, 3.0f, 0.0f});
+    REQUIRE(std::abs(line.Integral() - 1.0f) < kFloatEpsilon);
+    float pdf;
+    std::size_t index;
+    const float x = line.Sample(0.5f, pdf, index);
+    REQUIRE(index == 2);
+    REQUIRE(x >= 0.5f);
+    REQUIRE(x < 0.75f);
+    REQUIRE(std::abs(pdf - 3.0f) < kFloatEpsilon);
+    REQUIRE(line.PDF(0.3f) == 0.0f);
+
+    Distribution2D plane;
+    plane.Build({0.0f, 1.0f, 2.0f, 1.0f}, SizeN(2, 2));
+    for (int i = 0; i < 100; ++i)
+    {
+        const Vector2f p = plane.Sample((float(i) + 0.5f) / 100.0f, float((i * 37) % 100) / 100.0f, pdf);
+        REQUIRE(!(p.x() < 0.5f && p.y() < 0.5f));
+        REQUIRE(std::abs(pdf - plane.PDF(p)) < kFloatEpsilon);
+    }
+    REQUIRE(std::abs(plane.PDF(Vector2f(0.25f, 0.75f)) - 2.0f) < kFloatEpsilon);
+
+    EnvironmentMap environment(SizeN(8, 4));
+    environment(3, 1) = Vector3f::White;
+    environment.Prepare();
+    for (int i = 0; i < 100; ++i)
+    {
+        Vector3f direction;
+        const Vector3f radiance = environment.Sample((float(i) + 0.5f) / 100.0f, 0.5f, direction, pdf);
+        REQUIRE(radiance == Vector3f::White);
+        REQUIRE(environment.Eval(direction) == Vector3f::White);
+        REQUIRE(std::abs(pdf - environment.PDF(direction)) < kFloatEpsilon * pdf);
+    }
+}
+
+TEST_CASE("FresnelTable")
+{
+    for (const float eta : {1.0f / 1.5f, 1.0f / 1.45f, 1.0f, 1.33f, 1.45f, 1.5f, 2.42f})
+    {
+        const FresnelTable &table = FresnelTable::Get(eta);
+        REQUIRE(&table == &FresnelTable::Get(eta));
+        REQUIRE(table.Eta() == eta);
+        float max_error = 0.0f;
+        for (int i = -100; i <= 100000; ++i)
+        {
+            const float cos_theta_i = float(i) / 100000.0f;
+            max_error = std::max(max_error, std::abs(table.Eval(cos_theta_i) - DielectricFresnel(cos_theta_i, eta)));
+        }
+        REQUIRE(max_error < FresnelTable::kMaxError);
+        REQUIRE(table.Eval(1.0f) == DielectricFresnel(1.0f, eta));
+    }
+}
+
+TEST_CASE("RenderRegion")
+{
+    auto buckets = RenderRegion::Buckets(SizeN(100, 50), SizeN(32, 32), 2);
+    REQUIRE(buckets.size() == 8);
+    REQUIRE(buckets.back().origin.x == 96);
+    REQUIRE(buckets.back().origin.y == 32);
+    REQUIRE(buckets.back().size == SizeN(4, 18));
+    REQUIRE(buckets.back().overscan == 2);
+
+    std::size_t area = 0;
+    for (const auto &bucket : buckets)
+    {
+        area += bucket.size.Area();
+    }
+    REQUIRE(area == SizeN(100, 50).Area());
+
+    Image img(SizeN(8, 4));
+    img(5, 2) = Vector3f::White;
+    Image cropped = img.Crop(PointN(4, 1), SizeN(2, 2));
+    REQUIRE(cropped(1, 1) == Vector3f::White);
+    REQUIRE(cropped(0, 0) == Vector3f::O);
+
+    Image pasted(SizeN(8, 4));
+    pasted.Paste(cropped, PointN(4, 1));
+    REQUIRE(pasted(5, 2) == Vector3f::White);
+}
+
+TEST_CASE("Random")
+{
+    Random::Seed(7, 42, 3);
+    const float a = Random::Float();
+    const float b = Random::Float();
+    Random::Seed(7, 42, 3);
+    REQUIRE(Random::Float() == a);
+    REQUIRE(Random::Float() == b);
+
+    Random::Seed(7, 42, 4);
+    REQUIRE(Random::Float() != a);
+
+    Random::Seed(0);
+    for (int i = 0; i < 10000; ++i)
+    {
+        const float u = Random::Float();
+        REQUIRE(u >= 0.0f);
+        REQUIRE(u < 1.0f);
+    }
+}
+
+TEST_CASE("GuidingField")
+{
+    GuidingField field;
+    REQUIRE(field.Empty());
+    field.Reset(BoundingBox(Vector3f(-1.0f, -1.0f, -1.0f), Vector3f(1.0f, 1.0f, 1.0f)), 4);
+    REQUIRE(!field.Empty());
+
+    const Vector3f position(0.1f, 0.1f, 0.1f);
+    REQUIRE(!field.Trained(position));
+    field.Record(position, Vector3f::Z, 1.0f);
+    field.Update();
+    REQUIRE(field.Trained(position));
+    REQUIRE(!field.Trained(Vector3f(0.9f, 0.9f, 0.9f)));
+
+    // Nothing arrives from below the surface, and the learned direction is the most likely one.
+    REQUIRE(field.PDF(position, Vector3f::Z, -Vector3f::Z) == 0.0f);
+    REQUIRE(field.PDF(position, Vector3f::Z, Vector3f::Z) > field.PDF(position, Vector3f::Z, Vector3f::X));
+
+    Random::Seed(0);
+    for (int i = 0; i < 1000; ++i)
+    {
+        float pdf;
+        const Vector3f direction = field.Sample(position, Vector3f::Z, pdf);
+        REQUIRE(direction.z() >= 0.0f);
+        REQUIRE(std::abs(pdf - field.PDF(position, Vector3f::Z, direction)) < kFloatEpsilon * pdf);
+    }
+}
+
+TEST_CASE("RenderStats")
+{
+    RenderStats stats;
+    stats.pixels = 100;
+    stats.samples = 400;
+    stats.Thread().camera_rays += 400;
+    stats.Thread().shadow_rays += 100;
+    {
+        RenderStats::ScopedTimer timer(stats.Seconds(RenderStats::Phase::kRender));
+    }
+    REQUIRE(stats.Seconds(RenderStats::Phase::kRender) >= 0.0);
+    stats.Seconds(RenderStats::Phase::kRender) = 2.0;
+
+    REQUIRE(stats.Total().camera_rays == 400);
+    REQUIRE(stats.SamplesPerPixel() == 4.0);
+    REQUIRE(stats.RaysPerSecond() == 250.0);
+
+    std::ostringstream os;
+    stats.ExportJSON(os);
+    REQUIRE(os.str().find("\"rays_per_second\": 250") != std::string::npos);
+    REQUIRE(os.str().find("\"render\": 2") != std::string::npos);
+
+    stats.Reset();
+    REQUIRE(stats.Total().camera_rays == 0);
+    REQUIRE(stats.Seconds(RenderStats::Phase::kRender) == 0.0);
+}
+
+TEST_CASE("Trace")
+{
+    Trace::Clear();
+    {
+        Trace::Scope scope("TraceTest");
+    }
+    std::ostringstream os;
+    Trace::Write(os);
+    REQUIRE(os.str().find("{\"name\": \"TraceTest\", \"cat\": \"rendertoy\", \"ph\": \"X\"") != std::string::npos);
+    REQUIRE(os.str().find("\"thread_name\"") != std::string::npos);
+
+    Trace::Clear();
+    os.str("");
+    Trace::Write(os);
+    REQUIRE(os.str().find("TraceTest") == std::string::npos);
+}